@@ -0,0 +1,44 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <time.h>
+
+/* helpers shared by bench.c and tune.c */
+
+static inline double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline uint32_t rand_u32(void)
+{
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+/* a random number of exactly nmemb limbs */
+static inline void mpi_random(mpi_t rop, size_t nmemb)
+{
+	uint32_t *words = malloc(nmemb * sizeof(uint32_t));
+
+	if (words == NULL) {
+		abort();
+	}
+
+	for (size_t n = 0; n < nmemb; ++n) {
+		words[n] = rand_u32();
+	}
+
+	words[nmemb - 1] |= UINT32_C(1) << 30;
+
+	mpi_import(rop, nmemb, -1, sizeof(uint32_t), 0, 1, words);
+
+	free(words);
+}
+
+#endif
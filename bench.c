@@ -0,0 +1,223 @@
+#include "mpi.h"
+#include "bench-util.h"
+#include "collatz.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#ifdef __x86_64__
+#	include <x86intrin.h>
+#endif
+
+/* every measurement repeats the operation for at least this long */
+#define MIN_SECONDS 0.2
+
+static uint64_t cycles(void)
+{
+#ifdef __x86_64__
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+struct operands {
+	size_t limbs;
+	mpi_t a, b, r, s;
+	char *str;
+};
+
+static void op_add(struct operands *o)
+{
+	mpi_add(o->r, o->a, o->b);
+}
+
+static void op_mul(struct operands *o)
+{
+	mpi_mul(o->r, o->a, o->b);
+}
+
+static void op_sqr(struct operands *o)
+{
+	mpi_sqr(o->r, o->a);
+}
+
+/* 2n / n limbs */
+static void op_fdiv_qr(struct operands *o)
+{
+	mpi_fdiv_qr(o->r, o->s, o->a, o->b);
+}
+
+static void op_gcd(struct operands *o)
+{
+	mpi_gcd(o->r, o->a, o->b);
+}
+
+static void op_set_str(struct operands *o)
+{
+	mpi_set_str(o->r, o->str, 10);
+}
+
+static void op_get_str(struct operands *o)
+{
+	char *str;
+
+	gmp_asprintf(&str, "%Zd", o->a);
+	free(str);
+}
+
+struct benchmark {
+	const char *name;
+	void (*func)(struct operands *);
+	/* largest operand size in limbs (the quadratic algorithms are capped) */
+	size_t max_limbs;
+};
+
+static const struct benchmark benchmarks[] = {
+	{ "mpi_add", op_add, 1000000 },
+	{ "mpi_mul", op_mul, 1000000 },
+	{ "mpi_sqr", op_sqr, 1000000 },
+	{ "mpi_fdiv_qr", op_fdiv_qr, 30000 },
+	{ "mpi_gcd", op_gcd, 1000 },
+	{ "mpi_set_str", op_set_str, 1000000 },
+	{ "mpi_to_cstr", op_get_str, 30000 },
+};
+
+static void operands_init(struct operands *o, const struct benchmark *b, size_t limbs)
+{
+	o->limbs = limbs;
+	o->str = NULL;
+
+	mpi_init(o->a);
+	mpi_init(o->b);
+	mpi_init(o->r);
+	mpi_init(o->s);
+
+	if (b->func == op_fdiv_qr) {
+		mpi_random(o->a, 2 * limbs);
+	} else {
+		mpi_random(o->a, limbs);
+	}
+
+	mpi_random(o->b, limbs);
+
+	if (b->func == op_set_str) {
+		gmp_asprintf(&o->str, "%Zd", o->a);
+	}
+}
+
+static void operands_clear(struct operands *o)
+{
+	mpi_clear(o->a);
+	mpi_clear(o->b);
+	mpi_clear(o->r);
+	mpi_clear(o->s);
+	free(o->str);
+}
+
+static void measure(const struct benchmark *b, size_t limbs, int first)
+{
+	struct operands o;
+
+	operands_init(&o, b, limbs);
+
+	/* warm up */
+	b->func(&o);
+
+	uint64_t reps = 0;
+	double start = now(), elapsed;
+	uint64_t c = cycles();
+
+	do {
+		b->func(&o);
+		reps++;
+		elapsed = now() - start;
+	} while (elapsed < MIN_SECONDS);
+
+	c = cycles() - c;
+
+	printf("%s\t\t{ \"name\": \"%s\", \"limbs\": %zu, \"reps\": %" PRIu64 ", \"ns_per_op\": %.1f, ",
+		first ? "" : ",\n", b->name, limbs, reps, elapsed * 1e9 / (double)reps);
+
+	if (c != 0) {
+		printf("\"cycles_per_limb\": %.2f }", (double)c / (double)reps / (double)limbs);
+	} else {
+		printf("\"cycles_per_limb\": null }");
+	}
+
+	fflush(stdout);
+
+	operands_clear(&o);
+}
+
+static void collatz_workload(void)
+{
+	mpi_t n, max;
+	mpi_init(n);
+	mpi_init(max);
+
+	uint64_t count = 1 << 24;
+
+	mpi_set_u32(n, 1);
+	mpi_set_u32(max, 1);
+
+	double start = now();
+	collatz_sweep(n, count, max, NULL, NULL);
+	double elapsed = now() - start;
+
+	printf("\t\t{ \"name\": \"collatz_sweep\", \"values\": %" PRIu64 ", \"seconds\": %.3f, \"ns_per_value\": %.2f }",
+		count, elapsed, elapsed * 1e9 / (double)count);
+
+	mpi_clear(n);
+	mpi_clear(max);
+}
+
+static void llt_workload(void)
+{
+	mp_bitcnt_t p = 44497;
+
+	double start = now();
+	int prime = mpi_llt(p);
+	double elapsed = now() - start;
+
+	printf(",\n\t\t{ \"name\": \"mpi_llt\", \"p\": %zu, \"prime\": %d, \"seconds\": %.3f, \"ns_per_iteration\": %.0f }",
+		p, prime, elapsed, elapsed * 1e9 / (double)(p - 2));
+}
+
+/*
+ * Usage: bench [max-limbs]
+ *
+ * Times the basic operations over operand sizes from 1 limb up to max-limbs
+ * (default 10^6) in half-decade steps, then two end-to-end workloads, and
+ * prints the results as JSON on stdout.
+ */
+int main(int argc, char *argv[])
+{
+	size_t max_limbs = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 1000000;
+
+	srand(1);
+
+	printf("{\n\t\"benchmarks\": [\n");
+
+	int first = 1;
+
+	for (size_t i = 0; i < sizeof(benchmarks) / sizeof(*benchmarks); ++i) {
+		const struct benchmark *b = &benchmarks[i];
+
+		for (size_t limbs = 1, k = 0; limbs <= max_limbs && limbs <= b->max_limbs; ++k, limbs = k % 2 ? limbs * 3 : limbs / 3 * 10) {
+			measure(b, limbs, first);
+			first = 0;
+		}
+	}
+
+	printf("\n\t],\n\t\"workloads\": [\n");
+
+	collatz_workload();
+	llt_workload();
+
+	printf("\n\t]\n}\n");
+
+	mpi_pow_cache_clear();
+
+	return 0;
+}
@@ -0,0 +1,566 @@
+#include "collatz.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+#define UINT128_MAX (~(uint128_t)0)
+
+/* 3^80 is the largest power of 3 below 2^128 */
+#define POW3_MAX 80
+
+/* bignum powers 3^alpha cached for alpha below this */
+#define POW3_CACHE 256
+
+/* a jump advances the trajectory by this many steps of T(n) = n/2 or (3n+1)/2 */
+#define JUMP_K 16
+
+#define JUMP_MASK (((uint128_t)1 << JUMP_K) - 1)
+
+/* ceil(1.5^JUMP_K); T^i(n) + 1 <= 1.5^i (n + 1) bounds the values skipped by a jump */
+#define JUMP_BOUND 657
+
+/* starting values claimed by a worker at a time */
+#define CHUNK_SIZE 4096
+
+/*
+ * T^k(2^k a + b) = 3^c a + d for the c odd steps among the first k steps of b.
+ * Every n = b (mod 2^k) not below n_min falls below itself within these k steps.
+ */
+struct jump {
+	uint128_t n_min;
+	uint32_t d;
+	uint32_t c;
+};
+
+static uint128_t pow3[POW3_MAX + 1];
+
+/* the largest k with k * 3^alpha <= UINT128_MAX */
+static uint128_t pow3_limit[POW3_MAX + 1];
+
+static mpi_t pow3_mpi[POW3_CACHE];
+
+static struct jump *jumps;
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void tables_init(void)
+{
+	pow3[0] = 1;
+
+	for (int i = 1; i <= POW3_MAX; ++i) {
+		pow3[i] = pow3[i - 1] * 3;
+	}
+
+	for (int i = 0; i <= POW3_MAX; ++i) {
+		pow3_limit[i] = UINT128_MAX / pow3[i];
+	}
+
+	for (int i = 0; i < POW3_CACHE; ++i) {
+		mpi_init(pow3_mpi[i]);
+		mpi_ui_pow_u32(pow3_mpi[i], 3, (uint32_t)i);
+	}
+
+	jumps = malloc(((size_t)1 << JUMP_K) * sizeof(struct jump));
+
+	if (jumps == NULL) {
+		abort();
+	}
+
+	for (uint64_t b = 0; b < ((uint64_t)1 << JUMP_K); ++b) {
+		/* T^j(n) = (3^c n + e) / 2^j for n = b (mod 2^k), j <= k */
+		uint64_t t = b, c = 0, e = 0;
+
+		jumps[b].n_min = UINT128_MAX;
+
+		for (int j = 0; j < JUMP_K; ++j) {
+			if (t & 1) {
+				t = (3 * t + 1) / 2;
+				e = 3 * e + ((uint64_t)1 << j);
+				c++;
+			} else {
+				t = t / 2;
+			}
+
+			/* T^(j+1)(n) < n iff (2^(j+1) - 3^c) n > e */
+			if (jumps[b].n_min == UINT128_MAX && (uint64_t)pow3[c] < ((uint64_t)2 << j)) {
+				jumps[b].n_min = e / (((uint64_t)2 << j) - (uint64_t)pow3[c]) + 1;
+			}
+		}
+
+		jumps[b].c = (uint32_t)c;
+		jumps[b].d = (uint32_t)t;
+	}
+}
+
+static int ctz_u128(uint128_t n)
+{
+	uint64_t lo = (uint64_t)n;
+
+	if (lo != 0) {
+		return __builtin_ctzll(lo);
+	}
+
+	return 64 + __builtin_ctzll((uint64_t)(n >> 64));
+}
+
+static void mpi_set_u128(mpi_t rop, uint128_t op)
+{
+	mpi_set_u64(rop, (uint64_t)(op >> 64));
+	mpi_mul_2exp(rop, rop, 64);
+	mpi_add_u64(rop, rop, (uint64_t)op);
+}
+
+/* returns 0 if op does not fit into 128 bits */
+static int mpi_get_u128(uint128_t *rop, const mpi_t op)
+{
+	if (mpi_sizeinbase(op, 2) > 128) {
+		return 0;
+	}
+
+	mpi_t t;
+
+	mpi_init(t);
+
+	mpi_fdiv_q_2exp(t, op, 64);
+
+	*rop = (uint128_t)mpi_get_u64(t) << 64;
+
+	mpi_fdiv_r_2exp(t, op, 64);
+
+	*rop |= mpi_get_u64(t);
+
+	mpi_clear(t);
+
+	return 1;
+}
+
+/*
+ * Follow the trajectory of *n in native arithmetic while it is not below stop,
+ * raising *max. Stretches that cannot climb above max(floor, *max) are skipped
+ * k steps at a time, so *max is exact only where it exceeds floor.
+ * Returns 0 once the trajectory falls below stop, or 1 when the next step
+ * would overflow; *n then holds the value to continue from.
+ */
+static int trajectory_u128(uint128_t *n, uint128_t *max, uint128_t floor, uint128_t stop)
+{
+	uint128_t m = *n;
+	uint128_t limit = (floor > *max ? floor : *max) / JUMP_BOUND;
+
+	while (m >= stop) {
+		/*
+		 * with 3^k < 2^26, a jump from below 2^118 cannot overflow; one from
+		 * below 2^k could land in the cycle 1, 2 and jump there forever
+		 */
+		if (m < limit && (m >> 118) == 0 && (m >> JUMP_K) != 0) {
+			const struct jump *jump = &jumps[m & JUMP_MASK];
+
+			m = pow3[jump->c] * (m >> JUMP_K) + jump->d;
+			continue;
+		}
+
+		if (m == UINT128_MAX) {
+			*n = m;
+			return 1;
+		}
+
+		uint128_t k = m + 1;
+		int alpha = ctz_u128(k);
+
+		k >>= alpha;
+
+		if (alpha > POW3_MAX || k > pow3_limit[alpha]) {
+			*n = m;
+			return 1;
+		}
+
+		m = k * pow3[alpha] - 1;
+
+		if (m > *max) {
+			*max = m;
+
+			if (m > floor) {
+				limit = m / JUMP_BOUND;
+			}
+		}
+
+		m >>= ctz_u128(m);
+	}
+
+	*n = m;
+
+	return 0;
+}
+
+/* the bignum pipeline of collatz_max(), continuing from n until it fits into 100 bits */
+static void trajectory_mpi(mpi_t n, mpi_t max)
+{
+	mpi_t a;
+
+	mpi_init(a);
+
+	while (mpi_sizeinbase(n, 2) > 100) {
+		mpi_add_u32(n, n, 1);
+
+		mp_bitcnt_t alpha = mpi_scan1(n, 0);
+
+		mpi_fdiv_q_2exp(n, n, alpha);
+
+		if (alpha < POW3_CACHE) {
+			mpi_mul(n, n, pow3_mpi[alpha]);
+		} else {
+			mpi_ui_pow_u32(a, 3, (uint32_t)alpha);
+			mpi_mul(n, n, a);
+		}
+
+		mpi_sub_u32(n, n, 1);
+
+		if (mpi_cmp(n, max) > 0) {
+			mpi_set(max, n);
+		}
+
+		mpi_fdiv_q_2exp(n, n, mpi_scan1(n, 0));
+	}
+
+	mpi_clear(a);
+}
+
+/* the trajectory maximum, in native arithmetic as long as possible */
+struct peak {
+	int big;
+	uint128_t v;
+	mpi_t m;
+};
+
+/*
+ * The maximum of the trajectory of n until it falls below stop; exact where it
+ * exceeds floor (UINT128_MAX when the floor does not fit into 128 bits).
+ */
+static void peak_of(struct peak *peak, uint128_t n, uint128_t floor, uint128_t stop)
+{
+	uint128_t max = n;
+
+	peak->big = 0;
+
+	while (trajectory_u128(&n, &max, floor, stop) != 0) {
+		mpi_t t;
+
+		mpi_init(t);
+
+		mpi_set_u128(t, n);
+
+		if (!peak->big) {
+			mpi_set_u128(peak->m, max);
+			peak->big = 1;
+		}
+
+		trajectory_mpi(t, peak->m);
+
+		mpi_get_u128(&n, t);
+
+		mpi_clear(t);
+
+		/* no native value can raise the maximum any more */
+		max = UINT128_MAX;
+	}
+
+	if (peak->big) {
+		peak->big = !mpi_get_u128(&peak->v, peak->m);
+	} else {
+		peak->v = max;
+	}
+}
+
+static int peak_cmp(const struct peak *a, const struct peak *b)
+{
+	if (a->big != b->big) {
+		return a->big ? +1 : -1;
+	}
+
+	if (a->big) {
+		return mpi_cmp(a->m, b->m);
+	}
+
+	return a->v < b->v ? -1 : a->v > b->v;
+}
+
+static void peak_get(mpi_t rop, const struct peak *peak)
+{
+	if (peak->big) {
+		mpi_set(rop, peak->m);
+	} else {
+		mpi_set_u128(rop, peak->v);
+	}
+}
+
+static void peak_set(struct peak *peak, const mpi_t op)
+{
+	peak->big = !mpi_get_u128(&peak->v, op);
+
+	if (peak->big) {
+		mpi_set(peak->m, op);
+	}
+}
+
+struct record {
+	uint128_t n;
+	struct peak max;
+};
+
+/* records of one chunk, relative to the floor of the sweep */
+struct chunk {
+	struct record *records;
+	size_t nmemb;
+};
+
+struct sweep {
+	uint128_t n;
+	uint64_t count;
+	struct peak floor;
+	int abandon;
+	struct chunk *chunks;
+	size_t nchunks;
+	size_t next;
+	pthread_mutex_t mutex;
+};
+
+static void sweep_chunk(struct sweep *sweep, size_t c)
+{
+	struct chunk *chunk = &sweep->chunks[c];
+	struct peak max, peak;
+	uint64_t begin = (uint64_t)c * CHUNK_SIZE;
+	uint64_t end = begin + CHUNK_SIZE < sweep->count ? begin + CHUNK_SIZE : sweep->count;
+
+	mpi_init(max.m);
+	mpi_init(peak.m);
+
+	max.big = sweep->floor.big;
+	max.v = sweep->floor.v;
+	if (max.big) {
+		mpi_set(max.m, sweep->floor.m);
+	}
+
+	uint128_t floor = max.big ? UINT128_MAX : max.v;
+	uint128_t limit = floor / JUMP_BOUND;
+
+	for (uint64_t i = begin; i < end; ++i) {
+		uint128_t n = sweep->n + i;
+
+		/* n falls below itself without climbing above the floor */
+		if (sweep->abandon && n >= jumps[n & JUMP_MASK].n_min && n < limit) {
+			continue;
+		}
+
+		peak_of(&peak, n, floor, sweep->abandon && n > 2 ? n : 2);
+
+		if (peak_cmp(&peak, &max) > 0) {
+			chunk->records = realloc(chunk->records, (chunk->nmemb + 1) * sizeof(struct record));
+
+			if (chunk->records == NULL) {
+				abort();
+			}
+
+			struct record *record = &chunk->records[chunk->nmemb++];
+
+			record->n = n;
+			record->max.big = peak.big;
+			record->max.v = peak.v;
+			mpi_init(record->max.m);
+			if (peak.big) {
+				mpi_set(record->max.m, peak.m);
+			}
+
+			max.big = peak.big;
+			max.v = peak.v;
+			if (peak.big) {
+				mpi_set(max.m, peak.m);
+			}
+
+			floor = max.big ? UINT128_MAX : max.v;
+			limit = floor / JUMP_BOUND;
+		}
+	}
+
+	mpi_clear(max.m);
+	mpi_clear(peak.m);
+}
+
+/* workers claim chunks in increasing order until none is left */
+static void *sweep_worker(void *arg)
+{
+	struct sweep *sweep = arg;
+
+	while (1) {
+		pthread_mutex_lock(&sweep->mutex);
+		size_t c = sweep->next++;
+		pthread_mutex_unlock(&sweep->mutex);
+
+		if (c >= sweep->nchunks) {
+			break;
+		}
+
+		sweep_chunk(sweep, c);
+	}
+
+	return NULL;
+}
+
+void collatz_path_max(mpi_t max, const mpi_t n)
+{
+	uint128_t m;
+
+	pthread_once(&tables_once, tables_init);
+
+	if (mpi_get_u128(&m, n) && m != 0) {
+		struct peak peak;
+
+		mpi_init(peak.m);
+
+		peak_of(&peak, m, 0, 2);
+		peak_get(max, &peak);
+
+		mpi_clear(peak.m);
+
+		return;
+	}
+
+	mpi_t t;
+
+	mpi_init(t);
+
+	mpi_set(t, n);
+	mpi_set(max, n);
+
+	trajectory_mpi(t, max);
+
+	/* the rest of the trajectory fits into 128 bits again, and may climb above max */
+	struct peak peak;
+
+	mpi_init(peak.m);
+
+	mpi_get_u128(&m, t);
+	peak_of(&peak, m, 0, 2);
+	peak_get(t, &peak);
+
+	if (mpi_cmp(t, max) > 0) {
+		mpi_set(max, t);
+	}
+
+	mpi_clear(peak.m);
+	mpi_clear(t);
+}
+
+/*
+ * With abandon set, trajectories stop once they fall below their starting
+ * value: the rest is that of a smaller value, which max already covers.
+ */
+static void sweep_run(const mpi_t n, uint64_t count, mpi_t max, int abandon,
+	void (*record)(const mpi_t n, const mpi_t max, void *arg), void *arg)
+{
+	struct sweep sweep;
+
+	pthread_once(&tables_once, tables_init);
+
+	if (!mpi_get_u128(&sweep.n, n) || sweep.n == 0 || UINT128_MAX - sweep.n < count) {
+		fprintf(stderr, "Starting values out of range\n");
+		abort();
+	}
+
+	sweep.count = count;
+	sweep.abandon = abandon;
+	mpi_init(sweep.floor.m);
+	peak_set(&sweep.floor, max);
+	sweep.nchunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	sweep.chunks = calloc(sweep.nchunks + 1, sizeof(struct chunk));
+	sweep.next = 0;
+	pthread_mutex_init(&sweep.mutex, NULL);
+
+	if (sweep.chunks == NULL) {
+		abort();
+	}
+
+	size_t nthreads = (size_t)mpi_get_num_threads();
+
+	if (nthreads > sweep.nchunks) {
+		nthreads = sweep.nchunks;
+	}
+
+	pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+
+	if (threads == NULL && nthreads != 0) {
+		abort();
+	}
+
+	size_t nstarted = 0;
+
+	for (size_t t = 1; t < nthreads; ++t) {
+		if (pthread_create(&threads[nstarted], NULL, sweep_worker, &sweep) == 0) {
+			nstarted++;
+		}
+	}
+
+	sweep_worker(&sweep);
+
+	for (size_t t = 0; t < nstarted; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+
+	free(threads);
+
+	/* chunk records are relative to the floor; keep those above every earlier chunk */
+	struct peak best = sweep.floor;
+	mpi_t rn, rmax;
+
+	mpi_init(rn);
+	mpi_init(rmax);
+
+	for (size_t c = 0; c < sweep.nchunks; ++c) {
+		struct chunk *chunk = &sweep.chunks[c];
+
+		for (size_t i = 0; i < chunk->nmemb; ++i) {
+			struct record *r = &chunk->records[i];
+
+			if (peak_cmp(&r->max, &best) > 0) {
+				best.big = r->max.big;
+				best.v = r->max.v;
+				if (best.big) {
+					mpi_set(best.m, r->max.m);
+				}
+
+				if (record != NULL) {
+					mpi_set_u128(rn, r->n);
+					peak_get(rmax, &r->max);
+					record(rn, rmax, arg);
+				}
+			}
+
+			mpi_clear(r->max.m);
+		}
+
+		free(chunk->records);
+	}
+
+	peak_get(max, &best);
+
+	mpi_clear(rn);
+	mpi_clear(rmax);
+	mpi_clear(best.m);
+
+	free(sweep.chunks);
+	pthread_mutex_destroy(&sweep.mutex);
+}
+
+void collatz_sweep(const mpi_t n, uint64_t count, mpi_t max,
+	void (*record)(const mpi_t n, const mpi_t max, void *arg), void *arg)
+{
+	/* no value below 1 escapes the sweep */
+	sweep_run(n, count, max, mpi_cmp_u32(n, 1) == 0, record, arg);
+}
+
+void collatz_sweep_resume(const mpi_t n, uint64_t count, mpi_t max,
+	void (*record)(const mpi_t n, const mpi_t max, void *arg), void *arg)
+{
+	sweep_run(n, count, max, 1, record, arg);
+}
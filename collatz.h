@@ -0,0 +1,28 @@
+#ifndef COLLATZ_H
+#define COLLATZ_H
+
+#include "mpi.h"
+
+/* Trajectory maximum of n, as computed by collatz_max() in main.c */
+void collatz_path_max(mpi_t max, const mpi_t n);
+
+/*
+ * Sweep the starting values [n, n + count) on mpi_get_num_threads() threads
+ * and report the path records among them: values whose trajectory maximum
+ * exceeds that of every smaller value in the range, and the initial value of
+ * max. The callback is invoked in increasing order of n, from the calling
+ * thread. On return, max holds the highest trajectory maximum seen.
+ */
+void collatz_sweep(const mpi_t n, uint64_t count, mpi_t max,
+	void (*record)(const mpi_t n, const mpi_t max, void *arg), void *arg);
+
+/*
+ * collatz_sweep() continuing a sweep of [1, n): the initial value of max must
+ * not be below the trajectory maximum of any value under n (e.g. the maximum of
+ * the last path record before n). Trajectories are then abandoned once they
+ * fall below their starting value, which is much faster.
+ */
+void collatz_sweep_resume(const mpi_t n, uint64_t count, mpi_t max,
+	void (*record)(const mpi_t n, const mpi_t max, void *arg), void *arg);
+
+#endif
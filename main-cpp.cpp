@@ -0,0 +1,281 @@
+#include "mpi.hpp"
+#include <cassert>
+#include <cstdio>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+using mpixx::integer;
+
+int main()
+{
+	printf("integer (construction, conversion)\n");
+	{
+		integer a;
+		assert(a == 0 && !a);
+
+		integer b(UINT64_C(12345678901234567890));
+		assert(b.get_u64() == UINT64_C(12345678901234567890));
+		assert(b.str() == "12345678901234567890");
+
+		integer c("340282366920938463463374607431768211456");
+		assert(c.bits() == 129);
+		assert(c == integer(1) << 128);
+
+		std::ostringstream os;
+		os << c;
+		assert(os.str() == "340282366920938463463374607431768211456");
+
+		a = 42;
+		assert(a.get_u32() == 42 && a);
+
+		/* a literal zero is a number, not a null string */
+		integer z(0);
+		assert(z == integer() && !z);
+		assert(integer(0U) == 0 && integer(0L) == 0 && integer(7UL) == 7);
+		assert(integer(std::string("0")) == integer(0));
+	}
+
+	printf("integer (copy, move)\n");
+	{
+		integer a("123456789012345678901234567890");
+		integer b(a);
+		assert(b == a && b.get()->data != a.get()->data);
+
+		/* a move takes the limbs and leaves an empty zero */
+		const uint32_t *data = a.get()->data;
+		integer c(std::move(a));
+		assert(c.get()->data == data);
+		assert(a.get()->data == NULL && a == 0);
+
+		integer d;
+		d = std::move(c);
+		assert(d.get()->data == data && d == b);
+
+		a = d;
+		assert(a == d && a.get()->data != d.get()->data);
+
+		swap(a, b);
+		assert(a == b);
+
+		std::vector<integer> v;
+		for (uint32_t i = 0; i < 100; ++i) {
+			v.push_back(integer(i) << 100);
+		}
+		for (uint32_t i = 0; i < 100; ++i) {
+			assert(v[i] >> 100 == i);
+		}
+	}
+
+	printf("integer (reserve, capacity)\n");
+	{
+		integer a(5);
+		a.reserve(10000);
+		assert(a.capacity() >= 10000 && a == 5);
+
+		/* copy assignment keeps the storage */
+		integer b(7);
+		a = b;
+		assert(a.capacity() >= 10000 && a == 7);
+
+		a.shrink_to_fit();
+		assert(a.capacity() == 31 && a == 7);
+	}
+
+	printf("integer (arithmetic)\n");
+	{
+		integer a("98765432109876543210987654321");
+		integer b("12345678901234567890");
+		integer c(1000003);
+
+		/* against the C interface */
+		mpi_t r, t;
+		mpi_init(r);
+		mpi_init(t);
+
+		mpi_mul(r, a.get(), b.get());
+		mpi_add(r, r, c.get());
+		mpi_sub(r, r, b.get());
+		assert(mpi_cmp(r, integer(a * b + c - b).get()) == 0);
+		assert(mpi_cmp(r, integer(c + a * b - b).get()) == 0);
+		assert(mpi_cmp(r, integer(b * a - b + c).get()) == 0);
+
+		mpi_fdiv_qr(r, t, a.get(), b.get());
+		assert(mpi_cmp(r, integer(a / b).get()) == 0);
+		assert(mpi_cmp(t, integer(a % b).get()) == 0);
+		assert(a / b * b + a % b == a);
+
+		assert((a + 1) - a == 1);
+		assert(a - (a - 1) == 1);
+		assert((a - 1) - (a - 2) == 1);
+		assert((a + b) + (b + c) == a + b * 2 + c);
+		assert((a + b) * (a - b) == a * a - b * b);
+		assert(a * 3 == a + a + a);
+		assert((a << 10) >> 10 == a);
+		assert(a / 7 * 7 + a % integer(7) == a);
+
+		integer d(a);
+		d *= d;
+		assert(d == a * a);
+		assert(pow(a, 2) == d);
+		assert(sqrt(d) == a);
+		assert(gcd(a * c, b * c) % c == 0);
+
+		++d;
+		--d;
+		assert(d == a * a);
+
+		mpi_clear(r);
+		mpi_clear(t);
+	}
+
+	printf("integer (expressions)\n");
+	{
+		integer a("98765432109876543210987654321");
+		integer b("12345678901234567890");
+		integer c(1000003);
+		integer s, t;
+
+		/* fused into mpi_addmul*, mpi_submul* and back */
+		s = a;
+		s += b * c;
+		s -= b * c;
+		assert(s == a);
+		s += b * 12345u;
+		s -= b * 12345u;
+		assert(s == a);
+		s += b << 100;
+		assert(s == a + (b << 100));
+		s -= b << 100;
+		assert(s == a);
+		s = a + b * c + (c << 40) + 7 - (b * 3 - c);
+		t = a;
+		t += b * c;
+		t += c << 40;
+		t += 7;
+		t -= b * 3;
+		t += c;
+		assert(s == t);
+
+		/* the destination as an operand, anywhere in the expression */
+		s = a;
+		s = s * s + s;
+		assert(s == a * a + a);
+		s = a;
+		s = s + s * s;
+		assert(s == a * a + a);
+		s = a;
+		s = a * a * 2 - s;
+		assert(s + a == a * a * 2);
+		s = a;
+		s = s * (s + 1);
+		assert(s == a * a + a);
+		s = a;
+		s = (s + 1) * s;
+		assert(s == a * a + a);
+		s = b;
+		s = a - s * 2;
+		assert(s + b * 2 == a);
+		s = b;
+		s = (a << 1) - (s << 1);
+		assert(s == (a - b) * 2);
+		s = a;
+		s += s * s;
+		assert(s == a * a + a);
+		s = a;
+		s -= s;
+		assert(s == 0);
+		s = a;
+		s = ((s >> 3) << 3) + s % 8;
+		assert(s == a);
+		s = b;
+		s = (a + s) * (a - s);
+		assert(s == a * a - b * b);
+
+		/* scalars on either side */
+		assert(1 + a == a + 1 && 3 * a == a * 3);
+		assert(5 - integer(3) == 2);
+
+		/* scalars above 2^32 are not truncated */
+		const uint64_t big = UINT64_C(5000000000);
+		integer x(UINT64_C(1099511627776));
+		assert(x + big == UINT64_C(1104511627776) && big + x == UINT64_C(1104511627776));
+		assert(x - big == UINT64_C(1094511627776));
+		assert(x * big == integer("5497558138880000000000") && big * x == x * big);
+		assert(UINT64_MAX - integer(big) == UINT64_MAX - big);
+		s = b;
+		s = s + a * big - big + 1;
+		assert(s == b + a * integer(big) - integer(big) + 1);
+		s += a * big;
+		s -= a * big;
+		s -= big * a;
+		assert(s == b - integer(big) + 1);
+		s = a * big;
+		assert(s * integer(1) == integer(big) * a);
+
+		/* the Lucas-Lehmer test of main.c, written with expressions */
+		static const struct {
+			mp_bitcnt_t p;
+			int prime;
+		} llt[] = {
+			{ 3, 1 }, { 11, 0 }, { 13, 1 }, { 61, 1 }, { 67, 0 }, { 89, 1 }, { 107, 1 }, { 127, 1 }, { 521, 1 }, { 523, 0 }
+		};
+
+		for (size_t i = 0; i < sizeof(llt) / sizeof(llt[0]); ++i) {
+			mp_bitcnt_t p = llt[i].p;
+			integer m = (integer(1) << p) - 1;
+			integer q;
+
+			s = 4;
+
+			for (size_t j = 0; j < p - 2; ++j) {
+				s = s * s + m - 2;
+
+				q = s >> p;
+				s -= q << p;
+				s += q;
+
+				while (s >= m) {
+					s -= m;
+				}
+			}
+
+			assert((s == 0) == llt[i].prime);
+		}
+	}
+
+	printf("integer (comparison)\n");
+	{
+		integer a(10), b(20);
+
+		assert(a < b && a <= b && b > a && b >= a && a != b);
+		assert(a == 10 && 10 == a && a < 11 && 9 < a);
+		assert(!(a > b) && !(a == b));
+
+		/* 64-bit scalars are compared in full, not truncated */
+		const uint64_t big = UINT64_C(1) << 40;
+		integer c(big);
+		assert(c == big && big == c && c != big + 1 && c != (uint64_t)0);
+		assert(c < big + 1 && big - 1 < c && c > UINT32_MAX && UINT64_MAX > c);
+		assert(c * c > UINT64_MAX && UINT64_MAX < c * c && c * c != 0);
+		assert(cmp(c, big) == 0 && cmp(c, big - 1) > 0 && cmp(big * 2, c) > 0);
+
+		/* and in the compound operators */
+		integer d(5);
+		d += big;
+		assert(d == big + 5);
+		d -= big;
+		assert(d == 5);
+		d *= big;
+		assert(d == 5 * big);
+		d /= big;
+		assert(d == 5);
+		d *= UINT64_C(5000000000);
+		assert(d == UINT64_C(25000000000));
+		assert(d / UINT64_C(5000000000) == 5);
+	}
+
+	mpi_pow_cache_clear();
+
+	return 0;
+}
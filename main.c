@@ -1,4 +1,7 @@
 #include "mpi.h"
+#include "collatz.h"
+#include "mersenne.h"
+#include "mpi-params.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <inttypes.h>
@@ -15,6 +18,16 @@ uint64_t rand_u64()
 	 return (uint64_t)rand() << 48 ^ (uint64_t)rand() << 24 ^ (uint64_t)rand();
 }
 
+void mpi_random(mpi_t rop, size_t nmemb)
+{
+	mpi_set_u32(rop, 0);
+
+	for (size_t n = 0; n < nmemb; ++n) {
+		mpi_mul_2exp(rop, rop, 31);
+		mpi_add_u32(rop, rop, rand_u32() & 0x7fffffff);
+	}
+}
+
 mp_bitcnt_t mpi_ctz(const mpi_t n)
 {
 	return mpi_scan1(n, 0);
@@ -78,6 +91,33 @@ int collatz_max(const char *n_str, const char *max_str)
 	return ret;
 }
 
+struct records {
+	uint64_t n[16];
+	mpi_t max[16];
+	size_t nmemb;
+};
+
+void collect_record(const mpi_t n, const mpi_t max, void *arg)
+{
+	struct records *records = arg;
+
+	assert(records->nmemb < 16);
+
+	records->n[records->nmemb] = mpi_get_u64(n);
+	mpi_init(records->max[records->nmemb]);
+	mpi_set(records->max[records->nmemb], max);
+	records->nmemb++;
+}
+
+void collect_exponent(mp_bitcnt_t p, void *arg)
+{
+	struct records *records = arg;
+
+	assert(records->nmemb < 16);
+
+	records->n[records->nmemb++] = p;
+}
+
 int llt(mp_bitcnt_t p)
 {
 	mpi_t s;
@@ -127,6 +167,37 @@ int main()
 {
 	srand(42);
 
+	/* before anything reads the parameters, which happens once */
+	printf("mpi_get_param (environment)\n");
+	{
+		mpi_t a, b;
+		mpi_init(a);
+		mpi_init(b);
+
+		/* out of range: these would recurse without end */
+		setenv("MPI_MUL_KARATSUBA_THRESHOLD", "1", 1);
+		setenv("MPI_SET_STR_THRESHOLD", "0", 1);
+		setenv("MPI_GET_STR_THRESHOLD", "0", 1);
+
+		assert(mpi_get_param("MUL_KARATSUBA_THRESHOLD") == 2);
+		assert(mpi_get_param("SET_STR_THRESHOLD") == 1);
+		assert(mpi_get_param("GET_STR_THRESHOLD") == 1);
+
+		char *str;
+		mpi_set_str(a, "123456789012345678901234567890", 10);
+		mpi_mul(b, a, a);
+		gmp_asprintf(&str, "%Zd", b);
+		assert(strcmp(str, "15241578753238836750495351562536198787501905199875019052100") == 0);
+		free(str);
+
+		mpi_set_param("MUL_KARATSUBA_THRESHOLD", MUL_KARATSUBA_THRESHOLD);
+		mpi_set_param("SET_STR_THRESHOLD", SET_STR_THRESHOLD);
+		mpi_set_param("GET_STR_THRESHOLD", GET_STR_THRESHOLD);
+
+		mpi_clear(a);
+		mpi_clear(b);
+	}
+
 	printf("mpi_init, mpi_clear\n");
 	{
 		mpi_t r;
@@ -152,6 +223,150 @@ int main()
 		mpi_clear(r);
 	}
 
+	printf("mpi_import, mpi_export\n");
+	{
+		static const unsigned char be[] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0xfe, 0xdc };
+		static const uint16_t le[] = { 0xfedc, 0xcdef, 0x89ab, 0x4567, 0x0123 };
+		unsigned char buf[16];
+		size_t count;
+		mpi_t r, s;
+		mpi_init(r);
+		mpi_init(s);
+
+		mpi_import(r, sizeof(be), 1, 1, 1, 0, be);
+		mpi_set_str(s, "5373003642731685215964", 10);
+		assert(mpi_cmp(r, s) == 0);
+		mpi_import(r, 5, -1, 2, 0, 0, le);
+		assert(mpi_cmp(r, s) == 0);
+
+		assert(mpi_export(buf, &count, 1, 1, 1, 0, s) == buf);
+		assert(count == 10 && memcmp(buf, be, 10) == 0);
+		assert(mpi_export(buf, &count, -1, 4, -1, 0, s) == buf);
+		assert(count == 3 && buf[0] == 0xdc && buf[1] == 0xfe && buf[2] == 0xef && buf[4] == 0xab && buf[8] == 0x23 && buf[11] == 0);
+
+		/* 4 nails: one hex digit per byte */
+		mpi_set_u32(s, 0xfedcba);
+		assert(mpi_export(buf, &count, 1, 1, 0, 4, s) == buf);
+		assert(count == 6 && buf[0] == 0xf && buf[5] == 0xa);
+		for (size_t i = 0; i < count; ++i) {
+			buf[i] |= 0xf0;
+		}
+		mpi_import(r, count, 1, 1, 0, 4, buf);
+		assert(mpi_cmp(r, s) == 0);
+
+		mpi_set_u32(s, 0);
+		assert(mpi_export(NULL, &count, 1, 8, 0, 0, s) == NULL && count == 0);
+		mpi_import(r, 0, 1, 8, 0, 0, NULL);
+		assert(mpi_cmp_u32(r, 0) == 0);
+
+		for (size_t size = 1; size <= 9; ++size) {
+			mpi_random(s, 50);
+			void *p = mpi_export(NULL, &count, -1, size, 1, size, s);
+			mpi_import(r, count, -1, size, 1, size, p);
+			assert(mpi_cmp(r, s) == 0);
+			free(p);
+		}
+
+		mpi_clear(r);
+		mpi_clear(s);
+	}
+
+	printf("mpi_view\n");
+	{
+		static const uint32_t limbs[] = { 0x7fffffff, 0x7fffffff, 3 };
+		mpi_t v, r;
+		mpi_init(r);
+
+		mpi_add_u32(r, mpi_view(v, limbs, 3), 1);
+		assert(mpi_sizeinbase(r, 2) == 65);
+		assert(mpi_cmp(v, r) < 0 && v->data == limbs);
+
+		mpi_clear(r);
+	}
+
+	printf("mpi_enlarge, mpi_compact (huge blocks)\n");
+	{
+		mpi_t r, s;
+		mpi_init(r);
+		mpi_init(s);
+
+		/* 2^(31 * 600000) - 1, a block of more than 2 MiB */
+		size_t nmemb = 600000;
+		mpi_enlarge(r, nmemb);
+		for (size_t n = 0; n < nmemb; ++n) {
+			assert(r->data[n] == 0);
+			r->data[n] = 0x7fffffff;
+		}
+
+		/* the carry grows it by one limb within the rounded-up 4 MiB */
+		const uint32_t *data = r->data;
+		mpi_add_u32(r, r, 1);
+		assert(r->data == data && r->nmemb == nmemb + 1 && r->data[nmemb] == 1 && r->data[0] == 0);
+
+		for (size_t n = nmemb + 2; n <= ((size_t)4 << 20) / sizeof(uint32_t); n += 1000) {
+			mpi_enlarge(r, n);
+			assert(r->data == data && r->data[n - 1] == 0 && r->data[nmemb] == 1);
+		}
+
+		/* shrinking within the same rounded size keeps the block, growing back zeroes */
+		r->data[r->nmemb - 1] = 9;
+		mpi_set(s, r);
+		mpi_fdiv_r_2exp(s, s, 31 * (nmemb + 1));
+		mpi_swap(r, s);
+		mpi_compact(s);
+		assert(s->data[s->nmemb - 1] == 9);
+		s->data[s->nmemb - 1] = 0;
+		size_t full = s->nmemb;
+		mpi_compact(s);
+		assert(s->nmemb == nmemb + 1);
+		data = s->data;
+		mpi_enlarge(s, full);
+		assert(s->data == data && s->data[full - 1] == 0);
+
+		mpi_clear(r);
+		mpi_clear(s);
+	}
+
+	printf("mpi_init_mmap\n");
+	{
+		mpi_t r, s;
+		mpi_init(s);
+
+		remove("main-mmap.mpi");
+
+		mpi_init_mmap(r, "main-mmap.mpi", 64);
+		assert(r->nmemb == 0 && mpi_cmp_u32(r, 0) == 0);
+		mpi_set_u32(r, 12345);
+		mpi_ui_pow_u32(s, 3, 10000);
+		mpi_mul(r, r, s);
+		mpi_mul(r, r, r);
+		mpi_mul(s, s, s);
+		mpi_mul_u32(s, s, 12345);
+		mpi_mul_u32(s, s, 12345);
+		assert(mpi_cmp(r, s) == 0 && r->mmap != NULL);
+		mpi_clear(r);
+
+		/* the value survives in the file */
+		mpi_init_mmap(r, "main-mmap.mpi", 0);
+		assert(mpi_cmp(r, s) == 0);
+		mpi_add_u32(r, r, 1);
+		mpi_clear(r);
+
+		FILE *stream = fopen("main-mmap.mpi", "rb");
+		char magic[8];
+		uint64_t nmemb;
+		uint32_t limb;
+		assert(stream != NULL);
+		assert(fread(magic, 8, 1, stream) == 1 && memcmp(magic, "MPIMMAP1", 8) == 0);
+		assert(fread(&nmemb, 8, 1, stream) == 1 && 31 * nmemb >= mpi_sizeinbase(s, 2));
+		assert(fseek(stream, 4096, SEEK_SET) == 0 && fread(&limb, 4, 1, stream) == 1 && limb == s->data[0] + 1);
+		fclose(stream);
+
+		remove("main-mmap.mpi");
+
+		mpi_clear(s);
+	}
+
 	printf("mpi_set_str\n");
 	{
 		mpi_t s;
@@ -169,6 +384,38 @@ int main()
 		mpi_clear(s);
 	}
 
+	printf("mpi_set_str (long)\n");
+	{
+		char str[5001];
+		mpi_t s, t;
+		mpi_init(s);
+		mpi_init(t);
+
+		for (size_t i = 0; i < 5000; ++i) {
+			str[i] = (char)('0' + rand_u32() % 10);
+		}
+		str[5000] = 0;
+
+		mpi_set_u32(t, 0);
+		for (size_t i = 0; i < 5000; ++i) {
+			mpi_mul_u32(t, t, 10);
+			mpi_add_u32(t, t, (uint32_t)(str[i] - '0'));
+		}
+
+		mpi_set_str(s, str, 10);
+		assert(mpi_cmp(s, t) == 0);
+
+		str[0] = '1';
+		memset(str + 1, '0', 4095);
+		str[4096] = 0;
+		mpi_set_str(s, str, 10);
+		mpi_ui_pow_u32(t, 10, 4095);
+		assert(mpi_cmp(s, t) == 0);
+
+		mpi_clear(s);
+		mpi_clear(t);
+	}
+
 	printf("mpi_swap\n");
 	{
 		mpi_t r, s, t;
@@ -346,6 +593,80 @@ int main()
 		mpi_clear(t);
 	}
 
+	printf("mpi_mul (multithreaded)\n");
+	{
+		mpi_t a, b, r, s;
+		mpi_init(a);
+		mpi_init(b);
+		mpi_init(r);
+		mpi_init(s);
+
+		mpi_random(a, 4096);
+		mpi_random(b, 600);
+
+		mpi_set_num_threads(1);
+		mpi_mul(r, a, b);
+
+		mpi_set_num_threads(4);
+		assert(mpi_get_num_threads() == 4);
+		mpi_mul(s, a, b);
+		assert(mpi_cmp(r, s) == 0);
+
+		assert(mpz_fdiv_u32(s, 1000003) == (uint64_t)mpz_fdiv_u32(a, 1000003) * mpz_fdiv_u32(b, 1000003) % 1000003);
+
+		mpi_set_num_threads(1);
+
+		mpi_clear(a);
+		mpi_clear(b);
+		mpi_clear(r);
+		mpi_clear(s);
+	}
+
+	printf("mpi_mul, mpi_sqr (transform)\n");
+	{
+		mpi_t a, b, b0, b1, r, s;
+		mpi_init(a);
+		mpi_init(b);
+		mpi_init(b0);
+		mpi_init(b1);
+		mpi_init(r);
+		mpi_init(s);
+
+		mpi_random(a, 4096);
+		mpi_random(b, 3000);
+
+		/* a * b = a * b1 * 2^(31 * 1500) + a * b0, with schoolbook/Karatsuba sub-products */
+		mpi_fdiv_q_2exp(b1, b, 31 * 1500);
+		mpi_fdiv_r_2exp(b0, b, 31 * 1500);
+		mpi_mul(b1, a, b1);
+		mpi_mul(b0, a, b0);
+		mpi_mul_2exp(r, b1, 31 * 1500);
+		mpi_add(r, r, b0);
+
+		mpi_mul(s, a, b);
+		assert(mpi_cmp(r, s) == 0);
+
+		mpi_set_num_threads(4);
+		mpi_mul(s, b, a);
+		assert(mpi_cmp(r, s) == 0);
+		mpi_set_num_threads(1);
+
+		mpi_mul(r, a, a);
+		mpi_sqr(s, a);
+		assert(mpi_cmp(r, s) == 0);
+
+		mpi_set_u32(r, 0);
+		mpi_sqr(s, r);
+		assert(mpi_cmp_u32(s, 0) == 0);
+
+		mpi_clear(a);
+		mpi_clear(b);
+		mpi_clear(b0);
+		mpi_clear(b1);
+		mpi_clear(r);
+		mpi_clear(s);
+	}
+
 	printf("mpi_fdiv_q_2exp\n");
 	{
 		mpi_t r, s;
@@ -436,6 +757,62 @@ int main()
 		mpi_clear(r);
 	}
 
+	printf("mpi_get_param, mpi_set_param\n");
+	{
+		mpi_t a, b, r, s;
+		mpi_init(a);
+		mpi_init(b);
+		mpi_init(r);
+		mpi_init(s);
+
+		size_t karatsuba = mpi_get_param("MUL_KARATSUBA_THRESHOLD");
+		size_t ntt = mpi_get_param("MUL_NTT_THRESHOLD");
+
+		mpi_random(a, 1000);
+		mpi_random(b, 900);
+
+		mpi_mul(r, a, b);
+
+		/* every algorithm gives the same product */
+		mpi_set_param("MUL_NTT_THRESHOLD", 100);
+		mpi_set_param("MUL_KARATSUBA_THRESHOLD", 2);
+		assert(mpi_get_param("MUL_KARATSUBA_THRESHOLD") == 2);
+		mpi_mul(s, a, b);
+		assert(mpi_cmp(r, s) == 0);
+
+		mpi_set_param("MUL_NTT_THRESHOLD", SIZE_MAX);
+		mpi_set_param("MUL_KARATSUBA_THRESHOLD", SIZE_MAX);
+		mpi_mul(s, a, b);
+		assert(mpi_cmp(r, s) == 0);
+
+		/* clamped to the smallest values that end the recursions */
+		mpi_set_param("MUL_KARATSUBA_THRESHOLD", 0);
+		assert(mpi_get_param("MUL_KARATSUBA_THRESHOLD") == 2);
+		mpi_mul(s, a, b);
+		assert(mpi_cmp(r, s) == 0);
+
+		mpi_set_param("MUL_KARATSUBA_THRESHOLD", karatsuba);
+		mpi_set_param("MUL_NTT_THRESHOLD", ntt);
+
+		char *str;
+		size_t set_str = mpi_get_param("SET_STR_THRESHOLD");
+		size_t get_str = mpi_get_param("GET_STR_THRESHOLD");
+		mpi_set_param("SET_STR_THRESHOLD", 0);
+		mpi_set_param("GET_STR_THRESHOLD", 0);
+		assert(mpi_get_param("SET_STR_THRESHOLD") == 1 && mpi_get_param("GET_STR_THRESHOLD") == 1);
+		mpi_set_str(s, "9876543210987654321098765432109876543210", 10);
+		gmp_asprintf(&str, "%Zd", s);
+		assert(strcmp(str, "9876543210987654321098765432109876543210") == 0);
+		free(str);
+		mpi_set_param("SET_STR_THRESHOLD", set_str);
+		mpi_set_param("GET_STR_THRESHOLD", get_str);
+
+		mpi_clear(a);
+		mpi_clear(b);
+		mpi_clear(r);
+		mpi_clear(s);
+	}
+
 	printf("mpi_mul_2exp\n");
 	{
 		mpi_t r, s;
@@ -490,6 +867,94 @@ int main()
 		mpi_clear(r);
 	}
 
+	printf("mpi_addmul, mpi_submul\n");
+	{
+		mpi_t a, b, r, s, t;
+		mpi_init(a);
+		mpi_init(b);
+		mpi_init(r);
+		mpi_init(s);
+		mpi_init(t);
+
+		for (size_t i = 0; i < 200; ++i) {
+			mpi_random(a, 1 + rand() % 40);
+			mpi_random(b, 1 + rand() % 40);
+			mpi_random(r, rand() % 60);
+
+			uint32_t u = rand_u32();
+			mp_bitcnt_t k = (mp_bitcnt_t)(rand() % 200);
+
+			/* against the separate operations */
+			mpi_set(s, r);
+			mpi_addmul(s, a, b);
+			mpi_mul(t, a, b);
+			mpi_add(t, t, r);
+			assert(mpi_cmp(s, t) == 0);
+			mpi_submul(s, a, b);
+			assert(mpi_cmp(s, r) == 0);
+
+			mpi_set(s, r);
+			mpi_addmul_u32(s, a, u);
+			mpi_mul_u32(t, a, u);
+			mpi_add(t, t, r);
+			assert(mpi_cmp(s, t) == 0);
+			mpi_submul_u32(s, a, u);
+			assert(mpi_cmp(s, r) == 0);
+
+			mpi_set(s, r);
+			mpi_addmul_2exp(s, a, k);
+			mpi_mul_2exp(t, a, k);
+			mpi_add(t, t, r);
+			assert(mpi_cmp(s, t) == 0);
+			mpi_submul_2exp(s, a, k);
+			assert(mpi_cmp(s, r) == 0);
+
+			/* rop as an operand */
+			mpi_set(s, a);
+			mpi_addmul(s, s, s);
+			mpi_sqr(t, a);
+			mpi_add(t, t, a);
+			assert(mpi_cmp(s, t) == 0);
+
+			mpi_set(s, a);
+			mpi_addmul_u32(s, s, u);
+			mpi_mul_u32(t, a, u);
+			mpi_add(t, t, a);
+			assert(mpi_cmp(s, t) == 0);
+
+			mpi_set(s, a);
+			mpi_addmul_2exp(s, s, k);
+			mpi_mul_2exp(t, a, k);
+			mpi_add(t, t, a);
+			assert(mpi_cmp(s, t) == 0);
+
+			/* in place, the scalar operations stop with the carry */
+			mpi_set(s, a);
+			mpi_add_u32(s, s, u);
+			mpi_sub_u32(s, s, u);
+			assert(mpi_cmp(s, a) == 0);
+		}
+
+		mpi_set_u32(r, 0);
+		mpi_set_u32(a, 0);
+		mpi_addmul_2exp(r, a, 100);
+		mpi_addmul_u32(r, a, 7);
+		assert(mpi_cmp_u32(r, 0) == 0);
+
+		/* 2^31 - 1 times 2^32 - 1 with a carry out of every limb */
+		mpi_set_str(a, "2305843009213693951", 10);
+		mpi_set_str(r, "2305843009213693951", 10);
+		mpi_addmul_u32(r, a, UINT32_MAX);
+		mpi_set_str(t, "9903520314283042194898026496", 10);
+		assert(mpi_cmp(r, t) == 0);
+
+		mpi_clear(a);
+		mpi_clear(b);
+		mpi_clear(r);
+		mpi_clear(s);
+		mpi_clear(t);
+	}
+
 	printf("mpi_scan1\n");
 	{
 		mpi_t s;
@@ -542,10 +1007,105 @@ int main()
 		mpi_set_str(r, "1219211305094648479473193481872927834667576992593770717189298225284399541977208231315051", 10);
 		assert(mpi_cmp(s, r) == 0);
 
+		mpi_ui_pow_u32(s, 1024, 10);
+		mpi_set_str(r, "1267650600228229401496703205376", 10);
+		assert(mpi_cmp(s, r) == 0);
+
+		mpi_ui_pow_u32(s, 12, 25);
+		mpi_set_str(r, "953962166440690129601298432", 10);
+		assert(mpi_cmp(s, r) == 0);
+
+		mpi_ui_pow_u32(s, 1000003, 5);
+		mpi_set_str(r, "1000015000090000270000405000243", 10);
+		assert(mpi_cmp(s, r) == 0);
+
+		mpi_ui_pow_u32(s, 0, 0);
+		assert(mpi_cmp_u32(s, 1) == 0);
+		mpi_ui_pow_u32(s, 0, 7);
+		assert(mpi_cmp_u32(s, 0) == 0);
+
 		mpi_clear(s);
 		mpi_clear(r);
 	}
 
+	printf("mpi_pow_u32\n");
+	{
+		mpi_t b, r, s;
+		mpi_init(b);
+		mpi_init(r);
+		mpi_init(s);
+
+		for (int i = 0; i < 40; ++i) {
+			uint32_t exp = i < 20 ? (uint32_t)i : rand_u32() % 300;
+
+			mpi_random(b, 1 + i % 4);
+			mpi_mul_2exp(b, b, (mp_bitcnt_t)(i % 3) * 17);
+
+			mpi_set_u32(s, 1);
+			for (uint32_t e = 0; e < exp; ++e) {
+				mpi_mul(s, s, b);
+			}
+
+			mpi_pow_u32(r, b, exp);
+			assert(mpi_cmp(r, s) == 0);
+
+			/* in place */
+			mpi_pow_u32(b, b, exp);
+			assert(mpi_cmp(b, s) == 0);
+		}
+
+		mpi_set_u32(b, 0);
+		mpi_pow_u32(r, b, 0);
+		assert(mpi_cmp_u32(r, 1) == 0);
+		mpi_pow_u32(r, b, 5);
+		assert(mpi_cmp_u32(r, 0) == 0);
+
+		mpi_set_u32(b, 1024);
+		mpi_pow_u32(r, b, 7);
+		assert(mpi_sizeinbase(r, 2) == 71 && mpi_scan1(r, 0) == 70);
+
+		mpi_set_u32(b, 12);
+		mpi_pow_u32(r, b, 25);
+		mpi_set_str(s, "953962166440690129601298432", 10);
+		assert(mpi_cmp(r, s) == 0);
+
+		mpi_ui_pow_u32(r, 1000003, 1000);
+		mpi_set_u32(b, 1000003);
+		mpi_pow_u32(s, b, 1000);
+		assert(mpi_cmp(r, s) == 0);
+		mpi_fdiv_qr_u32(s, b, r, 1000003);
+		assert(mpi_cmp_u32(b, 0) == 0);
+
+		mpi_clear(b);
+		mpi_clear(r);
+		mpi_clear(s);
+	}
+
+	printf("mpi_pow_cache\n");
+	{
+		mpi_t r, p;
+		mpi_init(r);
+		mpi_init(p);
+
+		mpi_set_str(r, "100000000", 10);
+		assert(mpi_cmp(mpi_pow_cache(p, 10, 3), r) == 0);
+
+		mpi_mul(r, r, r);
+		assert(mpi_cmp(mpi_pow_cache(p, 10, 4), r) == 0);
+
+		/* the result lives in scratch, so it outlives a clear */
+		assert(mpi_pow_cache(p, 10, 4) == p);
+
+		mpi_pow_cache_clear();
+		assert(mpi_cmp(p, r) == 0);
+
+		mpi_ui_pow_u32(r, 3, 4);
+		assert(mpi_cmp(mpi_pow_cache(p, 3, 2), r) == 0);
+
+		mpi_clear(r);
+		mpi_clear(p);
+	}
+
 	printf("mpi_divisible_u32_p\n");
 	{
 		mpi_t s;
@@ -656,6 +1216,290 @@ int main()
 		mpi_clear(r);
 	}
 
+	printf("mpi_mod_u32_many, mpi_divisible_by_any\n");
+	{
+		mpi_t n;
+		mpi_init(n);
+
+		size_t counts[] = { 1, 2, 3, 7, 100, 1000, 5000 };
+
+		for (size_t c = 0; c < sizeof(counts) / sizeof(*counts); ++c) {
+			size_t count = counts[c];
+			uint32_t *divisors = malloc(count * sizeof(uint32_t));
+			uint32_t *residues = malloc(count * sizeof(uint32_t));
+
+			assert(divisors != NULL && residues != NULL);
+
+			for (size_t k = 0; k < count; ++k) {
+				divisors[k] = k % 5 == 0 ? 1 + rand_u32() % 1000 : k % 5 == 1 ? UINT32_MAX - (uint32_t)k : 1 + rand_u32();
+			}
+
+			for (size_t size = 0; size < 300; size = size * 3 + 1) {
+				mpi_random(n, size);
+				mpi_mod_u32_many(residues, n, divisors, count);
+
+				for (size_t k = 0; k < count; ++k) {
+					assert(residues[k] == mpz_fdiv_u32(n, divisors[k]));
+				}
+			}
+
+			free(divisors);
+			free(residues);
+		}
+
+		/* 1009 (2^100 + 1) is divisible by 17, not by 3 */
+		uint32_t primes[168];
+		size_t count = 0;
+
+		for (uint32_t p = 2; p < 1000; ++p) {
+			int prime = 1;
+			for (uint32_t d = 2; d * d <= p; ++d) {
+				prime = prime && p % d != 0;
+			}
+			if (prime) {
+				primes[count++] = p;
+			}
+		}
+
+		assert(count == 168);
+
+		mpi_set_u32(n, 1009);
+		assert(!mpi_divisible_by_any(n, primes, count));
+		mpi_mul_2exp(n, n, 100);
+		mpi_add_u32(n, n, 1009);
+		assert(!mpi_divisible_by_any(n, primes + 1, 1));
+		assert(mpi_divisible_by_any(n, primes, count));
+		assert(!mpi_divisible_by_any(n, primes, 0));
+
+		mpi_clear(n);
+	}
+
+	printf("mpi_sqrtrem, mpi_sqrt\n");
+	{
+		mpi_t a, s, r, t;
+		mpi_init(a);
+		mpi_init(s);
+		mpi_init(r);
+		mpi_init(t);
+
+		for (int i = 0; i < 200; ++i) {
+			if (i < 40) {
+				mpi_set_u32(a, (uint32_t)i);
+				mpi_mul_2exp(a, a, (mp_bitcnt_t)i * 3);
+			} else {
+				mpi_random(a, 1 + rand_u32() % (i < 190 ? 40 : 2000));
+			}
+
+			mpi_sqrtrem(s, r, a);
+
+			/* a = s^2 + r, 0 <= r <= 2 s */
+			mpi_sqr(t, s);
+			mpi_add(t, t, r);
+			assert(mpi_cmp(t, a) == 0);
+			mpi_mul_2exp(t, s, 1);
+			assert(mpi_cmp(r, t) <= 0);
+
+			mpi_sqrt(t, a);
+			assert(mpi_cmp(t, s) == 0);
+		}
+
+		/* (2^100 + 1)^2 - 1 */
+		mpi_set_u32(a, 1);
+		mpi_mul_2exp(a, a, 100);
+		mpi_add_u32(a, a, 1);
+		mpi_sqr(a, a);
+		mpi_sub_u32(a, a, 1);
+		mpi_sqrtrem(s, r, a);
+		mpi_set_u32(t, 1);
+		mpi_mul_2exp(t, t, 100);
+		assert(mpi_cmp(s, t) == 0);
+		mpi_mul_2exp(t, t, 1);
+		assert(mpi_cmp(r, t) == 0);
+
+		/* in place */
+		mpi_set_str(a, "152415787532388367504942236884722755800955129", 10);
+		mpi_sqrt(a, a);
+		mpi_set_str(t, "12345678901234567890123", 10);
+		assert(mpi_cmp(a, t) == 0);
+
+		mpi_clear(a);
+		mpi_clear(s);
+		mpi_clear(r);
+		mpi_clear(t);
+	}
+
+	printf("mpi_root\n");
+	{
+		mpi_t a, x, t;
+		mpi_init(a);
+		mpi_init(x);
+		mpi_init(t);
+
+		for (int i = 0; i < 200; ++i) {
+			uint32_t n = 1 + (uint32_t)i % 9;
+
+			if (i >= 180) {
+				n = 1 + rand_u32() % 200;
+			}
+
+			mpi_random(a, 1 + rand_u32() % 60);
+
+			int exact = mpi_root(x, a, n);
+
+			/* x^n <= a < (x + 1)^n */
+			mpi_pow_u32(t, x, n);
+			assert(mpi_cmp(t, a) <= 0);
+			assert(exact == (mpi_cmp(t, a) == 0));
+			mpi_add_u32(t, x, 1);
+			mpi_pow_u32(t, t, n);
+			assert(mpi_cmp(t, a) > 0);
+
+			/* exact powers, and one less */
+			mpi_pow_u32(a, x, n);
+			assert(mpi_root(t, a, n) == 1);
+			assert(mpi_cmp(t, x) == 0);
+
+			if (n > 1 && mpi_cmp_u32(x, 1) > 0) {
+				mpi_sub_u32(a, a, 1);
+				assert(mpi_root(t, a, n) == 0);
+				mpi_add_u32(t, t, 1);
+				assert(mpi_cmp(t, x) == 0);
+			}
+		}
+
+		mpi_set_u32(a, 0);
+		assert(mpi_root(x, a, 5) == 1 && mpi_cmp_u32(x, 0) == 0);
+		mpi_set_u32(a, 1);
+		assert(mpi_root(x, a, 5) == 1 && mpi_cmp_u32(x, 1) == 0);
+		mpi_set_u32(a, 31);
+		assert(mpi_root(x, a, 5) == 0 && mpi_cmp_u32(x, 1) == 0);
+		mpi_set_u32(a, 32);
+		assert(mpi_root(x, a, 5) == 1 && mpi_cmp_u32(x, 2) == 0);
+
+		/* roots of a degree past the bit length are 1 */
+		mpi_set_u32(a, 12345);
+		assert(mpi_root(x, a, 4000000000) == 0 && mpi_cmp_u32(x, 1) == 0);
+		assert(mpi_root(x, a, 14) == 0 && mpi_cmp_u32(x, 1) == 0);
+		assert(mpi_root(x, a, 13) == 0 && mpi_cmp_u32(x, 2) == 0);
+		mpi_set_u32(a, 1);
+		assert(mpi_root(x, a, 4000000000) == 1 && mpi_cmp_u32(x, 1) == 0);
+
+		/* in place */
+		mpi_ui_pow_u32(a, 3, 1000);
+		assert(mpi_root(a, a, 40) == 1);
+		mpi_set_u32(t, 3);
+		mpi_pow_u32(t, t, 25);
+		assert(mpi_cmp(a, t) == 0);
+
+		mpi_clear(a);
+		mpi_clear(x);
+		mpi_clear(t);
+	}
+
+	printf("mpi_perfect_square_p\n");
+	{
+		mpi_t a, s;
+		mpi_init(a);
+		mpi_init(s);
+
+		int squares = 0;
+
+		for (uint32_t i = 0; i < 10000; ++i) {
+			mpi_set_u32(a, i);
+			squares += mpi_perfect_square_p(a);
+		}
+
+		assert(squares == 100);
+
+		for (int i = 0; i < 200; ++i) {
+			mpi_random(s, 1 + rand_u32() % 100);
+			mpi_sqr(a, s);
+			assert(mpi_perfect_square_p(a));
+			mpi_add_u32(a, a, 1);
+			assert(!mpi_perfect_square_p(a));
+			mpi_sub_u32(a, a, 2);
+			assert(!mpi_perfect_square_p(a));
+			mpi_random(a, 1 + rand_u32() % 100);
+			mpi_sqrt(s, a);
+			mpi_sqr(s, s);
+			assert(mpi_perfect_square_p(a) == (mpi_cmp(a, s) == 0));
+		}
+
+		mpi_clear(a);
+		mpi_clear(s);
+	}
+
+	printf("mpi_perfect_power_p\n");
+	{
+		mpi_t a, x;
+		mpi_init(a);
+		mpi_init(x);
+
+		/* 0, 1, 4, 8, 9, 16, 25, 27, 32, 36, 49, 64, 81, 100, 121, 125, 128, ... */
+		int powers = 0;
+
+		for (uint32_t i = 0; i < 10000; ++i) {
+			mpi_set_u32(a, i);
+			powers += mpi_perfect_power_p(a);
+		}
+
+		assert(powers == 125);
+
+		for (int i = 0; i < 50; ++i) {
+			uint32_t n = 2 + rand_u32() % 12;
+
+			mpi_random(x, 1 + rand_u32() % 3);
+
+			if (mpi_cmp_u32(x, 1) <= 0) {
+				continue;
+			}
+
+			mpi_pow_u32(a, x, n);
+			assert(mpi_perfect_power_p(a));
+
+			/* against every exponent */
+			mpi_add_u32(a, a, rand_u32() % 2);
+			int power = 0;
+			for (uint32_t k = 2; k <= mpi_sizeinbase(a, 2); ++k) {
+				power |= mpi_root(x, a, k);
+			}
+			assert(mpi_perfect_power_p(a) == power);
+		}
+
+		/* 2^61 - 1 is prime */
+		mpi_set_u64(a, (UINT64_C(1) << 61) - 1);
+		assert(!mpi_perfect_power_p(a));
+		mpi_add_u32(a, a, 1);
+		assert(mpi_perfect_power_p(a));
+		mpi_mul_u32(a, a, 3);
+		assert(!mpi_perfect_power_p(a));
+
+		/* 3^35 2^70 = (3^7 2^14)^5 */
+		mpi_ui_pow_u32(a, 3, 35);
+		mpi_mul_2exp(a, a, 70);
+		assert(mpi_perfect_power_p(a));
+		mpi_mul_u32(a, a, 9);
+		assert(!mpi_perfect_power_p(a));
+
+		/* thousands of bits, where a full root for every exponent would take seconds */
+		static const uint32_t p[] = { 3, 7, 61, 997 };
+
+		for (size_t i = 0; i < sizeof(p) / sizeof(*p); ++i) {
+			mpi_random(x, 1 + 320 / p[i]);
+			mpi_pow_u32(a, x, p[i]);
+			assert(mpi_perfect_power_p(a));
+			mpi_add_u32(a, a, 2);
+			assert(!mpi_perfect_power_p(a));
+		}
+
+		mpi_random(a, 330);
+		mpi_setbit(a, 0);
+		assert(!mpi_perfect_power_p(a));
+
+		mpi_clear(a);
+		mpi_clear(x);
+	}
+
 	printf("gmp_sprintf\n");
 	{
 		char buffer[4096];
@@ -689,6 +1533,543 @@ int main()
 		assert(strcmp(buffer, "f = 123.456001\n") == 0);
 	}
 
+	printf("gmp_sprintf (width, precision)\n");
+	{
+		char buffer[4096];
+		mpi_t n;
+		mpi_init(n);
+
+		mpi_set_str(n, "1234567890", 10);
+
+		assert(gmp_sprintf(buffer, "[%15Zd|%-12Zd|%012Zd|%+.14Zd|% Zu]", n, n, n, n, n) == 71);
+		assert(strcmp(buffer, "[     1234567890|1234567890  |001234567890|+00001234567890| 1234567890]") == 0);
+
+		assert(gmp_sprintf(buffer, "[%*Zd|%-*Zd|%.*Zd]", 12, n, -11, n, 11, n) == 38);
+		assert(strcmp(buffer, "[  1234567890|1234567890 |01234567890]") == 0);
+
+		mpi_set_u32(n, 0);
+		gmp_sprintf(buffer, "[%Zd|%.0Zd|%3.0Zd|%03Zd]", n, n, n, n);
+		assert(strcmp(buffer, "[0||   |000]") == 0);
+
+		gmp_sprintf(buffer, "%5.2f|%-4d|%04x|%s|%c|%%", 3.14159, 7, 255U, "str", 'c');
+		assert(strcmp(buffer, " 3.14|7   |00ff|str|c|%") == 0);
+
+		/* every C conversion goes to the C library, with its length modifier */
+		char expect[256];
+		void *ptr = buffer;
+		int count, expect_count;
+		short hcount, expect_hcount;
+		mpi_set_u32(n, 7);
+		gmp_sprintf(buffer, "%lld|%zu|%hd|%hhu|%jd|%td|%llx|%Lg|%p|%Zd%n|%ls%hn", -12345678901LL, (size_t)42, (short)-3, (unsigned char)200,
+			(intmax_t)-9, (ptrdiff_t)5, 0xfedcba987ULL, (long double)0.5, ptr, n, &count, L"w", &hcount);
+		snprintf(expect, sizeof(expect), "%lld|%zu|%hd|%hhu|%jd|%td|%llx|%Lg|%p|7%n|%ls%hn", -12345678901LL, (size_t)42, (short)-3, (unsigned char)200,
+			(intmax_t)-9, (ptrdiff_t)5, 0xfedcba987ULL, (long double)0.5, ptr, &expect_count, L"w", &expect_hcount);
+		assert(strcmp(buffer, expect) == 0);
+		assert(count == expect_count && hcount == expect_hcount);
+
+		mpi_clear(n);
+	}
+
+	printf("gmp_snprintf, gmp_asprintf\n");
+	{
+		char buffer[16];
+		char *str;
+		mpi_t n, m;
+		mpi_init(n);
+		mpi_init(m);
+
+		mpi_set_str(n, "98765432109876543210", 10);
+
+		assert(gmp_snprintf(buffer, sizeof(buffer), "n = %Zd", n) == 24);
+		assert(strcmp(buffer, "n = 98765432109") == 0);
+		assert(gmp_snprintf(NULL, 0, "n = %Zd!", n) == 25);
+
+		assert(gmp_asprintf(&str, "<%Zd>", n) == 22);
+		assert(strcmp(str, "<98765432109876543210>") == 0);
+		free(str);
+
+		/* a long number goes through the divide-and-conquer conversion */
+		size_t len = 30000;
+		char *digits = malloc(len + 1);
+		assert(digits != NULL);
+		for (size_t i = 0; i < len; ++i) {
+			digits[i] = (char)('0' + (i == 0 ? 1 + rand_u32() % 9 : rand_u32() % 10));
+		}
+		digits[len] = 0;
+
+		mpi_set_str(m, digits, 10);
+		assert(gmp_asprintf(&str, "%Zd", m) == (int)len);
+		assert(strcmp(str, digits) == 0);
+		free(str);
+
+		/* 10^k - 1 and 10^k */
+		mpi_ui_pow_u32(m, 10, 5000);
+		assert(gmp_asprintf(&str, "%Zd", m) == 5001);
+		assert(strlen(str) == 5001 && str[0] == '1' && str[1] == '0' && str[5000] == '0');
+		free(str);
+		mpi_sub_u32(m, m, 1);
+		assert(gmp_snprintf(NULL, 0, "%Zd", m) == 5000);
+
+		FILE *stream = tmpfile();
+		assert(stream != NULL);
+		assert(gmp_fprintf(stream, "%Zd\n", m) == 5001);
+		assert(mpi_out_str(stream, 10, n) == 20);
+		assert(ftell(stream) == 5021);
+		fclose(stream);
+
+		free(digits);
+		mpi_clear(n);
+		mpi_clear(m);
+	}
+
+	printf("mpi_inp_str\n");
+	{
+		mpi_t n, m;
+		mpi_init(n);
+		mpi_init(m);
+
+		FILE *stream = tmpfile();
+		assert(stream != NULL);
+
+		/* seven chunks of 65536 digits, folded from three levels, and a partial one */
+		size_t len = 460000;
+		char *digits = malloc(len + 1);
+		assert(digits != NULL);
+		for (size_t i = 0; i < len; ++i) {
+			digits[i] = (char)('0' + (i == 0 ? 1 + rand_u32() % 9 : rand_u32() % 10));
+		}
+		digits[len] = 0;
+
+		fprintf(stream, " \n\t%s;00042 x", digits);
+		rewind(stream);
+
+		assert(mpi_inp_str(n, stream, 10) == len + 3);
+		mpi_set_str(m, digits, 10);
+		assert(mpi_cmp(n, m) == 0);
+
+		assert(getc(stream) == ';');
+		assert(mpi_inp_str(n, stream, 10) == 5);
+		assert(mpi_cmp_u32(n, 42) == 0);
+		assert(mpi_inp_str(n, stream, 10) == 0);
+		assert(getc(stream) == 'x');
+		assert(mpi_inp_str(n, stream, 10) == 0);
+
+		fclose(stream);
+
+		free(digits);
+		mpi_clear(n);
+		mpi_clear(m);
+	}
+
+	printf("mpi_stats_dump\n");
+	{
+		mpi_t a, b;
+		mpi_init(a);
+		mpi_init(b);
+
+		mpi_stats_reset();
+		mpi_random(a, 100);
+		mpi_random(b, 100);
+		mpi_mul(a, a, b);
+
+		FILE *stream = tmpfile();
+		char buffer[4096];
+		assert(stream != NULL);
+		mpi_stats_dump(stream);
+		rewind(stream);
+		size_t len = fread(buffer, 1, sizeof(buffer) - 1, stream);
+		buffer[len] = 0;
+		fclose(stream);
+
+		assert(buffer[0] == '{' && buffer[len - 2] == '}');
+#ifdef MPI_STATS
+		assert(strstr(buffer, "\"mpi_mul\": { \"calls\": 1, \"limbs\": 200") != NULL);
+		assert(strstr(buffer, "\"mul_ntt\": { \"calls\": 0,") != NULL);
+		assert(strstr(buffer, "\"mul_karatsuba\": { \"calls\": 0,") == NULL);
+
+		/* forked threads hand their counters over as they exit */
+		size_t ntt = mpi_get_param("MUL_NTT_THRESHOLD");
+		unsigned long karatsuba[2];
+
+		mpi_set_param("MUL_NTT_THRESHOLD", 1 << 30);
+		mpi_random(a, 1000);
+
+		for (int t = 0; t < 2; ++t) {
+			mpi_set_num_threads(t == 0 ? 1 : 4);
+			mpi_stats_reset();
+
+			for (int i = 0; i < 20; ++i) {
+				mpi_mul(b, a, a);
+			}
+
+			stream = tmpfile();
+			assert(stream != NULL);
+			mpi_stats_dump(stream);
+			rewind(stream);
+			len = fread(buffer, 1, sizeof(buffer) - 1, stream);
+			buffer[len] = 0;
+			fclose(stream);
+
+			assert(strstr(buffer, "\"threads\": 1,") != NULL);
+			assert(sscanf(strstr(buffer, "\"mul_karatsuba\""), "\"mul_karatsuba\": { \"calls\": %lu", &karatsuba[t]) == 1);
+		}
+
+		assert(karatsuba[0] == karatsuba[1]);
+
+		mpi_set_num_threads(1);
+		mpi_set_param("MUL_NTT_THRESHOLD", ntt);
+#endif
+
+		mpi_clear(a);
+		mpi_clear(b);
+	}
+
+	printf("mpi_jacobi\n");
+	{
+		mpi_t a, n, b;
+		mpi_init(a);
+		mpi_init(n);
+		mpi_init(b);
+
+		/* Euler's criterion modulo 1009 */
+		mpi_set_u32(n, 1009);
+		for (uint32_t i = 0; i < 1009; ++i) {
+			uint32_t e = 1;
+			for (int k = 0; k < 504; ++k) {
+				e = e * i % 1009;
+			}
+			mpi_set_u32(a, i);
+			assert(mpi_jacobi(a, n) == (e == 1 ? 1 : e == 0 ? 0 : -1));
+		}
+
+		/* (2^200 + 1 / 10^60 + k) and (10^60 + k / 2^127 - 1) */
+		static const int expected[][3] = { { 1, -1, -1 }, { 5, -1, 1 }, { 9, 1, -1 }, { 13, -1, 1 }, { 23, -1, 1 } };
+
+		for (size_t i = 0; i < sizeof(expected) / sizeof(*expected); ++i) {
+			mpi_ui_pow_u32(n, 10, 60);
+			mpi_add_u32(n, n, (uint32_t)expected[i][0]);
+			mpi_set_u32(a, 1);
+			mpi_mul_2exp(a, a, 200);
+			mpi_add_u32(a, a, 1);
+			assert(mpi_jacobi(a, n) == expected[i][1]);
+			mpi_set_u32(b, 1);
+			mpi_mul_2exp(b, b, 127);
+			mpi_sub_u32(b, b, 1);
+			assert(mpi_jacobi(n, b) == expected[i][2]);
+		}
+
+		/* multiplicative in the numerator, 0 on a common factor */
+		for (int i = 0; i < 100; ++i) {
+			mpi_random(n, 2 + rand_u32() % 20);
+			mpi_setbit(n, 0);
+			mpi_random(a, 1 + rand_u32() % 30);
+			mpi_random(b, 1 + rand_u32() % 30);
+			int ja = mpi_jacobi(a, n), jb = mpi_jacobi(b, n);
+			mpi_mul(a, a, b);
+			assert(mpi_jacobi(a, n) == ja * jb);
+			mpi_mul(a, n, b);
+			assert(mpi_jacobi(a, n) == 0);
+		}
+
+		mpi_clear(a);
+		mpi_clear(n);
+		mpi_clear(b);
+	}
+
+	printf("mpi_probab_prime_p\n");
+	{
+		mpi_t n, p;
+		mpi_init(n);
+		mpi_init(p);
+
+		int primes = 0;
+
+		for (uint32_t i = 0; i < 100000; ++i) {
+			mpi_set_u32(n, i);
+			int r = mpi_probab_prime_p(n, 25);
+			assert(r == 0 || r == 2);
+			primes += r == 2;
+		}
+
+		assert(primes == 9592);
+
+		/* strong pseudoprimes to base 2, Lucas pseudoprimes, Carmichael numbers */
+		static const uint64_t composites[] = { 2047, 3277, 4033, 4681, 8321, 5459, 5777, 10877, 561, 41041, UINT64_C(3825123056546413051), UINT64_C(18446744073709551615) };
+
+		for (size_t i = 0; i < sizeof(composites) / sizeof(*composites); ++i) {
+			mpi_set_u64(n, composites[i]);
+			assert(mpi_probab_prime_p(n, 25) == 0);
+		}
+
+		/* primes in [2^62 - 20000, 2^62), [2^64 - 20000, 2^64) and [2^80, 2^80 + 20000) */
+		static const struct { mp_bitcnt_t bits; int below; int count; } ranges[] = { { 62, 1, 479 }, { 64, 1, 445 }, { 80, 0, 374 } };
+
+		for (size_t i = 0; i < sizeof(ranges) / sizeof(*ranges); ++i) {
+			mpi_set_u32(p, 1);
+			mpi_mul_2exp(p, p, ranges[i].bits);
+
+			if (ranges[i].below) {
+				mpi_sub_u32(p, p, 20000);
+			}
+
+			primes = 0;
+
+			for (int k = 0; k < 20000; ++k) {
+				mpi_add_u32(n, p, (uint32_t)k);
+				primes += mpi_probab_prime_p(n, 30) != 0;
+			}
+
+			assert(primes == ranges[i].count);
+		}
+
+		/* Mersenne numbers */
+		for (mp_bitcnt_t e = 2; e < 700; ++e) {
+			mpi_set_u32(n, 1);
+			mpi_mul_2exp(n, n, e);
+			mpi_sub_u32(n, n, 1);
+
+			int prime = e == 2 || e == 3 || e == 5 || e == 7 || e == 13 || e == 17 || e == 19 || e == 31 || e == 61 || e == 89 || e == 107 || e == 127 || e == 521 || e == 607;
+
+			assert((mpi_probab_prime_p(n, 25) != 0) == prime);
+		}
+
+		/* products and a square of primes */
+		mpi_set_u32(n, 1);
+		mpi_mul_2exp(n, n, 127);
+		mpi_sub_u32(n, n, 1);
+		mpi_set_u32(p, 1);
+		mpi_mul_2exp(p, p, 89);
+		mpi_sub_u32(p, p, 1);
+		mpi_mul(p, n, p);
+		assert(mpi_probab_prime_p(p, 25) == 0);
+		mpi_sqr(p, n);
+		assert(mpi_probab_prime_p(p, 25) == 0);
+
+		/* more extra rounds than there are primes below the trial division limit */
+		assert(mpi_probab_prime_p(n, 1000) == 1);
+		assert(mpi_probab_prime_p(p, 1000) == 0);
+
+		/* Montgomery reduction by multiplications */
+		size_t ntt = mpi_get_param("MUL_NTT_THRESHOLD");
+		mpi_set_param("MUL_NTT_THRESHOLD", 4);
+		for (mp_bitcnt_t e = 600; e < 610; ++e) {
+			mpi_set_u32(n, 1);
+			mpi_mul_2exp(n, n, e);
+			mpi_sub_u32(n, n, 1);
+			assert((mpi_probab_prime_p(n, 30) != 0) == (e == 607));
+		}
+		mpi_set_param("MUL_NTT_THRESHOLD", ntt);
+
+		mpi_clear(n);
+		mpi_clear(p);
+	}
+
+	printf("mpi_fac_u32\n");
+	{
+		mpi_t f, g;
+		mpi_init(f);
+		mpi_init(g);
+
+		mpi_set_u32(g, 1);
+
+		for (uint32_t n = 0; n <= 3000; ++n) {
+			if (n > 0) {
+				mpi_mul_u32(g, g, n);
+			}
+
+			if (n < 100 || n % 97 == 0 || n == 3000) {
+				mpi_fac_u32(f, n);
+				assert(mpi_cmp(f, g) == 0);
+			}
+		}
+
+		mpi_fac_u32(f, 25);
+		mpi_set_str(g, "15511210043330985984000000", 10);
+		assert(mpi_cmp(f, g) == 0);
+
+		mpi_clear(f);
+		mpi_clear(g);
+	}
+
+	printf("mpi_bin_uiui\n");
+	{
+		mpi_t b, row[101];
+
+		mpi_init(b);
+
+		/* Pascal's triangle */
+		for (uint32_t n = 0; n <= 100; ++n) {
+			mpi_init(row[n]);
+			mpi_set_u32(row[n], 1);
+
+			for (uint32_t k = n - 1; k >= 1 && k < n; --k) {
+				mpi_add(row[k], row[k], row[k - 1]);
+			}
+
+			for (uint32_t k = 0; k <= n + 1; ++k) {
+				mpi_bin_uiui(b, n, k);
+				assert(k > n ? mpi_cmp_u32(b, 0) == 0 : mpi_cmp(b, row[k]) == 0);
+			}
+		}
+
+		for (uint32_t n = 0; n <= 100; ++n) {
+			mpi_clear(row[n]);
+		}
+
+		mpi_t f, g;
+		mpi_init(f);
+		mpi_init(g);
+
+		/* C(3000, 1234) = 3000! / (1234! 1766!) */
+		mpi_fac_u32(f, 3000);
+		mpi_fac_u32(g, 1234);
+		mpi_fdiv_qr(f, b, f, g);
+		mpi_fac_u32(g, 1766);
+		mpi_fdiv_qr(f, b, f, g);
+		mpi_bin_uiui(b, 3000, 1234);
+		assert(mpi_cmp(b, f) == 0);
+
+		/* C(2^32 - 1, 3) = (2^32 - 1) (2^32 - 2) (2^32 - 3) / 6 */
+		mpi_set_u32(f, UINT32_MAX);
+		mpi_mul_u32(f, f, UINT32_MAX - 1);
+		mpi_mul_u32(f, f, UINT32_MAX - 2);
+		mpi_fdiv_qr_u32(f, g, f, 6);
+		mpi_bin_uiui(b, UINT32_MAX, 3);
+		assert(mpi_cmp(b, f) == 0);
+
+		mpi_clear(b);
+		mpi_clear(f);
+		mpi_clear(g);
+	}
+
+	printf("mpi_primorial_u32\n");
+	{
+		mpi_t p, q;
+		mpi_init(p);
+		mpi_init(q);
+
+		mpi_primorial_u32(p, 0);
+		assert(mpi_cmp_u32(p, 1) == 0);
+		mpi_primorial_u32(p, 2);
+		assert(mpi_cmp_u32(p, 2) == 0);
+		mpi_primorial_u32(p, 30);
+		mpi_set_u64(q, UINT64_C(6469693230));
+		assert(mpi_cmp(p, q) == 0);
+
+		mpi_set_u32(q, 1);
+		for (uint32_t n = 2; n <= 20000; ++n) {
+			int prime = 1;
+			for (uint32_t d = 2; d * d <= n && prime; ++d) {
+				prime = n % d != 0;
+			}
+			if (prime) {
+				mpi_mul_u32(q, q, n);
+			}
+		}
+		mpi_primorial_u32(p, 20000);
+		assert(mpi_cmp(p, q) == 0);
+
+		mpi_clear(p);
+		mpi_clear(q);
+	}
+
+	printf("mpi_fib_u32, mpi_fib2_u32\n");
+	{
+		mpi_t f0, f1, t, f, g;
+		mpi_init(f0);
+		mpi_init(f1);
+		mpi_init(t);
+		mpi_init(f);
+		mpi_init(g);
+
+		/* f0 = F(n), f1 = F(n+1) */
+		mpi_set_u32(f0, 0);
+		mpi_set_u32(f1, 1);
+
+		for (uint32_t n = 0; n <= 5000; ++n) {
+			if (n < 300 || n % 37 == 0) {
+				mpi_fib_u32(f, n);
+				assert(mpi_cmp(f, f0) == 0);
+				mpi_fib2_u32(f, g, n + 1);
+				assert(mpi_cmp(f, f1) == 0 && mpi_cmp(g, f0) == 0);
+			}
+
+			mpi_add(t, f0, f1);
+			mpi_swap(f0, f1);
+			mpi_swap(f1, t);
+		}
+
+		mpi_fib2_u32(f, g, 0);
+		assert(mpi_cmp_u32(f, 0) == 0 && mpi_cmp_u32(g, 1) == 0);
+
+		/* a file-backed output keeps its mapping */
+		mpi_t h;
+		remove("main-mmap.mpi");
+		mpi_init_mmap(h, "main-mmap.mpi", 0);
+		mpi_fib2_u32(h, g, 1000);
+		mpi_fib_u32(f, 1000);
+		assert(h->mmap != NULL && mpi_cmp(h, f) == 0);
+		mpi_clear(h);
+		mpi_init_mmap(h, "main-mmap.mpi", 0);
+		assert(mpi_cmp(h, f) == 0);
+		mpi_clear(h);
+		remove("main-mmap.mpi");
+
+		mpi_fib_u32(f, 100);
+		mpi_set_str(g, "354224848179261915075", 10);
+		assert(mpi_cmp(f, g) == 0);
+
+		/* F(2n) = F(n) L(n) */
+		mpi_fib_u32(f, 100001);
+		mpi_lucnum_u32(g, 100001);
+		mpi_mul(f, f, g);
+		mpi_fib_u32(g, 200002);
+		assert(mpi_cmp(f, g) == 0);
+
+		mpi_clear(f0);
+		mpi_clear(f1);
+		mpi_clear(t);
+		mpi_clear(f);
+		mpi_clear(g);
+	}
+
+	printf("mpi_lucnum_u32, mpi_lucnum2_u32\n");
+	{
+		mpi_t l0, l1, t, l, m;
+		mpi_init(l0);
+		mpi_init(l1);
+		mpi_init(t);
+		mpi_init(l);
+		mpi_init(m);
+
+		/* l0 = L(n), l1 = L(n+1) */
+		mpi_set_u32(l0, 2);
+		mpi_set_u32(l1, 1);
+
+		for (uint32_t n = 0; n <= 5000; ++n) {
+			if (n < 300 || n % 37 == 0) {
+				mpi_lucnum_u32(l, n);
+				assert(mpi_cmp(l, l0) == 0);
+				mpi_lucnum2_u32(l, m, n + 1);
+				assert(mpi_cmp(l, l1) == 0 && mpi_cmp(m, l0) == 0);
+			}
+
+			mpi_add(t, l0, l1);
+			mpi_swap(l0, l1);
+			mpi_swap(l1, t);
+		}
+
+		mpi_lucnum_u32(l, 100);
+		mpi_set_str(m, "792070839848372253127", 10);
+		assert(mpi_cmp(l, m) == 0);
+
+		mpi_clear(l0);
+		mpi_clear(l1);
+		mpi_clear(t);
+		mpi_clear(l);
+		mpi_clear(m);
+	}
+
 	printf("mpi_gcd\n");
 	{
 		mpi_t a, b, r;
@@ -724,6 +2105,96 @@ int main()
 		assert(collatz_max("274133054632352106267", "56649062372194325899121269007146717645316"));
 	}
 
+	printf("collatz_path_max\n");
+	{
+		mpi_t n, max, r;
+		mpi_init(n);
+		mpi_init(max);
+		mpi_init(r);
+
+		mpi_set_str(n, "212581558780141311", 10);
+		collatz_path_max(max, n);
+		mpi_set_str(r, "2176718166004315761101410771585688", 10);
+		assert(mpi_cmp(max, r) == 0);
+
+		/* leaves the 128-bit range */
+		mpi_set_str(n, "274133054632352106267", 10);
+		collatz_path_max(max, n);
+		mpi_set_str(r, "56649062372194325899121269007146717645316", 10);
+		assert(mpi_cmp(max, r) == 0);
+
+		/* starts above 128 bits and climbs higher once back below */
+		mpi_set_str(n, "274133054632352106267", 10);
+		mpi_mul_2exp(n, n, 61);
+		collatz_path_max(max, n);
+		assert(mpi_cmp(max, r) == 0);
+
+		mpi_clear(n);
+		mpi_clear(max);
+		mpi_clear(r);
+	}
+
+	printf("collatz_sweep\n");
+	{
+		static const uint64_t n[] = { 1, 2, 3, 7, 15, 27, 255, 447, 639, 703 };
+		static const uint32_t m[] = { 1, 2, 8, 26, 80, 4616, 6560, 19682, 20762, 125252 };
+
+		struct records records;
+		mpi_t start, max;
+		mpi_init(start);
+		mpi_init(max);
+
+		mpi_set_num_threads(4);
+
+		records.nmemb = 0;
+		mpi_set_u32(start, 1);
+		mpi_set_u32(max, 0);
+		collatz_sweep(start, 500, max, collect_record, &records);
+		mpi_set_u32(start, 501);
+		collatz_sweep_resume(start, 499, max, collect_record, &records);
+
+		assert(records.nmemb == 10);
+		for (size_t i = 0; i < 10; ++i) {
+			assert(records.n[i] == n[i]);
+			assert(mpi_cmp_u32(records.max[i], m[i]) == 0);
+			mpi_clear(records.max[i]);
+		}
+		assert(mpi_cmp_u32(max, 125252) == 0);
+
+		/* the last record below 212581558780141311 is far below its maximum */
+		records.nmemb = 0;
+		mpi_set_str(start, "212581558780131312", 10);
+		mpi_set_u32(max, 0);
+		collatz_sweep(start, 10000, max, collect_record, &records);
+
+		assert(records.nmemb > 0);
+		assert(records.n[records.nmemb - 1] == UINT64_C(212581558780141311));
+		mpi_set_str(start, "2176718166004315761101410771585688", 10);
+		assert(mpi_cmp(max, start) == 0);
+
+		for (size_t i = 0; i < records.nmemb; ++i) {
+			mpi_clear(records.max[i]);
+		}
+
+		/* the records below 212581558780141311 do not climb as high */
+		records.nmemb = 0;
+		mpi_set_str(start, "212581558780041312", 10);
+		mpi_set_str(max, "2176718166004315761101410771585687", 10);
+		collatz_sweep_resume(start, 200000, max, collect_record, &records);
+
+		assert(records.nmemb == 1);
+		assert(records.n[0] == UINT64_C(212581558780141311));
+		mpi_set_str(start, "2176718166004315761101410771585688", 10);
+		assert(mpi_cmp(records.max[0], start) == 0);
+		assert(mpi_cmp(max, start) == 0);
+		mpi_clear(records.max[0]);
+
+		mpi_set_num_threads(1);
+
+		mpi_clear(start);
+		mpi_clear(max);
+	}
+
 	printf("Lucas-Lehmer test\n");
 	{
 		assert(llt(3) == 1);
@@ -753,5 +2224,137 @@ int main()
 		assert(llt(9689) == 1);
 	}
 
+	printf("mpi_llt\n");
+	{
+		static const mp_bitcnt_t p[] = { 3, 5, 7, 13, 17, 19, 31, 61, 89, 107, 127, 521, 607, 1279, 2203, 2281, 3217, 4253, 4423, 9689 };
+		static const mp_bitcnt_t q[] = { 9, 11, 15, 23, 25 };
+
+		for (size_t i = 0; i < sizeof(p) / sizeof(*p); ++i) {
+			assert(mpi_llt(p[i]) == 1);
+		}
+
+		for (size_t i = 0; i < sizeof(q) / sizeof(*q); ++i) {
+			assert(mpi_llt(q[i]) == 0);
+		}
+
+		assert(mpi_llt(2) == 1);
+		assert(mpi_llt(29) == 0);
+		assert(mpi_llt(67) == 0);
+		assert(mpi_llt(9941) == 1);
+		assert(mpi_llt(9949) == 0);
+		assert(mpi_llt(11213) == 1);
+	}
+
+	printf("mpi_llt_resume\n");
+	{
+		const char *path = "main-llt.ckpt";
+
+		remove(path);
+
+		assert(mpi_llt_resume(9689, path, 1000) == 1);
+		/* resumes from the final residue */
+		assert(mpi_llt_resume(9689, path, 1000) == 1);
+		assert(mpi_llt_resume(4423, NULL, 500) == 1);
+		assert(mpi_llt_resume(25, NULL, 5) == 0);
+		assert(mpi_llt_resume(11, NULL, 2) == 0);
+		assert(mpi_llt_resume(4421, NULL, 100) == 0);
+
+		/* a damaged checkpoint is ignored */
+		FILE *stream = fopen(path, "r+b");
+		assert(stream != NULL);
+		fseek(stream, 40, SEEK_SET);
+		fputc(0x55, stream);
+		fclose(stream);
+		assert(mpi_llt_resume(9689, path, 1000) == 1);
+
+		/* so is one with a flipped bit in the exponent */
+		stream = fopen(path, "r+b");
+		assert(stream != NULL);
+		fseek(stream, 16, SEEK_SET);
+		int c = fgetc(stream);
+		fseek(stream, 16, SEEK_SET);
+		fputc(c ^ 0x04, stream);
+		fclose(stream);
+		assert(mpi_llt_resume(9689, path, 1000) == 1);
+
+		remove(path);
+	}
+
+	printf("mersenne_divides\n");
+	{
+		mpi_t q;
+		mpi_init(q);
+
+		mpi_set_u32(q, 23);
+		assert(mersenne_divides(q, 11) == 1);
+		mpi_set_str(q, "193707721", 10);
+		assert(mersenne_divides(q, 67) == 1);
+		mpi_set_str(q, "341117531003194129", 10);
+		assert(mersenne_divides(q, 101) == 1);
+		mpi_set_str(q, "3976656429941438590393", 10);
+		assert(mersenne_divides(q, 103) == 1);
+		mpi_add_u32(q, q, 2 * 103);
+		assert(mersenne_divides(q, 103) == 0);
+
+		mpi_clear(q);
+	}
+
+	printf("mersenne_trial_factor\n");
+	{
+		mpi_t q;
+		mpi_init(q);
+
+		assert(mersenne_trial_factor(q, 11, 32) == 1);
+		assert(mpi_cmp_u32(q, 23) == 0);
+		assert(mersenne_trial_factor(q, 23, 32) == 1);
+		assert(mpi_cmp_u32(q, 47) == 0);
+		assert(mersenne_trial_factor(q, 67, 32) == 1);
+		assert(mpi_cmp_u32(q, 193707721) == 0);
+		assert(mersenne_trial_factor(q, 67, 27) == 0);
+		assert(mersenne_trial_factor(q, 3, 32) == 0);
+		assert(mersenne_trial_factor(q, 127, 32) == 0);
+
+		mpi_clear(q);
+	}
+
+	printf("mersenne_search\n");
+	{
+		static const mp_bitcnt_t p[] = { 2, 3, 5, 7, 13, 17, 19, 31, 61, 89, 107, 127, 521, 607, 1279 };
+		struct records records;
+		struct mersenne_stats stats;
+
+		records.nmemb = 0;
+
+		mpi_set_num_threads(4);
+		mersenne_search(2, 1300, 24, collect_exponent, &records, &stats);
+		mpi_set_num_threads(1);
+
+		assert(records.nmemb == sizeof(p) / sizeof(*p));
+		for (size_t i = 0; i < records.nmemb; ++i) {
+			assert(records.n[i] == p[i]);
+		}
+
+		assert(stats.exponents == 211);
+		assert(stats.primes == 15);
+		assert(stats.factored + stats.tested == stats.exponents);
+		assert(stats.factored > stats.tested);
+	}
+
+	printf("mpi_prp_mersenne\n");
+	{
+		const char *path = "main-prp.ckpt";
+
+		remove(path);
+
+		assert(mpi_prp_mersenne(3, NULL, 0) == 1);
+		assert(mpi_prp_mersenne(11, NULL, 4) == 0);
+		assert(mpi_prp_mersenne(127, NULL, 16) == 1);
+		assert(mpi_prp_mersenne(4423, path, 1000) == 1);
+		assert(mpi_prp_mersenne(4423, path, 1000) == 1);
+		assert(mpi_prp_mersenne(4421, NULL, 1000) == 0);
+
+		remove(path);
+	}
+
 	return 0;
 }
@@ -0,0 +1,403 @@
+#include "mersenne.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+/* candidates q = 2kp + 1 are sieved by the primes below this */
+#define SIEVE_LIMIT 4096
+
+/* number of k in one sieve segment */
+#define SEGMENT_SIZE 65536
+
+/* exponents from here on are tested one at a time, after all smaller ones, each transform on all threads */
+#define LARGE_EXPONENT 1000000
+
+static uint32_t small_primes[SIEVE_LIMIT];
+
+static size_t small_primes_count;
+
+static pthread_once_t small_primes_once = PTHREAD_ONCE_INIT;
+
+static void small_primes_init(void)
+{
+	char composite[SIEVE_LIMIT] = { 0 };
+
+	for (uint32_t i = 3; i < SIEVE_LIMIT; i += 2) {
+		if (!composite[i]) {
+			small_primes[small_primes_count++] = i;
+
+			for (uint32_t j = i * i; j < SIEVE_LIMIT; j += 2 * i) {
+				composite[j] = 1;
+			}
+		}
+	}
+}
+
+static int prime_p(uint64_t p)
+{
+	if (p < 2) {
+		return 0;
+	}
+
+	for (uint64_t d = 2; d * d <= p; ++d) {
+		if (p % d == 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Montgomery arithmetic modulo q < 2^63, R = 2^64 */
+
+static uint64_t mont64_inv(uint64_t q)
+{
+	uint64_t x = q;
+
+	for (int i = 0; i < 5; ++i) {
+		x *= 2 - q * x;
+	}
+
+	return -x;
+}
+
+static uint64_t mont64_mul(uint64_t a, uint64_t b, uint64_t q, uint64_t q_inv)
+{
+	uint128_t t = (uint128_t)a * b;
+	uint64_t m = (uint64_t)t * q_inv;
+	uint64_t u = (uint64_t)((t + (uint128_t)m * q) >> 64);
+
+	return u >= q ? u - q : u;
+}
+
+/* 2^p mod q = 1 */
+static int divides64(uint64_t q, mp_bitcnt_t p)
+{
+	uint64_t q_inv = mont64_inv(q);
+	/* R mod q */
+	uint64_t one = (uint64_t)(0 - q) % q;
+	uint64_t x = one;
+
+	for (int b = 63; b >= 0; --b) {
+		if ((p >> b) == 0) {
+			continue;
+		}
+
+		x = mont64_mul(x, x, q, q_inv);
+
+		if ((p >> b) & 1) {
+			x = x + x;
+			x = x >= q ? x - q : x;
+		}
+	}
+
+	return x == one;
+}
+
+/* Montgomery arithmetic modulo q < 2^126, R = 2^128 */
+
+static uint128_t mont128_inv(uint128_t q)
+{
+	uint128_t x = q;
+
+	for (int i = 0; i < 6; ++i) {
+		x *= 2 - q * x;
+	}
+
+	return -x;
+}
+
+/* (hi, lo) = a * b */
+static void mul256(uint128_t a, uint128_t b, uint128_t *hi, uint128_t *lo)
+{
+	uint64_t a0 = (uint64_t)a, a1 = (uint64_t)(a >> 64);
+	uint64_t b0 = (uint64_t)b, b1 = (uint64_t)(b >> 64);
+
+	uint128_t p00 = (uint128_t)a0 * b0;
+	uint128_t p01 = (uint128_t)a0 * b1;
+	uint128_t p10 = (uint128_t)a1 * b0;
+	uint128_t p11 = (uint128_t)a1 * b1;
+
+	uint128_t mid = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+
+	*lo = (uint64_t)p00 | (mid << 64);
+	*hi = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+}
+
+static uint128_t mont128_mul(uint128_t a, uint128_t b, uint128_t q, uint128_t q_inv)
+{
+	uint128_t th, tl, mh, ml;
+
+	mul256(a, b, &th, &tl);
+	mul256(tl * q_inv, q, &mh, &ml);
+
+	/* tl + ml = 0 (mod 2^128) */
+	uint128_t u = th + mh + (tl != 0);
+
+	return u >= q ? u - q : u;
+}
+
+static int divides128(uint128_t q, mp_bitcnt_t p)
+{
+	uint128_t q_inv = mont128_inv(q);
+	uint128_t one = (0 - q) % q;
+	uint128_t x = one;
+
+	for (int b = 63; b >= 0; --b) {
+		if ((p >> b) == 0) {
+			continue;
+		}
+
+		x = mont128_mul(x, x, q, q_inv);
+
+		if ((p >> b) & 1) {
+			x = x + x;
+			x = x >= q ? x - q : x;
+		}
+	}
+
+	return x == one;
+}
+
+static int divides(uint128_t q, mp_bitcnt_t p)
+{
+	if ((q >> 63) == 0) {
+		return divides64((uint64_t)q, p);
+	}
+
+	return divides128(q, p);
+}
+
+int mersenne_divides(const mpi_t q, mp_bitcnt_t p)
+{
+	assert(mpi_sizeinbase(q, 2) <= 126 && mpi_odd_p(q));
+
+	mpi_t t;
+
+	mpi_init(t);
+
+	mpi_fdiv_q_2exp(t, q, 64);
+
+	uint128_t r = (uint128_t)mpi_get_u64(t) << 64;
+
+	mpi_fdiv_r_2exp(t, q, 64);
+
+	r |= mpi_get_u64(t);
+
+	mpi_clear(t);
+
+	return divides(r, p);
+}
+
+/* smallest q = 2kp + 1 < 2^bits dividing 2^p - 1, or 0 */
+static uint128_t trial_factor(mp_bitcnt_t p, unsigned bits)
+{
+	pthread_once(&small_primes_once, small_primes_init);
+
+	/* a factor above sqrt(2^p - 1) has a cofactor below it */
+	if (bits > p / 2) {
+		bits = (unsigned)(p / 2);
+	}
+
+	assert(bits <= 126);
+
+	if (bits < 2) {
+		return 0;
+	}
+
+	uint128_t q_max = (uint128_t)1 << bits;
+	uint128_t k_max = (q_max - 2) / (2 * (uint128_t)p);
+	char composite[SEGMENT_SIZE];
+
+	for (uint128_t k0 = 1; k0 <= k_max; k0 += SEGMENT_SIZE) {
+		memset(composite, 0, sizeof(composite));
+
+		/* q = 2kp + 1 divisible by r iff k = -(2p)^-1 (mod r) */
+		for (size_t i = 0; i < small_primes_count; ++i) {
+			uint64_t r = small_primes[i];
+
+			if (r == p) {
+				continue;
+			}
+
+			uint64_t s = 2 * (uint64_t)(p % r) % r;
+			uint64_t s_inv = 1;
+
+			for (uint64_t e = r - 2, b = s; e != 0; e >>= 1) {
+				if (e & 1) {
+					s_inv = s_inv * b % r;
+				}
+				b = b * b % r;
+			}
+
+			uint64_t k = (r - s_inv) % r;
+			uint64_t start = (uint64_t)((k + r - (uint64_t)(k0 % r)) % r);
+
+			for (uint64_t j = start; j < SEGMENT_SIZE; j += r) {
+				/* do not sieve out q = r itself */
+				if (2 * (k0 + j) * p + 1 != r) {
+					composite[j] = 1;
+				}
+			}
+		}
+
+		for (uint64_t j = 0; j < SEGMENT_SIZE && k0 + j <= k_max; ++j) {
+			uint128_t q = 2 * (k0 + j) * (uint128_t)p + 1;
+			unsigned q8 = (unsigned)(q & 7);
+
+			/* factors of 2^p - 1 are +-1 mod 8 */
+			if (composite[j] || (q8 != 1 && q8 != 7)) {
+				continue;
+			}
+
+			if (divides(q, p)) {
+				return q;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int mersenne_trial_factor(mpi_t q, mp_bitcnt_t p, unsigned bits)
+{
+	uint128_t r = trial_factor(p, bits);
+
+	mpi_set_u64(q, (uint64_t)(r >> 64));
+	mpi_mul_2exp(q, q, 64);
+	mpi_add_u64(q, q, (uint64_t)r);
+
+	return r != 0;
+}
+
+#define STATUS_FACTORED 1
+#define STATUS_COMPOSITE 2
+#define STATUS_PRIME 3
+#define STATUS_LARGE 4
+
+struct search {
+	mp_bitcnt_t *exponents;
+	int *status;
+	size_t count;
+	unsigned bits;
+	size_t next;
+	pthread_mutex_t mutex;
+};
+
+static void *search_worker(void *arg)
+{
+	struct search *search = arg;
+
+	while (1) {
+		pthread_mutex_lock(&search->mutex);
+		size_t i = search->next++;
+		pthread_mutex_unlock(&search->mutex);
+
+		if (i >= search->count) {
+			break;
+		}
+
+		mp_bitcnt_t p = search->exponents[i];
+
+		if (trial_factor(p, search->bits) != 0) {
+			search->status[i] = STATUS_FACTORED;
+		} else if (p >= LARGE_EXPONENT) {
+			search->status[i] = STATUS_LARGE;
+		} else {
+			search->status[i] = mpi_llt(p) ? STATUS_PRIME : STATUS_COMPOSITE;
+		}
+	}
+
+	return NULL;
+}
+
+void mersenne_search(mp_bitcnt_t begin, mp_bitcnt_t end, unsigned bits,
+	void (*prime)(mp_bitcnt_t p, void *arg), void *arg, struct mersenne_stats *stats)
+{
+	struct search search;
+
+	search.count = 0;
+	search.exponents = NULL;
+
+	for (mp_bitcnt_t p = begin; p < end; ++p) {
+		if (prime_p(p)) {
+			search.exponents = realloc(search.exponents, (search.count + 1) * sizeof(mp_bitcnt_t));
+
+			if (search.exponents == NULL) {
+				abort();
+			}
+
+			search.exponents[search.count++] = p;
+		}
+	}
+
+	search.status = calloc(search.count + 1, sizeof(int));
+	search.bits = bits;
+	search.next = 0;
+	pthread_mutex_init(&search.mutex, NULL);
+
+	if (search.status == NULL) {
+		abort();
+	}
+
+	/* small exponents: one per thread */
+	size_t nthreads = (size_t)mpi_get_num_threads();
+
+	if (nthreads > search.count) {
+		nthreads = search.count;
+	}
+
+	pthread_t *threads = malloc((nthreads + 1) * sizeof(pthread_t));
+
+	if (threads == NULL) {
+		abort();
+	}
+
+	size_t nstarted = 0;
+
+	for (size_t t = 1; t < nthreads; ++t) {
+		if (pthread_create(&threads[nstarted], NULL, search_worker, &search) == 0) {
+			nstarted++;
+		}
+	}
+
+	search_worker(&search);
+
+	for (size_t t = 0; t < nstarted; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+
+	free(threads);
+
+	/* large exponents: one at a time, mpi_llt() splitting every squaring over the threads */
+	for (size_t i = 0; i < search.count; ++i) {
+		if (search.status[i] == STATUS_LARGE) {
+			search.status[i] = mpi_llt(search.exponents[i]) ? STATUS_PRIME : STATUS_COMPOSITE;
+		}
+	}
+
+	if (stats != NULL) {
+		memset(stats, 0, sizeof(*stats));
+		stats->exponents = search.count;
+	}
+
+	for (size_t i = 0; i < search.count; ++i) {
+		if (stats != NULL) {
+			stats->factored += search.status[i] == STATUS_FACTORED;
+			stats->tested += search.status[i] != STATUS_FACTORED;
+			stats->primes += search.status[i] == STATUS_PRIME;
+		}
+
+		if (search.status[i] == STATUS_PRIME && prime != NULL) {
+			prime(search.exponents[i], arg);
+		}
+	}
+
+	free(search.exponents);
+	free(search.status);
+	pthread_mutex_destroy(&search.mutex);
+}
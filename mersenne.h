@@ -0,0 +1,35 @@
+#ifndef MERSENNE_H
+#define MERSENNE_H
+
+#include "mpi.h"
+
+struct mersenne_stats {
+	/* prime exponents in the range */
+	uint64_t exponents;
+	/* exponents eliminated by trial factoring */
+	uint64_t factored;
+	/* exponents that went through the Lucas-Lehmer test */
+	uint64_t tested;
+	/* Mersenne primes found */
+	uint64_t primes;
+};
+
+/* Does q divide 2^p - 1? (q odd, below 2^126) */
+int mersenne_divides(const mpi_t q, mp_bitcnt_t p);
+
+/*
+ * Find the smallest factor q = 2kp + 1 < 2^bits of 2^p - 1 (p prime, bits at
+ * most 126), considering only q with q^2 < 2^p. Returns 0 if there is none.
+ */
+int mersenne_trial_factor(mpi_t q, mp_bitcnt_t p, unsigned bits);
+
+/*
+ * Test 2^p - 1 for all primes p in [begin, end): trial factoring up to the
+ * given bit depth, then the Lucas-Lehmer test of the survivors. Exponents are
+ * spread over mpi_get_num_threads() threads. The callback is invoked for every
+ * Mersenne prime, in increasing order of p, from the calling thread.
+ */
+void mersenne_search(mp_bitcnt_t begin, mp_bitcnt_t end, unsigned bits,
+	void (*prime)(mp_bitcnt_t p, void *arg), void *arg, struct mersenne_stats *stats);
+
+#endif
@@ -0,0 +1,20 @@
+/* Default parameters; 'make params' regenerates this file for the build machine. */
+#ifndef MPI_PARAMS_H
+#define MPI_PARAMS_H
+
+/* operands from this many limbs on are multiplied by Karatsuba */
+#define MUL_KARATSUBA_THRESHOLD 32
+
+/* operands from this many limbs on are multiplied by the NTT */
+#define MUL_NTT_THRESHOLD 640
+
+/* decimal strings up to this many digits are parsed by the basecase */
+#define SET_STR_THRESHOLD 512
+
+/* numbers up to this many decimal digits are printed by the basecase */
+#define GET_STR_THRESHOLD 512
+
+/* Mersenne exponents from this one on use the IBDWT in the Lucas-Lehmer test */
+#define LLT_FFT_THRESHOLD 32
+
+#endif
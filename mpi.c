@@ -1,1088 +1,6216 @@
 #include "mpi.h"
+#include "mpi-params.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <wchar.h>
+#include <limits.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <math.h>
+#include <complex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* upper bound on the number of threads used by a single operation */
+static int num_threads = 1;
+
+/* threads that may still be forked (shared by all running operations) */
+static int spare_threads = 0;
+
+static pthread_mutex_t spare_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void mpi_set_num_threads(int n)
+{
+	if (n < 1) {
+		n = 1;
+	}
 
-void mpi_init(mpi_t rop)
+	pthread_mutex_lock(&spare_threads_mutex);
+	spare_threads += n - num_threads;
+	num_threads = n;
+	pthread_mutex_unlock(&spare_threads_mutex);
+}
+
+int mpi_get_num_threads(void)
 {
-	rop->nmemb = 0;
-	rop->data = NULL;
+	pthread_mutex_lock(&spare_threads_mutex);
+	int n = num_threads;
+	pthread_mutex_unlock(&spare_threads_mutex);
+
+	return n;
 }
 
-void mpi_clear(mpi_t rop)
+/* the crossovers of mpi-params.h, each overridable by the environment variable MPI_<name> */
+enum {
+	PARAM_MUL_KARATSUBA,
+	PARAM_MUL_NTT,
+	PARAM_SET_STR,
+	PARAM_GET_STR,
+	PARAM_LLT_FFT,
+	PARAM_COUNT
+};
+
+/* below min, the recursions of Karatsuba and of the string conversions never end */
+static struct {
+	const char *name;
+	size_t value;
+	size_t min;
+} params[PARAM_COUNT] = {
+	{ "MUL_KARATSUBA_THRESHOLD", MUL_KARATSUBA_THRESHOLD, 2 },
+	{ "MUL_NTT_THRESHOLD", MUL_NTT_THRESHOLD, 0 },
+	{ "SET_STR_THRESHOLD", SET_STR_THRESHOLD, 1 },
+	{ "GET_STR_THRESHOLD", GET_STR_THRESHOLD, 1 },
+	{ "LLT_FFT_THRESHOLD", LLT_FFT_THRESHOLD, 0 },
+};
+
+static void param_store(int i, size_t value)
 {
-	free(rop->data);
+	params[i].value = value < params[i].min ? params[i].min : value;
 }
 
-void mpi_enlarge(mpi_t rop, size_t nmemb)
+static pthread_once_t params_once = PTHREAD_ONCE_INIT;
+
+static void params_init(void)
 {
-	if (nmemb > rop->nmemb) {
-		size_t min = rop->nmemb;
+	for (int i = 0; i < PARAM_COUNT; ++i) {
+		char var[64];
 
-		rop->nmemb = nmemb;
+		snprintf(var, sizeof(var), "MPI_%s", params[i].name);
 
-		rop->data = realloc(rop->data, nmemb * sizeof(uint32_t));
+		const char *value = getenv(var);
 
-		if (rop->data == NULL && nmemb != 0) {
-			fprintf(stderr, "Out of memory (%zu words requested)\n", nmemb);
-			abort();
-		}
+		if (value != NULL) {
+			char *end;
+			unsigned long long v = strtoull(value, &end, 10);
+
+			if (*value == 0 || *end != 0) {
+				fprintf(stderr, "Invalid value of %s\n", var);
+				abort();
+			}
 
-		for (size_t n = min; n < nmemb; ++n) {
-			rop->data[n] = 0;
+			param_store(i, (size_t)v);
 		}
 	}
 }
 
-void mpi_compact(mpi_t rop)
+static size_t param(int i)
 {
-	size_t nmemb = rop->nmemb;
+	pthread_once(&params_once, params_init);
 
-	if (rop->nmemb == 0) {
-		return;
-	}
+	return params[i].value;
+}
 
-	for (size_t i = rop->nmemb - 1; i != (size_t)-1; --i) {
-		if (rop->data[i] == 0) {
-			nmemb--;
-		} else {
-			break;
+static int param_index(const char *name)
+{
+	pthread_once(&params_once, params_init);
+
+	for (int i = 0; i < PARAM_COUNT; ++i) {
+		if (strcmp(params[i].name, name) == 0) {
+			return i;
 		}
 	}
 
-	assert(nmemb != (size_t)-1);
-
-	rop->data = realloc(rop->data, nmemb * sizeof(uint32_t));
-	rop->nmemb = nmemb;
-
-	if (rop->data == NULL && nmemb != 0) {
-		fprintf(stderr, "Out of memory (%zu words requested)\n", nmemb);
-		abort();
-	}
+	fprintf(stderr, "Unknown parameter %s\n", name);
+	abort();
 }
 
-static size_t ceil_div(size_t n, size_t d)
+size_t mpi_get_param(const char *name)
 {
-	return (n + d) / d;
+	return params[param_index(name)].value;
 }
 
-void mpi_set_u64(mpi_t rop, uint64_t op)
+void mpi_set_param(const char *name, size_t value)
 {
-	size_t nmemb = ceil_div(64, 31);
-
-	mpi_enlarge(rop, nmemb);
+	param_store(param_index(name), value);
+}
 
-	for (size_t n = 0; n < nmemb; ++n) {
-		rop->data[n] = op & 0x7fffffff;
-		op >>= 31;
-	}
+/*
+ * Instrumentation, compiled in with -DMPI_STATS (and cycle timers with
+ * -DMPI_STATS_CYCLES). Operation counters are kept per thread and summed by
+ * mpi_stats_dump(); the limb storage counters are global.
+ */
+enum {
+	STATS_ADD,
+	STATS_SUB,
+	STATS_MUL,
+	STATS_SQR,
+	STATS_FDIV_QR,
+	STATS_FDIV_QR_U32,
+	STATS_GCD,
+	STATS_POW,
+	STATS_SQRTREM,
+	STATS_ROOT,
+	STATS_PROBAB_PRIME,
+	STATS_MOD_U32_MANY,
+	STATS_SET_STR,
+	STATS_GET_STR,
+	/* algorithms chosen by mpi_mul/mpi_sqr, including recursive calls */
+	STATS_MUL_NAIVE,
+	STATS_MUL_KARATSUBA,
+	STATS_MUL_NTT,
+	STATS_COUNT
+};
+
+#ifdef MPI_STATS
+static const char *const stats_names[STATS_COUNT] = {
+	"mpi_add",
+	"mpi_sub",
+	"mpi_mul",
+	"mpi_sqr",
+	"mpi_fdiv_qr",
+	"mpi_fdiv_qr_u32",
+	"mpi_gcd",
+	"mpi_ui_pow_u32",
+	"mpi_sqrtrem",
+	"mpi_root",
+	"mpi_probab_prime_p",
+	"mpi_mod_u32_many",
+	"mpi_set_str",
+	"mpi_get_str",
+	"mul_naive",
+	"mul_karatsuba",
+	"mul_ntt",
+};
+
+/* counters written by their thread only, read by others with relaxed atomics */
+struct stats {
+	uint64_t calls[STATS_COUNT];
+	uint64_t limbs[STATS_COUNT];
+	uint64_t cycles[STATS_COUNT];
+	uint64_t allocs;
+	uint64_t reallocs;
+	uint64_t frees;
+	uint64_t bytes;
+};
+
+#	define STATS_FIELDS (sizeof(struct stats) / sizeof(uint64_t))
+
+/* the counters of a running thread, and their values at the last mpi_stats_reset() */
+struct stats_thread {
+	struct stats stats;
+	struct stats reset;
+	struct stats_thread *next;
+};
+
+static __thread struct stats_thread *stats_local;
+
+static struct stats_thread *stats_list;
+
+/* counted by the threads that exited since the last mpi_stats_reset() */
+static struct stats stats_exited;
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t stats_key;
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+/* bytes of limb storage in use, and the most ever in use */
+static int64_t stats_live;
+static int64_t stats_peak;
+
+/* total += stats - reset, the whole struct being an array of counters */
+static void stats_accumulate(struct stats *total, const struct stats *stats, const struct stats *reset)
+{
+	uint64_t *t = (uint64_t *)total;
+	const uint64_t *s = (const uint64_t *)stats;
+	const uint64_t *r = (const uint64_t *)reset;
 
-	for (size_t n = nmemb; n < rop->nmemb; ++n) {
-		rop->data[n] = 0;
+	for (size_t i = 0; i < STATS_FIELDS; ++i) {
+		t[i] += __atomic_load_n(&s[i], __ATOMIC_RELAXED) - r[i];
 	}
 }
 
-void mpi_set_u32(mpi_t rop, uint32_t op)
+/* a thread exits: its counters go into stats_exited */
+static void stats_exit(void *arg)
 {
-	size_t nmemb = ceil_div(32, 31);
+	struct stats_thread *thread = arg;
 
-	mpi_enlarge(rop, nmemb);
+	pthread_mutex_lock(&stats_mutex);
 
-	for (size_t n = 0; n < nmemb; ++n) {
-		rop->data[n] = op & 0x7fffffff;
-		op >>= 31;
-	}
+	stats_accumulate(&stats_exited, &thread->stats, &thread->reset);
 
-	for (size_t n = nmemb; n < rop->nmemb; ++n) {
-		rop->data[n] = 0;
+	struct stats_thread **link = &stats_list;
+
+	while (*link != thread) {
+		link = &(*link)->next;
 	}
-}
 
-uint64_t mpi_get_u64(const mpi_t op)
-{
-	size_t nmemb = op->nmemb;
+	*link = thread->next;
 
-	if (nmemb > ceil_div(64, 31)) {
-		nmemb = ceil_div(64, 31);
-	}
+	pthread_mutex_unlock(&stats_mutex);
 
-	uint64_t r = 0;
+	free(thread);
+	stats_local = NULL;
+}
 
-	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
-		r <<= 31;
-		r |= op->data[n];
+static void stats_init(void)
+{
+	if (pthread_key_create(&stats_key, stats_exit) != 0) {
+		abort();
 	}
-
-	return r;
 }
 
-uint32_t mpi_get_u32(const mpi_t op)
+static struct stats *stats_get(void)
 {
-	size_t nmemb = op->nmemb;
+	if (stats_local == NULL) {
+		pthread_once(&stats_once, stats_init);
 
-	if (nmemb > ceil_div(32, 31)) {
-		nmemb = ceil_div(32, 31);
-	}
+		stats_local = calloc(1, sizeof(struct stats_thread));
 
-	uint32_t r = 0;
+		if (stats_local == NULL) {
+			abort();
+		}
 
-	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
-		r <<= 31;
-		r |= op->data[n];
+		pthread_setspecific(stats_key, stats_local);
+
+		pthread_mutex_lock(&stats_mutex);
+		stats_local->next = stats_list;
+		stats_list = stats_local;
+		pthread_mutex_unlock(&stats_mutex);
 	}
 
-	return r;
+	return &stats_local->stats;
 }
 
-void mpi_add(mpi_t rop, const mpi_t op1, const mpi_t op2)
+static void stats_add(uint64_t *counter, uint64_t value)
 {
-	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
 
-	mpi_enlarge(rop, nmemb);
+/* TSC cycles (nanoseconds off x86-64) */
+static uint64_t stats_clock(void)
+{
+#	if defined(MPI_STATS_CYCLES) && defined(__x86_64__)
+	return __builtin_ia32_rdtsc();
+#	elif defined(MPI_STATS_CYCLES)
+	struct timespec ts;
 
-	uint32_t c = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	/* op1 + op2 */
-	for (size_t n = 0; n < rop->nmemb; ++n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = (n < op2->nmemb) ? op2->data[n] : 0;
-		rop->data[n] = r1 + r2 + c;
-		c = rop->data[n] >> 31;
-		rop->data[n] &= 0x7fffffff;
-	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#	else
+	return 0;
+#	endif
+}
 
-	if (c != 0) {
-		mpi_enlarge(rop, nmemb + 1);
-		rop->data[nmemb] = 0 + c;
-	}
+static uint64_t stats_begin(int op, size_t limbs)
+{
+	struct stats *stats = stats_get();
 
-	mpi_compact(rop);
+	stats_add(&stats->calls[op], 1);
+	stats_add(&stats->limbs[op], limbs);
+
+	return stats_clock();
 }
 
-void mpi_sub(mpi_t rop, const mpi_t op1, const mpi_t op2)
+static void stats_end(int op, uint64_t start)
 {
-	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+	stats_add(&stats_get()->cycles[op], stats_clock() - start);
+}
 
-	mpi_enlarge(rop, nmemb);
+/* limb storage of old_size bytes became new_size bytes */
+static void stats_storage(size_t old_size, size_t new_size)
+{
+	struct stats *stats = stats_get();
 
-	uint32_t c = 0;
+	if (old_size == new_size) {
+		return;
+	}
 
-	/* op1 - op2 */
-	for (size_t n = 0; n < rop->nmemb; ++n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = (n < op2->nmemb) ? op2->data[n] : 0;
-		rop->data[n] = r1 - r2 - c;
-		c = rop->data[n] >> 31;
-		rop->data[n] &= 0x7fffffff;
+	if (old_size == 0) {
+		stats_add(&stats->allocs, 1);
+	} else if (new_size == 0) {
+		stats_add(&stats->frees, 1);
+	} else {
+		stats_add(&stats->reallocs, 1);
 	}
 
-	if (c != 0) {
-		fprintf(stderr, "Negative numbers not supported\n");
-		abort();
+	if (new_size > old_size) {
+		stats_add(&stats->bytes, new_size - old_size);
 	}
 
-	mpi_compact(rop);
+	int64_t live = __atomic_add_fetch(&stats_live, (int64_t)new_size - (int64_t)old_size, __ATOMIC_RELAXED);
+	int64_t peak = __atomic_load_n(&stats_peak, __ATOMIC_RELAXED);
+
+	while (live > peak && !__atomic_compare_exchange_n(&stats_peak, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
 }
 
-void mpi_add_u64(mpi_t rop, const mpi_t op1, uint64_t op2)
+#	define STATS_BEGIN(op, limbs) uint64_t stats_start = stats_begin(op, limbs)
+#	define STATS_END(op) stats_end(op, stats_start)
+#	define STATS_COUNT_CALL(op, limbs) (void)stats_begin(op, limbs)
+#	define STATS_STORAGE(old_size, new_size) stats_storage(old_size, new_size)
+#else
+#	define STATS_BEGIN(op, limbs) ((void)0)
+#	define STATS_END(op) ((void)0)
+#	define STATS_COUNT_CALL(op, limbs) ((void)0)
+#	define STATS_STORAGE(old_size, new_size) ((void)0)
+#endif
+
+void mpi_stats_dump(FILE *stream)
 {
-	size_t nmemb = op1->nmemb > ceil_div(64, 31) ? op1->nmemb : ceil_div(64, 31);
-
-	mpi_enlarge(rop, nmemb);
+#ifdef MPI_STATS
+	/* threads counts the running threads that have counted anything */
+	struct stats total;
+	size_t threads = 0;
+
+	pthread_mutex_lock(&stats_mutex);
+	total = stats_exited;
+	for (struct stats_thread *thread = stats_list; thread != NULL; thread = thread->next) {
+		stats_accumulate(&total, &thread->stats, &thread->reset);
+		threads++;
+	}
+	pthread_mutex_unlock(&stats_mutex);
 
-	uint32_t c = 0;
+	fprintf(stream, "{\n\t\"threads\": %zu,\n\t\"operations\": {\n", threads);
 
-	/* op1 + op2 */
-	for (size_t n = 0; n < rop->nmemb; ++n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = op2 & 0x7fffffff;
-		op2 >>= 31;
-		rop->data[n] = r1 + r2 + c;
-		c = rop->data[n] >> 31;
-		rop->data[n] &= 0x7fffffff;
+	for (int op = 0; op < STATS_COUNT; ++op) {
+		fprintf(stream, "\t\t\"%s\": { \"calls\": %" PRIu64 ", \"limbs\": %" PRIu64,
+			stats_names[op], total.calls[op], total.limbs[op]);
+#	ifdef MPI_STATS_CYCLES
+		fprintf(stream, ", \"cycles\": %" PRIu64, total.cycles[op]);
+#	endif
+		fprintf(stream, " }%s\n", op + 1 < STATS_COUNT ? "," : "");
 	}
 
-	if (c != 0) {
-		mpi_enlarge(rop, nmemb + 1);
-		rop->data[nmemb] = 0 + c;
-	}
+	fprintf(stream, "\t},\n\t\"storage\": { \"allocs\": %" PRIu64 ", \"reallocs\": %" PRIu64 ", \"frees\": %" PRIu64
+		", \"bytes\": %" PRIu64 ", \"live\": %" PRId64 ", \"peak\": %" PRId64 " }\n}\n",
+		total.allocs, total.reallocs, total.frees, total.bytes,
+		__atomic_load_n(&stats_live, __ATOMIC_RELAXED), __atomic_load_n(&stats_peak, __ATOMIC_RELAXED));
+#else
+	fprintf(stream, "{ \"enabled\": false }\n");
+#endif
 }
 
-void mpi_sub_u64(mpi_t rop, const mpi_t op1, uint64_t op2)
+void mpi_stats_reset(void)
 {
-	size_t nmemb = op1->nmemb > ceil_div(64, 31) ? op1->nmemb : ceil_div(64, 31);
-
-	mpi_enlarge(rop, nmemb);
+#ifdef MPI_STATS
+	/* the running threads keep counting; only the baseline they are read against moves */
+	struct stats zero;
 
-	uint32_t c = 0;
+	memset(&zero, 0, sizeof(zero));
 
-	/* op1 + op2 */
-	for (size_t n = 0; n < rop->nmemb; ++n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = op2 & 0x7fffffff;
-		op2 >>= 31;
-		rop->data[n] = r1 - r2 - c;
-		c = rop->data[n] >> 31;
-		rop->data[n] &= 0x7fffffff;
+	pthread_mutex_lock(&stats_mutex);
+	for (struct stats_thread *thread = stats_list; thread != NULL; thread = thread->next) {
+		thread->reset = zero;
+		stats_accumulate(&thread->reset, &thread->stats, &zero);
 	}
+	stats_exited = zero;
+	pthread_mutex_unlock(&stats_mutex);
 
-	if (c != 0) {
-		fprintf(stderr, "Negative numbers not supported\n");
-		abort();
-	}
+	__atomic_store_n(&stats_peak, __atomic_load_n(&stats_live, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+#endif
 }
 
-void mpi_add_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+struct task {
+	void (*func)(void *);
+	void *arg;
+	pthread_t thread;
+	int forked;
+};
+
+static void *task_main(void *arg)
 {
-	size_t nmemb = op1->nmemb > ceil_div(32, 31) ? op1->nmemb : ceil_div(32, 31);
+	struct task *task = arg;
 
-	mpi_enlarge(rop, nmemb);
+	task->func(task->arg);
 
-	uint32_t c = 0;
+	return NULL;
+}
 
-	/* op1 + op2 */
-	for (size_t n = 0; n < rop->nmemb; ++n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = op2 & 0x7fffffff;
-		op2 >>= 31;
-		rop->data[n] = r1 + r2 + c;
-		c = rop->data[n] >> 31;
-		rop->data[n] &= 0x7fffffff;
+/* run func(arg) on a new thread if the budget allows, otherwise defer it to task_join() */
+static void task_fork(struct task *task, void (*func)(void *), void *arg)
+{
+	task->func = func;
+	task->arg = arg;
+	task->forked = 0;
+
+	pthread_mutex_lock(&spare_threads_mutex);
+	if (spare_threads > 0) {
+		spare_threads--;
+		task->forked = 1;
 	}
+	pthread_mutex_unlock(&spare_threads_mutex);
 
-	if (c != 0) {
-		mpi_enlarge(rop, nmemb + 1);
-		rop->data[nmemb] = 0 + c;
+	if (task->forked && pthread_create(&task->thread, NULL, task_main, task) != 0) {
+		pthread_mutex_lock(&spare_threads_mutex);
+		spare_threads++;
+		pthread_mutex_unlock(&spare_threads_mutex);
+		task->forked = 0;
 	}
 }
 
-void mpi_sub_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+static void task_join(struct task *task)
 {
-	size_t nmemb = op1->nmemb > ceil_div(32, 31) ? op1->nmemb : ceil_div(32, 31);
+	if (!task->forked) {
+		task->func(task->arg);
+		return;
+	}
 
-	mpi_enlarge(rop, nmemb);
+	pthread_join(task->thread, NULL);
 
-	uint32_t c = 0;
+	pthread_mutex_lock(&spare_threads_mutex);
+	spare_threads++;
+	pthread_mutex_unlock(&spare_threads_mutex);
+}
 
-	/* op1 + op2 */
-	for (size_t n = 0; n < rop->nmemb; ++n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = op2 & 0x7fffffff;
-		op2 >>= 31;
-		rop->data[n] = r1 - r2 - c;
-		c = rop->data[n] >> 31;
-		rop->data[n] &= 0x7fffffff;
-	}
+struct parallel_for_args {
+	void (*func)(void *, size_t, size_t);
+	void *arg;
+	size_t begin;
+	size_t end;
+};
 
-	if (c != 0) {
-		fprintf(stderr, "Negative numbers not supported\n");
-		abort();
-	}
+static void parallel_for_task(void *arg)
+{
+	struct parallel_for_args *args = arg;
+
+	args->func(args->arg, args->begin, args->end);
 }
 
-void mpi_mul_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+/* call func(arg, begin, end) on disjoint slices of [0, count), one slice per available thread */
+static void parallel_for(size_t count, void (*func)(void *, size_t, size_t), void *arg)
 {
-	size_t nmemb = op1->nmemb + 1;
+	size_t n = (size_t)mpi_get_num_threads();
 
-	mpi_enlarge(rop, nmemb);
-
-	uint32_t c = 0;
+	if (n > count) {
+		n = count;
+	}
 
-	/* op1 * op2 */
-	for (size_t n = 0; n < op1->nmemb; ++n) {
-		assert(op1->data[n] <= (UINT64_MAX - c) / op2);
-		uint64_t r = (uint64_t)op1->data[n] * op2 + c;
-		rop->data[n] = r & 0x7fffffff;
-		c = r >> 31;
+	if (n <= 1) {
+		func(arg, 0, count);
+		return;
 	}
 
-	while (c != 0) {
-		mpi_enlarge(rop, nmemb + 1);
-		rop->data[nmemb] = c & 0x7fffffff;
-		c >>= 31;
+	struct task *tasks = malloc(n * sizeof(struct task));
+	struct parallel_for_args *args = malloc(n * sizeof(struct parallel_for_args));
+
+	if (tasks == NULL || args == NULL) {
+		abort();
 	}
-}
 
-int mpi_set_str(mpi_t rop, const char *str, int base)
-{
-	assert(base == 10);
+	for (size_t t = 0; t < n; ++t) {
+		args[t].func = func;
+		args[t].arg = arg;
+		args[t].begin = count * t / n;
+		args[t].end = count * (t + 1) / n;
+	}
 
-	size_t len = strlen(str);
+	for (size_t t = 1; t < n; ++t) {
+		task_fork(&tasks[t], parallel_for_task, &args[t]);
+	}
 
-	mpi_set_u32(rop, (uint32_t)0);
+	parallel_for_task(&args[0]);
 
-	for (size_t i = 0; i < len; ++i) {
-		mpi_mul_u32(rop, rop, (uint32_t)10);
-		assert(str[i] >= '0' && str[i] <= '9');
-		mpi_add_u32(rop, rop, (uint32_t)(str[i] - '0'));
+	for (size_t t = 1; t < n; ++t) {
+		task_join(&tasks[t]);
 	}
 
-	return 0;
+	free(tasks);
+	free(args);
 }
 
-void mpi_swap(mpi_t rop1, mpi_t rop2)
+void mpi_init(mpi_t rop)
 {
-	mpi_t t;
+	rop->nmemb = 0;
+	rop->data = NULL;
+	rop->mmap = NULL;
+}
 
-	*t = *rop1;
-	*rop1 = *rop2;
-	*rop2 = *t;
+/*
+ * File-backed storage. The file holds a 4 KiB header followed by the limbs,
+ * so that the whole file can be mapped and the limbs used in place:
+ *
+ *   offset 0    "MPIMMAP1"
+ *   offset 8    number of limbs in use (uint64_t, native byte order)
+ *   offset 16   zeros up to offset 4096
+ *   offset 4096 the limbs (uint32_t, native byte order), 31 bits each,
+ *               least significant first; the rest of the file is spare capacity
+ */
+
+#define MMAP_HEADER_SIZE 4096
+
+struct mpi_mmap {
+	int fd;
+	unsigned char *base;
+	/* limbs that fit in the file */
+	size_t capacity;
+};
+
+static void mmap_fail(const char *what)
+{
+	perror(what);
+	abort();
 }
 
-void mpi_set(mpi_t rop, const mpi_t op)
+static void mmap_sync_nmemb(mpi_t rop)
 {
-	mpi_enlarge(rop, op->nmemb);
+	uint64_t nmemb = rop->nmemb;
 
-	for (size_t n = 0; n < op->nmemb; ++n) {
-		rop->data[n] = op->data[n];
-	}
+	memcpy(rop->mmap->base + 8, &nmemb, sizeof(nmemb));
+}
 
-	for (size_t n = op->nmemb; n < rop->nmemb; ++n) {
+static void mmap_grow(mpi_t rop, size_t capacity)
+{
+	struct mpi_mmap *map = rop->mmap;
+	size_t old_size = MMAP_HEADER_SIZE + map->capacity * sizeof(uint32_t);
+	size_t new_size = MMAP_HEADER_SIZE + capacity * sizeof(uint32_t);
+
+	if (ftruncate(map->fd, (off_t)new_size) != 0) {
+		mmap_fail("ftruncate");
+	}
+
+	void *base = mremap(map->base, old_size, new_size, MREMAP_MAYMOVE);
+
+	if (base == MAP_FAILED) {
+		mmap_fail("mremap");
+	}
+
+	map->base = base;
+	map->capacity = capacity;
+	rop->data = (uint32_t *)(map->base + MMAP_HEADER_SIZE);
+}
+
+void mpi_init_mmap(mpi_t rop, const char *path, mp_bitcnt_t bits)
+{
+	struct mpi_mmap *map = malloc(sizeof(struct mpi_mmap));
+
+	if (map == NULL) {
+		abort();
+	}
+
+	map->fd = open(path, O_RDWR | O_CREAT, 0644);
+
+	if (map->fd < 0) {
+		mmap_fail(path);
+	}
+
+	struct stat st;
+
+	if (fstat(map->fd, &st) != 0) {
+		mmap_fail(path);
+	}
+
+	size_t size = (size_t)st.st_size;
+	int fresh = size == 0;
+
+	if (fresh) {
+		size = MMAP_HEADER_SIZE + (bits + 30) / 31 * sizeof(uint32_t);
+
+		if (ftruncate(map->fd, (off_t)size) != 0) {
+			mmap_fail(path);
+		}
+	} else if (size < MMAP_HEADER_SIZE || (size - MMAP_HEADER_SIZE) % sizeof(uint32_t) != 0) {
+		fprintf(stderr, "%s is not an integer file\n", path);
+		abort();
+	}
+
+	map->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+
+	if (map->base == MAP_FAILED) {
+		mmap_fail(path);
+	}
+
+	map->capacity = (size - MMAP_HEADER_SIZE) / sizeof(uint32_t);
+
+	rop->data = (uint32_t *)(map->base + MMAP_HEADER_SIZE);
+	rop->mmap = map;
+
+	if (fresh) {
+		memcpy(map->base, "MPIMMAP1", 8);
+		rop->nmemb = 0;
+		mmap_sync_nmemb(rop);
+	} else {
+		uint64_t nmemb;
+
+		memcpy(&nmemb, map->base + 8, sizeof(nmemb));
+
+		if (memcmp(map->base, "MPIMMAP1", 8) != 0 || nmemb > map->capacity) {
+			fprintf(stderr, "%s is not an integer file\n", path);
+			abort();
+		}
+
+		rop->nmemb = (size_t)nmemb;
+	}
+}
+
+void mpi_clear(mpi_t rop)
+{
+	if (rop->mmap != NULL) {
+		struct mpi_mmap *map = rop->mmap;
+
+		munmap(map->base, MMAP_HEADER_SIZE + map->capacity * sizeof(uint32_t));
+		close(map->fd);
+		free(map);
+		return;
+	}
+
+	STATS_STORAGE(rop->nmemb * sizeof(uint32_t), 0);
+
+	free(rop->data);
+}
+
+/* allocations from this size on are 2 MiB aligned and backed by transparent huge pages */
+#define HUGE_PAGE_THRESHOLD ((size_t)2 << 20)
+
+/* zero newly enlarged limbs from the threads that will later work on them (NUMA first touch) */
+#ifndef MPI_FIRST_TOUCH
+#	define MPI_FIRST_TOUCH 1
+#endif
+
+/* memory to be released with free() */
+static void *mpi_alloc(size_t size)
+{
+	void *ptr;
+
+	if (size < HUGE_PAGE_THRESHOLD) {
+		ptr = malloc(size);
+	} else {
+		size = (size + HUGE_PAGE_THRESHOLD - 1) / HUGE_PAGE_THRESHOLD * HUGE_PAGE_THRESHOLD;
+
+		if (posix_memalign(&ptr, HUGE_PAGE_THRESHOLD, size) != 0) {
+			ptr = NULL;
+		}
+#ifdef MADV_HUGEPAGE
+		if (ptr != NULL) {
+			madvise(ptr, size, MADV_HUGEPAGE);
+		}
+#endif
+	}
+
+	if (ptr == NULL && size != 0) {
+		fprintf(stderr, "Out of memory (%zu bytes requested)\n", size);
+		abort();
+	}
+
+	return ptr;
+}
+
+/* limbs held by a heap block for nmemb limbs: huge allocations are rounded up, and the rest is spare */
+static size_t heap_capacity(size_t nmemb)
+{
+	size_t size = nmemb * sizeof(uint32_t);
+
+	if (size < HUGE_PAGE_THRESHOLD) {
+		return nmemb;
+	}
+
+	return (size + HUGE_PAGE_THRESHOLD - 1) / HUGE_PAGE_THRESHOLD * HUGE_PAGE_THRESHOLD / sizeof(uint32_t);
+}
+
+#if MPI_FIRST_TOUCH
+static void zero_limbs(void *arg, size_t begin, size_t end)
+{
+	uint32_t *data = arg;
+
+	memset(data + begin, 0, (end - begin) * sizeof(uint32_t));
+}
+#endif
+
+/* limbs [begin, end) := 0, large ranges in the slices of the parallel loops over a result */
+static void zero_range(uint32_t *data, size_t begin, size_t end)
+{
+	if (end <= begin) {
+		return;
+	}
+#if MPI_FIRST_TOUCH
+	if ((end - begin) * sizeof(uint32_t) >= HUGE_PAGE_THRESHOLD) {
+		parallel_for(end - begin, zero_limbs, data + begin);
+		return;
+	}
+#endif
+	memset(data + begin, 0, (end - begin) * sizeof(uint32_t));
+}
+
+void mpi_enlarge(mpi_t rop, size_t nmemb)
+{
+	if (nmemb <= rop->nmemb) {
+		return;
+	}
+
+	size_t min = rop->nmemb;
+
+	if (rop->mmap != NULL) {
+		if (nmemb > rop->mmap->capacity) {
+			mmap_grow(rop, nmemb > 2 * rop->mmap->capacity ? nmemb : 2 * rop->mmap->capacity);
+		}
+
+		rop->nmemb = nmemb;
+		mmap_sync_nmemb(rop);
+		zero_range(rop->data, min, nmemb);
+		return;
+	}
+
+	STATS_STORAGE(min * sizeof(uint32_t), nmemb * sizeof(uint32_t));
+
+	if (nmemb <= heap_capacity(min)) {
+		/* within the rounded-up block */
+	} else if (nmemb * sizeof(uint32_t) >= HUGE_PAGE_THRESHOLD) {
+		uint32_t *data = mpi_alloc(nmemb * sizeof(uint32_t));
+
+		if (min != 0) {
+			memcpy(data, rop->data, min * sizeof(uint32_t));
+		}
+
+		free(rop->data);
+		rop->data = data;
+	} else {
+		rop->data = realloc(rop->data, nmemb * sizeof(uint32_t));
+
+		if (rop->data == NULL) {
+			fprintf(stderr, "Out of memory (%zu words requested)\n", nmemb);
+			abort();
+		}
+	}
+
+	rop->nmemb = nmemb;
+	zero_range(rop->data, min, nmemb);
+}
+
+void mpi_compact(mpi_t rop)
+{
+	size_t nmemb = rop->nmemb;
+
+	if (rop->nmemb == 0) {
+		return;
+	}
+
+	for (size_t i = rop->nmemb - 1; i != (size_t)-1; --i) {
+		if (rop->data[i] == 0) {
+			nmemb--;
+		} else {
+			break;
+		}
+	}
+
+	assert(nmemb != (size_t)-1);
+
+	if (rop->mmap != NULL) {
+		rop->nmemb = nmemb;
+		mmap_sync_nmemb(rop);
+		return;
+	}
+
+	STATS_STORAGE(rop->nmemb * sizeof(uint32_t), nmemb * sizeof(uint32_t));
+
+	/* a huge block is only shrunk to the rounded-up size, so that mpi_enlarge() can grow back into it */
+	if (heap_capacity(nmemb) != heap_capacity(rop->nmemb)) {
+		rop->data = realloc(rop->data, heap_capacity(nmemb) * sizeof(uint32_t));
+
+		if (rop->data == NULL && nmemb != 0) {
+			fprintf(stderr, "Out of memory (%zu words requested)\n", nmemb);
+			abort();
+		}
+	}
+
+	rop->nmemb = nmemb;
+}
+
+/* rop := op, taking over the storage of op unless rop is file-backed */
+static void mpi_move(mpi_t rop, mpi_t op)
+{
+	if (rop->mmap != NULL) {
+		mpi_set(rop, op);
+	} else {
+		mpi_swap(rop, op);
+	}
+}
+
+static size_t ceil_div(size_t n, size_t d)
+{
+	return (n + d) / d;
+}
+
+void mpi_set_u64(mpi_t rop, uint64_t op)
+{
+	size_t nmemb = ceil_div(64, 31);
+
+	mpi_enlarge(rop, nmemb);
+
+	for (size_t n = 0; n < nmemb; ++n) {
+		rop->data[n] = op & 0x7fffffff;
+		op >>= 31;
+	}
+
+	for (size_t n = nmemb; n < rop->nmemb; ++n) {
+		rop->data[n] = 0;
+	}
+}
+
+void mpi_set_u32(mpi_t rop, uint32_t op)
+{
+	size_t nmemb = ceil_div(32, 31);
+
+	mpi_enlarge(rop, nmemb);
+
+	for (size_t n = 0; n < nmemb; ++n) {
+		rop->data[n] = op & 0x7fffffff;
+		op >>= 31;
+	}
+
+	for (size_t n = nmemb; n < rop->nmemb; ++n) {
 		rop->data[n] = 0;
 	}
 }
 
-void mpi_mul_naive(mpi_t rop, const mpi_t op1, const mpi_t op2)
+uint64_t mpi_get_u64(const mpi_t op)
+{
+	size_t nmemb = op->nmemb;
+
+	if (nmemb > ceil_div(64, 31)) {
+		nmemb = ceil_div(64, 31);
+	}
+
+	uint64_t r = 0;
+
+	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
+		r <<= 31;
+		r |= op->data[n];
+	}
+
+	return r;
+}
+
+uint32_t mpi_get_u32(const mpi_t op)
+{
+	size_t nmemb = op->nmemb;
+
+	if (nmemb > ceil_div(32, 31)) {
+		nmemb = ceil_div(32, 31);
+	}
+
+	uint32_t r = 0;
+
+	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
+		r <<= 31;
+		r |= op->data[n];
+	}
+
+	return r;
+}
+
+static int native_endian(void)
+{
+	const uint16_t one = 1;
+
+	return *(const unsigned char *)&one == 1 ? -1 : 1;
+}
+
+/* address of the j-th least significant byte of the i-th least significant word */
+static size_t word_byte(size_t i, size_t j, size_t count, int order, size_t size, int endian)
+{
+	size_t word = order > 0 ? count - 1 - i : i;
+	size_t byte = endian > 0 ? size - 1 - j : j;
+
+	return word * size + byte;
+}
+
+void mpi_import(mpi_t rop, size_t count, int order, size_t size, int endian, size_t nails, const void *op)
+{
+	const unsigned char *bytes = op;
+	size_t numb = 8 * size - nails;
+
+	assert(size > 0 && nails < 8 * size);
+
+	if (endian == 0) {
+		endian = native_endian();
+	}
+
+	mpi_t tmp;
+
+	mpi_init(tmp);
+
+	mpi_enlarge(tmp, ceil_div(count * numb, 31));
+
+	uint64_t acc = 0;
+	size_t acc_bits = 0;
+	size_t n = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t j = 0; j < size && 8 * j < numb; ++j) {
+			size_t valid = numb - 8 * j < 8 ? numb - 8 * j : 8;
+			uint64_t byte = bytes[word_byte(i, j, count, order, size, endian)] & ((1U << valid) - 1);
+
+			acc |= byte << acc_bits;
+			acc_bits += valid;
+
+			if (acc_bits >= 31) {
+				tmp->data[n++] = (uint32_t)(acc & 0x7fffffff);
+				acc >>= 31;
+				acc_bits -= 31;
+			}
+		}
+	}
+
+	if (acc_bits > 0) {
+		tmp->data[n++] = (uint32_t)acc;
+	}
+
+	assert(n <= tmp->nmemb);
+
+	mpi_move(rop, tmp);
+
+	mpi_clear(tmp);
+
+	mpi_compact(rop);
+}
+
+void *mpi_export(void *rop, size_t *countp, int order, size_t size, int endian, size_t nails, const mpi_t op)
+{
+	size_t numb = 8 * size - nails;
+	size_t bits = op->nmemb > 0 ? mpi_sizeinbase(op, 2) : 0;
+	size_t count = (bits + numb - 1) / numb;
+
+	assert(size > 0 && nails < 8 * size);
+
+	if (endian == 0) {
+		endian = native_endian();
+	}
+
+	if (countp != NULL) {
+		*countp = count;
+	}
+
+	if (count == 0) {
+		return rop;
+	}
+
+	if (rop == NULL) {
+		rop = malloc(count * size);
+
+		if (rop == NULL) {
+			fprintf(stderr, "Out of memory (%zu bytes requested)\n", count * size);
+			abort();
+		}
+	}
+
+	unsigned char *bytes = rop;
+	uint64_t acc = 0;
+	size_t acc_bits = 0;
+	size_t n = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t j = 0; j < size; ++j) {
+			size_t valid = 8 * j >= numb ? 0 : numb - 8 * j < 8 ? numb - 8 * j : 8;
+
+			if (acc_bits < valid) {
+				acc |= (uint64_t)(n < op->nmemb ? op->data[n] : 0) << acc_bits;
+				acc_bits += 31;
+				n++;
+			}
+
+			bytes[word_byte(i, j, count, order, size, endian)] = (unsigned char)(acc & ((1U << valid) - 1));
+			acc >>= valid;
+			acc_bits -= valid;
+		}
+	}
+
+	return rop;
+}
+
+/* read-only view of 31-bit limbs (least significant first), never to be modified or cleared */
+const struct mpi *mpi_view(mpi_t rop, const uint32_t *data, size_t nmemb)
+{
+	rop->data = (uint32_t *)data;
+	rop->nmemb = nmemb;
+	rop->mmap = NULL;
+
+	return rop;
+}
+
+void mpi_add(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+
+	STATS_BEGIN(STATS_ADD, nmemb);
+
+	mpi_enlarge(rop, nmemb);
+
+	uint32_t c = 0;
+
+	/* op1 + op2 */
+	for (size_t n = 0; n < rop->nmemb; ++n) {
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = (n < op2->nmemb) ? op2->data[n] : 0;
+		rop->data[n] = r1 + r2 + c;
+		c = rop->data[n] >> 31;
+		rop->data[n] &= 0x7fffffff;
+	}
+
+	if (c != 0) {
+		mpi_enlarge(rop, nmemb + 1);
+		rop->data[nmemb] = 0 + c;
+	}
+
+	mpi_compact(rop);
+
+	STATS_END(STATS_ADD);
+}
+
+void mpi_sub(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+
+	STATS_BEGIN(STATS_SUB, nmemb);
+
+	mpi_enlarge(rop, nmemb);
+
+	uint32_t c = 0;
+
+	/* op1 - op2 */
+	for (size_t n = 0; n < rop->nmemb; ++n) {
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = (n < op2->nmemb) ? op2->data[n] : 0;
+		rop->data[n] = r1 - r2 - c;
+		c = rop->data[n] >> 31;
+		rop->data[n] &= 0x7fffffff;
+	}
+
+	if (c != 0) {
+		fprintf(stderr, "Negative numbers not supported\n");
+		abort();
+	}
+
+	mpi_compact(rop);
+
+	STATS_END(STATS_SUB);
+}
+
+void mpi_add_u64(mpi_t rop, const mpi_t op1, uint64_t op2)
+{
+	size_t nmemb = op1->nmemb > ceil_div(64, 31) ? op1->nmemb : ceil_div(64, 31);
+
+	mpi_enlarge(rop, nmemb);
+
+	uint32_t c = 0;
+
+	/* op1 + op2 */
+	for (size_t n = 0; n < rop->nmemb; ++n) {
+		if (rop == op1 && op2 == 0 && c == 0) {
+			break;
+		}
+
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = op2 & 0x7fffffff;
+		op2 >>= 31;
+		rop->data[n] = r1 + r2 + c;
+		c = rop->data[n] >> 31;
+		rop->data[n] &= 0x7fffffff;
+	}
+
+	if (c != 0) {
+		mpi_enlarge(rop, nmemb + 1);
+		rop->data[nmemb] = 0 + c;
+	}
+}
+
+void mpi_sub_u64(mpi_t rop, const mpi_t op1, uint64_t op2)
+{
+	size_t nmemb = op1->nmemb > ceil_div(64, 31) ? op1->nmemb : ceil_div(64, 31);
+
+	mpi_enlarge(rop, nmemb);
+
+	uint32_t c = 0;
+
+	/* op1 + op2 */
+	for (size_t n = 0; n < rop->nmemb; ++n) {
+		if (rop == op1 && op2 == 0 && c == 0) {
+			break;
+		}
+
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = op2 & 0x7fffffff;
+		op2 >>= 31;
+		rop->data[n] = r1 - r2 - c;
+		c = rop->data[n] >> 31;
+		rop->data[n] &= 0x7fffffff;
+	}
+
+	if (c != 0) {
+		fprintf(stderr, "Negative numbers not supported\n");
+		abort();
+	}
+}
+
+void mpi_add_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+{
+	size_t nmemb = op1->nmemb > ceil_div(32, 31) ? op1->nmemb : ceil_div(32, 31);
+
+	mpi_enlarge(rop, nmemb);
+
+	uint32_t c = 0;
+
+	/* op1 + op2 */
+	for (size_t n = 0; n < rop->nmemb; ++n) {
+		/* in place, the limbs above the carry stay as they are */
+		if (rop == op1 && op2 == 0 && c == 0) {
+			break;
+		}
+
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = op2 & 0x7fffffff;
+		op2 >>= 31;
+		rop->data[n] = r1 + r2 + c;
+		c = rop->data[n] >> 31;
+		rop->data[n] &= 0x7fffffff;
+	}
+
+	if (c != 0) {
+		mpi_enlarge(rop, nmemb + 1);
+		rop->data[nmemb] = 0 + c;
+	}
+}
+
+void mpi_sub_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+{
+	size_t nmemb = op1->nmemb > ceil_div(32, 31) ? op1->nmemb : ceil_div(32, 31);
+
+	mpi_enlarge(rop, nmemb);
+
+	uint32_t c = 0;
+
+	/* op1 + op2 */
+	for (size_t n = 0; n < rop->nmemb; ++n) {
+		if (rop == op1 && op2 == 0 && c == 0) {
+			break;
+		}
+
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = op2 & 0x7fffffff;
+		op2 >>= 31;
+		rop->data[n] = r1 - r2 - c;
+		c = rop->data[n] >> 31;
+		rop->data[n] &= 0x7fffffff;
+	}
+
+	if (c != 0) {
+		fprintf(stderr, "Negative numbers not supported\n");
+		abort();
+	}
+}
+
+void mpi_mul_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+{
+	size_t nmemb = op1->nmemb + 1;
+
+	mpi_enlarge(rop, nmemb);
+
+	uint32_t c = 0;
+
+	/* op1 * op2 */
+	for (size_t n = 0; n < op1->nmemb; ++n) {
+		assert(op1->data[n] <= (UINT64_MAX - c) / op2);
+		uint64_t r = (uint64_t)op1->data[n] * op2 + c;
+		rop->data[n] = r & 0x7fffffff;
+		c = r >> 31;
+	}
+
+	size_t n = op1->nmemb;
+
+	for (; c != 0; ++n) {
+		mpi_enlarge(rop, n + 1);
+		rop->data[n] = c & 0x7fffffff;
+		c >>= 31;
+	}
+
+	for (; n < rop->nmemb; ++n) {
+		rop->data[n] = 0;
+	}
+}
+
+/* rop = the len digits of str, as (high part) * 10^(2^k) + (low 2^k digits) */
+static void set_str_rec(mpi_t rop, const char *str, size_t len)
+{
+	if (len <= param(PARAM_SET_STR)) {
+		mpi_set_u32(rop, (uint32_t)0);
+
+		for (size_t i = 0; i < len; ) {
+			uint32_t word = 0, scale = 1;
+
+			for (size_t j = 0; j < 9 && i < len; ++j, ++i) {
+				assert(str[i] >= '0' && str[i] <= '9');
+				word = word * 10 + (uint32_t)(str[i] - '0');
+				scale *= 10;
+			}
+
+			mpi_mul_u32(rop, rop, scale);
+			mpi_add_u32(rop, rop, word);
+		}
+
+		mpi_compact(rop);
+
+		return;
+	}
+
+	unsigned k = 0;
+
+	while (((size_t)2 << k) < len) {
+		k++;
+	}
+
+	size_t low = (size_t)1 << k;
+
+	mpi_t t, p;
+
+	mpi_init(t);
+	mpi_init(p);
+
+	set_str_rec(rop, str, len - low);
+	set_str_rec(t, str + len - low, low);
+
+	mpi_mul(rop, rop, mpi_pow_cache(p, 10, k));
+	mpi_add(rop, rop, t);
+
+	mpi_clear(t);
+	mpi_clear(p);
+}
+
+int mpi_set_str(mpi_t rop, const char *str, int base)
+{
+	assert(base == 10);
+
+	size_t len = strlen(str);
+
+	STATS_BEGIN(STATS_SET_STR, len / 9);
+
+	set_str_rec(rop, str, len);
+
+	STATS_END(STATS_SET_STR);
+
+	return 0;
+}
+
+void mpi_swap(mpi_t rop1, mpi_t rop2)
+{
+	mpi_t t;
+
+	*t = *rop1;
+	*rop1 = *rop2;
+	*rop2 = *t;
+}
+
+void mpi_set(mpi_t rop, const mpi_t op)
+{
+	mpi_enlarge(rop, op->nmemb);
+
+	for (size_t n = 0; n < op->nmemb; ++n) {
+		rop->data[n] = op->data[n];
+	}
+
+	for (size_t n = op->nmemb; n < rop->nmemb; ++n) {
+		rop->data[n] = 0;
+	}
+}
+
+void mpi_mul_naive(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	size_t nmemb = op1->nmemb + op2->nmemb;
+
+	STATS_COUNT_CALL(STATS_MUL_NAIVE, nmemb);
+
+	mpi_t tmp;
+
+	mpi_init(tmp);
+
+	mpi_enlarge(tmp, nmemb);
+
+	for (size_t n = 0; n < tmp->nmemb; ++n) {
+		tmp->data[n] = 0;
+	}
+
+	for (size_t n = 0; n < op1->nmemb; ++n) {
+		for (size_t m = 0; m < op2->nmemb; ++m) {
+			uint64_t r = (uint64_t)op1->data[n] * op2->data[m];
+			uint64_t c = 0;
+			for (size_t k = m + n; c != 0 || r != 0; ++k) {
+				if (k >= tmp->nmemb) {
+					mpi_enlarge(tmp, tmp->nmemb + 1);
+				}
+				tmp->data[k] += (r & 0x7fffffff) + c;
+				r >>= 31;
+				c = tmp->data[k] >> 31;
+				tmp->data[k] &= 0x7fffffff;
+			}
+		}
+	}
+
+	mpi_set(rop, tmp);
+
+	mpi_compact(rop);
+
+	mpi_clear(tmp);
+}
+
+/* below this size (in limbs), Karatsuba sub-products are not forked */
+#define KARATSUBA_PARALLEL_THRESHOLD 256
+
+void mpi_mul_karatsuba(mpi_t rop, const mpi_t op1, const mpi_t op2);
+
+struct mul_args {
+	struct mpi *rop;
+	const struct mpi *op1;
+	const struct mpi *op2;
+};
+
+static void mul_karatsuba_task(void *arg)
+{
+	struct mul_args *args = arg;
+
+	mpi_mul_karatsuba(args->rop, args->op1, args->op2);
+}
+
+void mpi_mul_karatsuba(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	/* end recursion */
+	if (op1->nmemb < param(PARAM_MUL_KARATSUBA) || op2->nmemb < param(PARAM_MUL_KARATSUBA)) {
+		mpi_mul_naive(rop, op1, op2);
+		return;
+	}
+
+	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+
+	STATS_COUNT_CALL(STATS_MUL_KARATSUBA, op1->nmemb + op2->nmemb);
+
+	size_t m = nmemb / 2;
+
+	mpi_t x0, x1, y0, y1;
+
+	mpi_init(x0);
+	mpi_init(x1);
+	mpi_init(y0);
+	mpi_init(y1);
+
+	/* x = op1 */
+	/* y = op2 */
+	mpi_fdiv_r_2exp(x0, op1, 31 * m);
+	mpi_fdiv_q_2exp(x1, op1, 31 * m);
+	mpi_fdiv_r_2exp(y0, op2, 31 * m);
+	mpi_fdiv_q_2exp(y1, op2, 31 * m);
+
+	mpi_t z0, z1, z2;
+
+	mpi_init(z0);
+	mpi_init(z1);
+	mpi_init(z2);
+
+	mpi_t w0, w1;
+
+	mpi_init(w0);
+	mpi_init(w1);
+
+	mpi_add(w0, x0, x1);
+	mpi_add(w1, y0, y1);
+
+	if (nmemb >= KARATSUBA_PARALLEL_THRESHOLD) {
+		/* z2 and z0 go to other threads (if any are spare), z1 stays here */
+		struct mul_args a2 = { z2, x1, y1 };
+		struct mul_args a0 = { z0, x0, y0 };
+		struct task t2, t0;
+
+		task_fork(&t2, mul_karatsuba_task, &a2);
+		task_fork(&t0, mul_karatsuba_task, &a0);
+
+		mpi_mul_karatsuba(z1, w0, w1);
+
+		task_join(&t0);
+		task_join(&t2);
+	} else {
+		mpi_mul_karatsuba(z2, x1, y1);
+		mpi_mul_karatsuba(z0, x0, y0);
+		mpi_mul_karatsuba(z1, w0, w1);
+	}
+
+	mpi_sub(z1, z1, z2);
+	mpi_sub(z1, z1, z0);
+
+	mpi_mul_2exp(z2, z2, 31 * 2 * m);
+	mpi_mul_2exp(z1, z1, 31 * m);
+
+	mpi_add(rop, z0, z1);
+	mpi_add(rop, rop, z2);
+
+	mpi_clear(w0);
+	mpi_clear(w1);
+
+	mpi_clear(z0);
+	mpi_clear(z1);
+	mpi_clear(z2);
+
+	mpi_clear(x0);
+	mpi_clear(x1);
+	mpi_clear(y0);
+	mpi_clear(y1);
+
+	mpi_compact(rop);
+}
+
+/*
+ * Number-theoretic transform over GF(p), p = 2^64 - 2^32 + 1.
+ *
+ * Operands are split into 16-bit digits, so a convolution of up to 2^30 digits
+ * cannot exceed p. Transforms of length n = n1 * n2 use the six-step layout:
+ * rows of length n1 or n2 (transposed in between) fit into the cache, and are
+ * distributed across threads.
+ */
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+#define NTT_P UINT64_C(0xffffffff00000001)
+
+/* generator of the multiplicative group of GF(p) */
+#define NTT_G 7
+
+static uint64_t ntt_add(uint64_t a, uint64_t b)
+{
+	uint64_t r = a + b;
+
+	if (r < a || r >= NTT_P) {
+		r -= NTT_P;
+	}
+
+	return r;
+}
+
+static uint64_t ntt_sub(uint64_t a, uint64_t b)
+{
+	uint64_t r = a - b;
+
+	if (a < b) {
+		r += NTT_P;
+	}
+
+	return r;
+}
+
+static uint64_t ntt_mul(uint64_t a, uint64_t b)
+{
+	uint128_t x = (uint128_t)a * b;
+
+	uint64_t lo = (uint64_t)x;
+	uint64_t hi = (uint64_t)(x >> 64);
+
+	/* 2^64 = 2^32 - 1 and 2^96 = -1 (mod p) */
+	uint64_t t = lo - (hi >> 32);
+
+	if (lo < (hi >> 32)) {
+		t -= 0xffffffff;
+	}
+
+	uint64_t r = t + (hi & 0xffffffff) * 0xffffffff;
+
+	if (r < t) {
+		r += 0xffffffff;
+	}
+
+	if (r >= NTT_P) {
+		r -= NTT_P;
+	}
+
+	return r;
+}
+
+static uint64_t ntt_pow(uint64_t a, uint64_t e)
+{
+	uint64_t r = 1;
+
+	while (e != 0) {
+		if (e & 1) {
+			r = ntt_mul(r, a);
+		}
+		a = ntt_mul(a, a);
+		e >>= 1;
+	}
+
+	return r;
+}
+
+/* in-place transform of length len (natural order in and out), roots[i] = w^i */
+static void ntt_row(uint64_t *a, size_t len, const uint64_t *roots)
+{
+	for (size_t i = 1, j = 0; i < len; ++i) {
+		size_t bit = len >> 1;
+
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+
+		j ^= bit;
+
+		if (i < j) {
+			uint64_t t = a[i];
+			a[i] = a[j];
+			a[j] = t;
+		}
+	}
+
+	for (size_t half = 1; half < len; half <<= 1) {
+		size_t step = len / (2 * half);
+
+		for (size_t i = 0; i < len; i += 2 * half) {
+			for (size_t k = 0; k < half; ++k) {
+				uint64_t u = a[i + k];
+				uint64_t v = ntt_mul(a[i + k + half], roots[k * step]);
+
+				a[i + k] = ntt_add(u, v);
+				a[i + k + half] = ntt_sub(u, v);
+			}
+		}
+	}
+}
+
+struct ntt {
+	size_t n, n1, n2;
+	/* primitive n-th root of unity and its inverse */
+	uint64_t w, w_inv;
+	/* powers of the primitive n1-th and n2-th roots (and of their inverses) */
+	uint64_t *roots1, *roots2, *roots1_inv, *roots2_inv;
+	/* scratch array of n elements */
+	uint64_t *tmp;
+};
+
+/* left untouched here: the parallel loops filling it place each page on the node of its thread */
+static uint64_t *ntt_alloc(size_t n)
+{
+	return mpi_alloc(n * sizeof(uint64_t));
+}
+
+static uint64_t *ntt_roots(size_t len, int inverse)
+{
+	uint64_t *roots = ntt_alloc(len / 2 + 1);
+	uint64_t w = ntt_pow(NTT_G, (NTT_P - 1) / len);
+
+	if (inverse) {
+		w = ntt_pow(w, NTT_P - 2);
+	}
+
+	roots[0] = 1;
+
+	for (size_t i = 1; i < len / 2 + 1; ++i) {
+		roots[i] = ntt_mul(roots[i - 1], w);
+	}
+
+	return roots;
+}
+
+static void ntt_init(struct ntt *ntt, size_t n)
+{
+	size_t log2n = 0;
+
+	while (((size_t)1 << log2n) < n) {
+		log2n++;
+	}
+
+	assert(((size_t)1 << log2n) == n && log2n <= 30);
+
+	ntt->n = n;
+	ntt->n1 = (size_t)1 << (log2n / 2);
+	ntt->n2 = n / ntt->n1;
+	ntt->w = ntt_pow(NTT_G, (NTT_P - 1) / n);
+	ntt->w_inv = ntt_pow(ntt->w, NTT_P - 2);
+	ntt->roots1 = ntt_roots(ntt->n1, 0);
+	ntt->roots2 = ntt_roots(ntt->n2, 0);
+	ntt->roots1_inv = ntt_roots(ntt->n1, 1);
+	ntt->roots2_inv = ntt_roots(ntt->n2, 1);
+	ntt->tmp = ntt_alloc(n);
+}
+
+static void ntt_clear(struct ntt *ntt)
+{
+	free(ntt->roots1);
+	free(ntt->roots2);
+	free(ntt->roots1_inv);
+	free(ntt->roots2_inv);
+	free(ntt->tmp);
+}
+
+struct ntt_pass {
+	struct ntt *ntt;
+	uint64_t *dst;
+	const uint64_t *src;
+	const uint64_t *src2;
+	size_t rows, cols;
+};
+
+#define NTT_TILE 32
+
+/* dst (cols x rows) := transpose of src (rows x cols), for tile rows [begin, end) */
+static void ntt_transpose_rows(void *arg, size_t begin, size_t end)
+{
+	struct ntt_pass *pass = arg;
+
+	for (size_t ti = begin * NTT_TILE; ti < end * NTT_TILE && ti < pass->rows; ti += NTT_TILE) {
+		for (size_t tj = 0; tj < pass->cols; tj += NTT_TILE) {
+			for (size_t i = ti; i < ti + NTT_TILE && i < pass->rows; ++i) {
+				for (size_t j = tj; j < tj + NTT_TILE && j < pass->cols; ++j) {
+					pass->dst[j * pass->rows + i] = pass->src[i * pass->cols + j];
+				}
+			}
+		}
+	}
+}
+
+static void ntt_transpose(uint64_t *dst, const uint64_t *src, size_t rows, size_t cols)
+{
+	struct ntt_pass pass = { NULL, dst, src, NULL, rows, cols };
+
+	parallel_for((rows + NTT_TILE - 1) / NTT_TILE, ntt_transpose_rows, &pass);
+}
+
+/* length-n2 transforms of the rows j1, then multiplication by w^(j1 k2) */
+static void ntt_forward_rows2(void *arg, size_t begin, size_t end)
+{
+	struct ntt_pass *pass = arg;
+	struct ntt *ntt = pass->ntt;
+
+	for (size_t j1 = begin; j1 < end; ++j1) {
+		uint64_t *row = pass->dst + j1 * ntt->n2;
+		uint64_t t = ntt_pow(ntt->w, j1);
+		uint64_t w = 1;
+
+		ntt_row(row, ntt->n2, ntt->roots2);
+
+		for (size_t k2 = 0; k2 < ntt->n2; ++k2) {
+			row[k2] = ntt_mul(row[k2], w);
+			w = ntt_mul(w, t);
+		}
+	}
+}
+
+/* division by w^(j1 k2) and by n, then inverse length-n2 transforms of the rows j1 */
+static void ntt_inverse_rows2(void *arg, size_t begin, size_t end)
+{
+	struct ntt_pass *pass = arg;
+	struct ntt *ntt = pass->ntt;
+	uint64_t n_inv = ntt_pow(ntt->n, NTT_P - 2);
+
+	for (size_t j1 = begin; j1 < end; ++j1) {
+		uint64_t *row = pass->dst + j1 * ntt->n2;
+		uint64_t t = ntt_pow(ntt->w_inv, j1);
+		uint64_t w = n_inv;
+
+		for (size_t k2 = 0; k2 < ntt->n2; ++k2) {
+			row[k2] = ntt_mul(row[k2], w);
+			w = ntt_mul(w, t);
+		}
+
+		ntt_row(row, ntt->n2, ntt->roots2_inv);
+	}
+}
+
+static void ntt_forward_rows1(void *arg, size_t begin, size_t end)
+{
+	struct ntt_pass *pass = arg;
+	struct ntt *ntt = pass->ntt;
+
+	for (size_t k2 = begin; k2 < end; ++k2) {
+		ntt_row(pass->dst + k2 * ntt->n1, ntt->n1, ntt->roots1);
+	}
+}
+
+static void ntt_inverse_rows1(void *arg, size_t begin, size_t end)
+{
+	struct ntt_pass *pass = arg;
+	struct ntt *ntt = pass->ntt;
+
+	for (size_t k2 = begin; k2 < end; ++k2) {
+		ntt_row(pass->dst + k2 * ntt->n1, ntt->n1, ntt->roots1_inv);
+	}
+}
+
+/* the output is in transposed order, which the inverse transform expects */
+static void ntt_forward(struct ntt *ntt, uint64_t *a)
+{
+	struct ntt_pass pass = { ntt, ntt->tmp, NULL, NULL, 0, 0 };
+
+	ntt_transpose(ntt->tmp, a, ntt->n2, ntt->n1);
+	parallel_for(ntt->n1, ntt_forward_rows2, &pass);
+	ntt_transpose(a, ntt->tmp, ntt->n1, ntt->n2);
+
+	pass.dst = a;
+	parallel_for(ntt->n2, ntt_forward_rows1, &pass);
+}
+
+static void ntt_inverse(struct ntt *ntt, uint64_t *a)
+{
+	struct ntt_pass pass = { ntt, a, NULL, NULL, 0, 0 };
+
+	parallel_for(ntt->n2, ntt_inverse_rows1, &pass);
+	ntt_transpose(ntt->tmp, a, ntt->n2, ntt->n1);
+
+	pass.dst = ntt->tmp;
+	parallel_for(ntt->n1, ntt_inverse_rows2, &pass);
+	ntt_transpose(a, ntt->tmp, ntt->n1, ntt->n2);
+}
+
+static void ntt_pointwise(void *arg, size_t begin, size_t end)
+{
+	struct ntt_pass *pass = arg;
+
+	for (size_t i = begin; i < end; ++i) {
+		pass->dst[i] = ntt_mul(pass->dst[i], pass->src[i]);
+	}
+}
+
+struct ntt_digits {
+	uint64_t *a;
+	const struct mpi *op;
+	size_t len, n;
+	/* carry out of each block */
+	uint64_t *carry;
+	size_t blocks;
+};
+
+/* split op into 16-bit digits (zero-padded up to n) */
+static void ntt_split(void *arg, size_t begin, size_t end)
+{
+	struct ntt_digits *d = arg;
+
+	for (size_t i = begin; i < end; ++i) {
+		size_t b = 16 * i;
+		size_t l = b / 31;
+		uint64_t v = 0;
+
+		if (i < d->len) {
+			v = l < d->op->nmemb ? d->op->data[l] : 0;
+			v |= (uint64_t)(l + 1 < d->op->nmemb ? d->op->data[l + 1] : 0) << 31;
+			v = (v >> (b % 31)) & 0xffff;
+		}
+
+		d->a[i] = v;
+	}
+}
+
+/* propagate carries inside each block of the convolution */
+static void ntt_carry_blocks(void *arg, size_t begin, size_t end)
+{
+	struct ntt_digits *d = arg;
+
+	for (size_t k = begin; k < end; ++k) {
+		uint64_t c = 0;
+
+		for (size_t i = d->n * k / d->blocks; i < d->n * (k + 1) / d->blocks; ++i) {
+			c += d->a[i];
+			d->a[i] = c & 0xffff;
+			c >>= 16;
+		}
+
+		d->carry[k] = c;
+	}
+}
+
+/* gather 16-bit digits into 31-bit limbs */
+static void ntt_join(void *arg, size_t begin, size_t end)
+{
+	struct ntt_digits *d = arg;
+	uint32_t *data = d->op->data;
+
+	for (size_t l = begin; l < end; ++l) {
+		size_t b = 31 * l;
+		size_t i = b / 16;
+		uint64_t v = 0;
+
+		for (size_t k = 0; k < 3 && i + k < d->n; ++k) {
+			v |= d->a[i + k] << (16 * k);
+		}
+
+		data[l] = (uint32_t)(v >> (b % 16)) & 0x7fffffff;
+	}
+}
+
+static void mpi_mul_ntt(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	STATS_COUNT_CALL(STATS_MUL_NTT, op1->nmemb + op2->nmemb);
+
+	size_t len1 = (mpi_sizeinbase(op1, 2) + 15) / 16;
+	size_t len2 = (mpi_sizeinbase(op2, 2) + 15) / 16;
+
+	if (len1 == 0 || len2 == 0) {
+		mpi_set_u32(rop, 0);
+		mpi_compact(rop);
+		return;
+	}
+
+	size_t n = 4;
+
+	while (n < len1 + len2) {
+		n <<= 1;
+	}
+
+	struct ntt ntt;
+
+	ntt_init(&ntt, n);
+
+	struct ntt_digits d1 = { ntt_alloc(n), op1, len1, n, NULL, 0 };
+
+	parallel_for(n, ntt_split, &d1);
+	ntt_forward(&ntt, d1.a);
+
+	if (op1 == op2) {
+		struct ntt_pass pass = { &ntt, d1.a, d1.a, NULL, 0, 0 };
+
+		parallel_for(n, ntt_pointwise, &pass);
+	} else {
+		struct ntt_digits d2 = { ntt_alloc(n), op2, len2, n, NULL, 0 };
+
+		parallel_for(n, ntt_split, &d2);
+		ntt_forward(&ntt, d2.a);
+
+		struct ntt_pass pass = { &ntt, d1.a, d2.a, NULL, 0, 0 };
+
+		parallel_for(n, ntt_pointwise, &pass);
+
+		free(d2.a);
+	}
+
+	ntt_inverse(&ntt, d1.a);
+
+	ntt_clear(&ntt);
+
+	/* carries: each block on its own, then a serial fix-up across block boundaries */
+	d1.blocks = 4 * (size_t)mpi_get_num_threads();
+	d1.carry = ntt_alloc(d1.blocks);
+
+	parallel_for(d1.blocks, ntt_carry_blocks, &d1);
+
+	for (size_t k = 0; k + 1 < d1.blocks; ++k) {
+		uint64_t c = d1.carry[k];
+
+		for (size_t i = n * (k + 1) / d1.blocks; c != 0 && i < n * (k + 2) / d1.blocks; ++i) {
+			c += d1.a[i];
+			d1.a[i] = c & 0xffff;
+			c >>= 16;
+		}
+
+		d1.carry[k + 1] += c;
+	}
+
+	assert(d1.carry[d1.blocks - 1] == 0);
+
+	free(d1.carry);
+
+	size_t nmemb = (16 * n + 30) / 31;
+
+	mpi_t tmp;
+
+	mpi_init(tmp);
+
+	mpi_enlarge(tmp, nmemb);
+
+	d1.op = tmp;
+
+	parallel_for(nmemb, ntt_join, &d1);
+
+	free(d1.a);
+
+	mpi_move(rop, tmp);
+
+	mpi_clear(tmp);
+
+	mpi_compact(rop);
+}
+
+void mpi_mul(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	STATS_BEGIN(STATS_MUL, op1->nmemb + op2->nmemb);
+
+	if (op1->nmemb >= param(PARAM_MUL_NTT) && op2->nmemb >= param(PARAM_MUL_NTT)) {
+		mpi_mul_ntt(rop, op1, op2);
+	} else {
+		mpi_mul_karatsuba(rop, op1, op2);
+	}
+
+	STATS_END(STATS_MUL);
+}
+
+void mpi_sqr(mpi_t rop, const mpi_t op)
+{
+	STATS_BEGIN(STATS_SQR, op->nmemb);
+
+	if (op->nmemb >= param(PARAM_MUL_NTT)) {
+		mpi_mul_ntt(rop, op, op);
+	} else {
+		mpi_mul_karatsuba(rop, op, op);
+	}
+
+	STATS_END(STATS_SQR);
+}
+
+int mpi_cmp(const mpi_t op1, const mpi_t op2)
+{
+	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+
+	if (nmemb == 0) {
+		return 0;
+	}
+
+	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = (n < op2->nmemb) ? op2->data[n] : 0;
+
+		if (r1 < r2) {
+			return -1;
+		}
+
+		if (r1 > r2) {
+			return +1;
+		}
+	}
+
+	return 0;
+}
+
+int mpi_cmp_u32(const mpi_t op1, uint32_t op2)
+{
+	size_t nmemb = op1->nmemb;
+
+	if (nmemb < ceil_div(32, 31)) {
+		nmemb = ceil_div(32, 31);
+	}
+
+	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
+		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
+		uint32_t r2 = 0;
+
+		switch (n) {
+			case 0: r2 = (op2      ) & 0x7fffffff; break;
+			case 1: r2 = (op2 >> 31) & 0x7fffffff; break;
+		}
+
+		if (r1 < r2) {
+			return -1;
+		}
+
+		if (r1 > r2) {
+			return +1;
+		}
+	}
+
+	return 0;
+}
+
+int mpi_odd_p(const mpi_t op)
+{
+	if (op->nmemb == 0) {
+		return 0;
+	}
+
+	return op->data[0] & 1;
+}
+
+int mpi_even_p(const mpi_t op)
+{
+	if (op->nmemb == 0) {
+		return 1;
+	}
+
+	return !(op->data[0] & 1);
+}
+
+uint64_t mpi_get_word_u64(const mpi_t op, size_t n)
+{
+	uint64_t r = 0;
+
+	if (n + 0 < op->nmemb) {
+		r |= (uint64_t)op->data[n + 0];
+	}
+
+	if (n + 1 < op->nmemb) {
+		r |= (uint64_t)op->data[n + 1] << 31;
+	}
+
+	if (n + 2 < op->nmemb) {
+		r |= (uint64_t)op->data[n + 2] << 62;
+	}
+
+	return r;
+}
+
+void mpi_fdiv_q_2exp(mpi_t q, const mpi_t n, mp_bitcnt_t b)
+{
+	size_t words = b / 31; /* shift by whole words/limbs */
+	size_t bits = b % 31; /* and shift by bits */
+
+	size_t nmemb = n->nmemb >= words ? n->nmemb - words : 0;
+
+	mpi_t tmp;
+
+	mpi_init(tmp);
+
+	mpi_enlarge(tmp, nmemb);
+
+	if (bits == 0) {
+		memcpy(tmp->data, n->data + words, nmemb * sizeof(uint32_t));
+	} else {
+		for (size_t i = 0; i < tmp->nmemb; ++i) {
+			uint32_t r = (uint32_t)((mpi_get_word_u64(n, i + words) >> bits) & 0x7fffffff);
+
+			tmp->data[i] = r;
+		}
+	}
+
+	mpi_set(q, tmp);
+
+	mpi_clear(tmp);
+}
+
+void mpi_fdiv_r_2exp(mpi_t r, const mpi_t n, mp_bitcnt_t b)
+{
+	size_t words = b / 31; /* shift by whole words/limbs */
+	size_t bits = b % 31; /* and shift by bits */
+
+	size_t nmemb = words + 1;
+
+	mpi_t tmp;
+
+	mpi_init(tmp);
+
+	mpi_enlarge(tmp, nmemb);
+
+	if (bits == 0) {
+		size_t min = words < n->nmemb ? words : n->nmemb;
+		memcpy(tmp->data, n->data, sizeof(uint32_t) * min);
+		memset(tmp->data + min, 0, sizeof(uint32_t) * (tmp->nmemb - min));
+	} else {
+		for (size_t i = 0; i < words; ++i) {
+			tmp->data[i] = i < n->nmemb ? n->data[i] : 0;
+		}
+
+		tmp->data[words] = words < n->nmemb ? n->data[words] & ((UINT32_C(1) << bits) - 1) : 0;
+	}
+
+	mpi_set(r, tmp);
+
+	mpi_clear(tmp);
+
+	mpi_compact(r);
+}
+
+uint32_t mpi_get_word_lshift_u32(const mpi_t op, size_t n, size_t lshift)
+{
+	uint32_t r = 0;
+
+	assert(lshift < 31);
+
+	if (n < op->nmemb + 0) {
+		r |= (op->data[n + 0] << lshift) & 0x7fffffff;
+	}
+
+	if (n < op->nmemb + 1 && n > 0) {
+		r |= op->data[n - 1] >> (31 - lshift);
+	}
+
+	return r;
+}
+
+void mpi_mul_2exp(mpi_t rop, const mpi_t op1, mp_bitcnt_t op2)
+{
+	size_t words = ceil_div(op2, 31);
+	size_t word_shift = op2 / 31;
+	size_t bit_shift = op2 % 31;
+
+	size_t nmemb = op1->nmemb + words;
+
+	mpi_t tmp;
+
+	mpi_init(tmp);
+
+	mpi_enlarge(tmp, nmemb);
+
+	for (size_t i = 0; i < tmp->nmemb; ++i) {
+		tmp->data[i] = i >= word_shift ? mpi_get_word_lshift_u32(op1, i - word_shift, bit_shift) : 0;
+	}
+
+	mpi_set(rop, tmp);
+
+	mpi_clear(tmp);
+
+	mpi_compact(rop);
+}
+
+/* rop + op1 * op2 in one pass over the limbs */
+void mpi_addmul_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+{
+	size_t nmemb1 = op1->nmemb;
+	size_t nmemb = rop->nmemb > nmemb1 ? rop->nmemb : nmemb1;
+
+	/* rop may be op1, so op1->nmemb changes here */
+	mpi_enlarge(rop, nmemb);
+
+	uint64_t c = 0;
+	size_t n = 0;
+
+	for (; n < nmemb && (n < nmemb1 || c != 0); ++n) {
+		uint64_t r = (uint64_t)rop->data[n] + c;
+
+		if (n < nmemb1) {
+			r += (uint64_t)op1->data[n] * op2;
+		}
+
+		rop->data[n] = r & 0x7fffffff;
+		c = r >> 31;
+	}
+
+	for (; c != 0; ++n) {
+		mpi_enlarge(rop, n + 1);
+		rop->data[n] = c & 0x7fffffff;
+		c >>= 31;
+	}
+}
+
+/* rop - op1 * op2 in one pass over the limbs */
+void mpi_submul_u32(mpi_t rop, const mpi_t op1, uint32_t op2)
+{
+	size_t nmemb1 = op1->nmemb;
+	size_t nmemb = rop->nmemb > nmemb1 ? rop->nmemb : nmemb1;
+
+	mpi_enlarge(rop, nmemb);
+
+	uint64_t c = 0;
+
+	for (size_t n = 0; n < nmemb && (n < nmemb1 || c != 0); ++n) {
+		uint64_t p = c;
+
+		if (n < nmemb1) {
+			p += (uint64_t)op1->data[n] * op2;
+		}
+
+		uint32_t r = rop->data[n] - (uint32_t)(p & 0x7fffffff);
+
+		rop->data[n] = r & 0x7fffffff;
+		c = (p >> 31) + (r >> 31);
+	}
+
+	if (c != 0) {
+		fprintf(stderr, "Negative numbers not supported\n");
+		abort();
+	}
+}
+
+/* rop + op1 * 2^op2 in one pass, without the shifted copy of mpi_mul_2exp */
+void mpi_addmul_2exp(mpi_t rop, const mpi_t op1, mp_bitcnt_t op2)
+{
+	if (rop == op1) {
+		mpi_t tmp;
+
+		mpi_init(tmp);
+		mpi_set(tmp, op1);
+		mpi_addmul_2exp(rop, tmp, op2);
+		mpi_clear(tmp);
+	} else {
+		size_t word_shift = op2 / 31;
+		size_t bit_shift = op2 % 31;
+		size_t end = op1->nmemb + word_shift + (bit_shift != 0);
+		size_t nmemb = rop->nmemb > end ? rop->nmemb : end;
+
+		mpi_enlarge(rop, nmemb);
+
+		uint32_t c = 0;
+		size_t n = word_shift;
+
+		for (; n < nmemb && (n < end || c != 0); ++n) {
+			rop->data[n] += mpi_get_word_lshift_u32(op1, n - word_shift, bit_shift) + c;
+			c = rop->data[n] >> 31;
+			rop->data[n] &= 0x7fffffff;
+		}
+
+		if (c != 0) {
+			mpi_enlarge(rop, nmemb + 1);
+			rop->data[nmemb] = c;
+		}
+	}
+}
+
+/* rop - op1 * 2^op2 in one pass */
+void mpi_submul_2exp(mpi_t rop, const mpi_t op1, mp_bitcnt_t op2)
+{
+	if (rop == op1) {
+		mpi_t tmp;
+
+		mpi_init(tmp);
+		mpi_set(tmp, op1);
+		mpi_submul_2exp(rop, tmp, op2);
+		mpi_clear(tmp);
+	} else {
+		size_t word_shift = op2 / 31;
+		size_t bit_shift = op2 % 31;
+		size_t end = op1->nmemb + word_shift + (bit_shift != 0);
+		size_t nmemb = rop->nmemb > end ? rop->nmemb : end;
+
+		mpi_enlarge(rop, nmemb);
+
+		uint32_t c = 0;
+
+		for (size_t n = word_shift; n < nmemb && (n < end || c != 0); ++n) {
+			rop->data[n] -= mpi_get_word_lshift_u32(op1, n - word_shift, bit_shift) + c;
+			c = rop->data[n] >> 31;
+			rop->data[n] &= 0x7fffffff;
+		}
+
+		if (c != 0) {
+			fprintf(stderr, "Negative numbers not supported\n");
+			abort();
+		}
+	}
+}
+
+/* rop + op1 * op2, with the product as the only temporary */
+void mpi_addmul(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	if (op2->nmemb <= 1) {
+		mpi_addmul_u32(rop, op1, op2->nmemb == 1 ? op2->data[0] : 0);
+	} else if (op1->nmemb <= 1) {
+		mpi_addmul_u32(rop, op2, op1->nmemb == 1 ? op1->data[0] : 0);
+	} else {
+		mpi_t tmp;
+
+		mpi_init(tmp);
+
+		if (op1 == op2) {
+			mpi_sqr(tmp, op1);
+		} else {
+			mpi_mul(tmp, op1, op2);
+		}
+
+		mpi_add(rop, rop, tmp);
+		mpi_clear(tmp);
+	}
+}
+
+/* rop - op1 * op2, with the product as the only temporary */
+void mpi_submul(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	if (op2->nmemb <= 1) {
+		mpi_submul_u32(rop, op1, op2->nmemb == 1 ? op2->data[0] : 0);
+	} else if (op1->nmemb <= 1) {
+		mpi_submul_u32(rop, op2, op1->nmemb == 1 ? op1->data[0] : 0);
+	} else {
+		mpi_t tmp;
+
+		mpi_init(tmp);
+
+		if (op1 == op2) {
+			mpi_sqr(tmp, op1);
+		} else {
+			mpi_mul(tmp, op1, op2);
+		}
+
+		mpi_sub(rop, rop, tmp);
+		mpi_clear(tmp);
+	}
+}
+
+int mpi_get_bit(const mpi_t op, mp_bitcnt_t b)
+{
+	size_t word = b / 31;
+	size_t bit = b % 31;
+
+	int r = 0;
+
+	if (word < op->nmemb) {
+		r = (op->data[word] >> bit) & 1;
+	}
+
+	return r;
+}
+
+mp_bitcnt_t mpi_scan1(const mpi_t op, mp_bitcnt_t starting_bit)
+{
+	size_t bits = 31 * op->nmemb;
+
+	for (size_t i = starting_bit; i < bits; ++i) {
+		if (mpi_get_bit(op, i) == 1) {
+			return i;
+		}
+	}
+
+	return (mp_bitcnt_t)-1;
+}
+
+/* powers base^(2^k) for base < POW_CACHE_BASES, computed on first use */
+#define POW_CACHE_BASES 64
+
+#define POW_CACHE_LEVELS 32
+
+/* limbs retained by the cache over all bases (64 MiB) */
+#define POW_CACHE_LIMBS ((size_t)1 << 24)
+
+static struct mpi *pow_cache[POW_CACHE_BASES][POW_CACHE_LEVELS];
+
+static size_t pow_cache_limbs;
+
+static pthread_rwlock_t pow_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * Sets scratch to base^(2^k) and returns it. Levels are retained while they
+ * fit into POW_CACHE_LIMBS; a level beyond that is squared from the largest
+ * one retained. Readers hold the lock shared, so new levels are squared
+ * without holding up the others, and mpi_pow_cache_clear() waits for them.
+ */
+const struct mpi *mpi_pow_cache(mpi_t scratch, uint32_t base, unsigned k)
+{
+	assert(base < POW_CACHE_BASES && k < POW_CACHE_LEVELS);
+
+	pthread_rwlock_rdlock(&pow_cache_lock);
+
+	while (1) {
+		unsigned i = 0;
+
+		while (i <= k && pow_cache[base][i] != NULL) {
+			i++;
+		}
+
+		if (i > k) {
+			mpi_set(scratch, pow_cache[base][k]);
+			break;
+		}
+
+		const struct mpi *prev = i == 0 ? NULL : pow_cache[base][i - 1];
+
+		/* the square has at most twice the limbs */
+		if (prev != NULL && pow_cache_limbs + 2 * prev->nmemb > POW_CACHE_LIMBS) {
+			mpi_sqr(scratch, prev);
+
+			for (++i; i <= k; ++i) {
+				mpi_sqr(scratch, scratch);
+			}
+
+			break;
+		}
+
+		struct mpi *p = malloc(sizeof(struct mpi));
+
+		if (p == NULL) {
+			abort();
+		}
+
+		mpi_init(p);
+
+		if (prev == NULL) {
+			mpi_set_u32(p, base);
+		} else {
+			mpi_sqr(p, prev);
+		}
+
+		mpi_compact(p);
+
+		pthread_rwlock_unlock(&pow_cache_lock);
+		pthread_rwlock_wrlock(&pow_cache_lock);
+
+		/* another thread may have published the level meanwhile */
+		if (pow_cache[base][i] == NULL) {
+			pow_cache[base][i] = p;
+			pow_cache_limbs += p->nmemb;
+		} else {
+			mpi_clear(p);
+			free(p);
+		}
+
+		pthread_rwlock_unlock(&pow_cache_lock);
+		pthread_rwlock_rdlock(&pow_cache_lock);
+	}
+
+	pthread_rwlock_unlock(&pow_cache_lock);
+
+	return scratch;
+}
+
+void mpi_pow_cache_clear(void)
+{
+	pthread_rwlock_wrlock(&pow_cache_lock);
+
+	for (size_t base = 0; base < POW_CACHE_BASES; ++base) {
+		for (size_t k = 0; k < POW_CACHE_LEVELS; ++k) {
+			if (pow_cache[base][k] != NULL) {
+				mpi_clear(pow_cache[base][k]);
+				free(pow_cache[base][k]);
+				pow_cache[base][k] = NULL;
+			}
+		}
+	}
+
+	pow_cache_limbs = 0;
+
+	pthread_rwlock_unlock(&pow_cache_lock);
+}
+
+void mpi_ui_pow_u32(mpi_t rop, uint32_t base, uint32_t exp)
+{
+	if (base == 0) {
+		mpi_set_u32(rop, exp == 0);
+		return;
+	}
+
+	STATS_BEGIN(STATS_POW, 1);
+
+	/* base = odd * 2^shift */
+	unsigned shift = 0;
+
+	while ((base & 1) == 0) {
+		base >>= 1;
+		shift++;
+	}
+
+	mpi_set_u32(rop, 1);
+
+	if (base == 1) {
+		/* nothing to do */
+	} else if (base < POW_CACHE_BASES) {
+		mpi_t p;
+
+		mpi_init(p);
+
+		for (unsigned k = 0; (exp >> k) != 0; ++k) {
+			if ((exp >> k) & 1) {
+				mpi_mul(rop, rop, mpi_pow_cache(p, base, k));
+			}
+		}
+
+		mpi_clear(p);
+	} else {
+		mpi_t b;
+
+		mpi_init(b);
+
+		mpi_set_u32(b, base);
+		mpi_pow_u32(rop, b, exp);
+
+		mpi_clear(b);
+	}
+
+	if (shift != 0) {
+		mpi_mul_2exp(rop, rop, (mp_bitcnt_t)shift * exp);
+	}
+
+	STATS_END(STATS_POW);
+}
+
+void mpi_pow_u32(mpi_t rop, const mpi_t base, uint32_t exp)
+{
+	if (mpi_cmp_u32(base, 0) == 0) {
+		mpi_set_u32(rop, exp == 0);
+		mpi_compact(rop);
+		return;
+	}
+
+	/* base = odd * 2^shift */
+	mp_bitcnt_t shift = mpi_scan1(base, 0);
+
+	mpi_t odd, r, t;
+	mpi_init(odd);
+	mpi_init(r);
+	mpi_init(t);
+
+	mpi_fdiv_q_2exp(odd, base, shift);
+	mpi_compact(odd);
+
+	int ebits = 0;
+
+	while (ebits < 32 && (exp >> ebits) != 0) {
+		ebits++;
+	}
+
+	mpi_set_u32(r, 1);
+
+	if (mpi_cmp_u32(odd, 1) != 0 && exp != 0) {
+		/* window width for a 32-bit exponent */
+		int w = ebits <= 8 ? 1 : ebits <= 24 ? 3 : 4;
+
+		/* odd powers odd^1, odd^3, ..., odd^(2^w - 1) */
+		mpi_t powers[8];
+
+		mpi_init(powers[0]);
+		mpi_set(powers[0], odd);
+
+		if (w > 1) {
+			mpi_sqr(t, odd);
+
+			for (int i = 1; i < 1 << (w - 1); ++i) {
+				mpi_init(powers[i]);
+				mpi_mul(powers[i], powers[i - 1], t);
+			}
+		}
+
+		/* left to right, a window always ending in a set bit */
+		int first = 1;
+
+		for (int i = ebits - 1; i >= 0; ) {
+			if (((exp >> i) & 1) == 0) {
+				mpi_sqr(r, r);
+				i--;
+				continue;
+			}
+
+			int j = i - w + 1 < 0 ? 0 : i - w + 1;
+
+			while (((exp >> j) & 1) == 0) {
+				j++;
+			}
+
+			uint32_t window = (exp >> j) & ((UINT32_C(1) << (i - j + 1)) - 1);
+
+			if (first) {
+				mpi_set(r, powers[window >> 1]);
+				first = 0;
+			} else {
+				for (int k = j; k <= i; ++k) {
+					mpi_sqr(r, r);
+				}
+
+				mpi_mul(r, r, powers[window >> 1]);
+			}
+
+			i = j - 1;
+		}
+
+		for (int i = 0; i < (w > 1 ? 1 << (w - 1) : 1); ++i) {
+			mpi_clear(powers[i]);
+		}
+	}
+
+	mpi_mul_2exp(rop, r, shift * exp);
+	mpi_compact(rop);
+
+	mpi_clear(odd);
+	mpi_clear(r);
+	mpi_clear(t);
+}
+
+/*
+ * Products of many words by balanced binary splitting. Runs of factors are
+ * first packed into single words, then the halves are multiplied recursively,
+ * so that the large multiplications have operands of about the same size.
+ */
+#define PROD_PARALLEL_THRESHOLD 4096
+
+/* multiply runs of factors into words in place, return the new count */
+static size_t prod_pack(uint32_t *a, size_t count)
+{
+	size_t n = 0;
+	uint64_t w = 1;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (w * a[i] > UINT32_MAX) {
+			a[n++] = (uint32_t)w;
+			w = 1;
+		}
+
+		w *= a[i];
+	}
+
+	if (w != 1 || n == 0) {
+		a[n++] = (uint32_t)w;
+	}
+
+	return n;
+}
+
+struct prod_args {
+	struct mpi *rop;
+	const uint32_t *a;
+	size_t count;
+};
+
+static void prod_tree(mpi_t rop, const uint32_t *a, size_t count);
+
+static void prod_tree_task(void *arg)
+{
+	struct prod_args *args = arg;
+
+	prod_tree(args->rop, args->a, args->count);
+}
+
+static void prod_tree(mpi_t rop, const uint32_t *a, size_t count)
+{
+	if (count <= 2) {
+		mpi_set_u64(rop, count == 2 ? (uint64_t)a[0] * a[1] : a[0]);
+		return;
+	}
+
+	size_t half = count / 2;
+
+	mpi_t t;
+	mpi_init(t);
+
+	if (count >= PROD_PARALLEL_THRESHOLD) {
+		/* the lower half goes to another thread (if one is spare) */
+		struct prod_args args = { t, a, half };
+		struct task task;
+
+		task_fork(&task, prod_tree_task, &args);
+		prod_tree(rop, a + half, count - half);
+		task_join(&task);
+	} else {
+		prod_tree(t, a, half);
+		prod_tree(rop, a + half, count - half);
+	}
+
+	mpi_mul(rop, rop, t);
+
+	mpi_clear(t);
+}
+
+/* product of the count factors in a, which is overwritten */
+static void prod_words(mpi_t rop, uint32_t *a, size_t count)
+{
+	if (count == 0) {
+		mpi_set_u32(rop, 1);
+		return;
+	}
+
+	prod_tree(rop, a, prod_pack(a, count));
+}
+
+/* the primes up to n, their number in *count; free() the result */
+static uint32_t *primes_upto(uint32_t n, size_t *count)
+{
+	/* bit i stands for 2 i + 1 */
+	size_t bits = (size_t)n / 2 + 1;
+	uint64_t *composite = mpi_alloc((bits + 63) / 64 * sizeof(uint64_t));
+
+	memset(composite, 0, (bits + 63) / 64 * sizeof(uint64_t));
+	composite[0] |= 1;
+	*count = n >= 2;
+
+	for (size_t i = 1; i < bits; ++i) {
+		if ((composite[i / 64] >> (i % 64)) & 1) {
+			continue;
+		}
+
+		uint64_t p = 2 * i + 1;
+
+		if (p > n) {
+			break;
+		}
+
+		(*count)++;
+
+		for (uint64_t j = p * p / 2; j < bits; j += p) {
+			composite[j / 64] |= UINT64_C(1) << (j % 64);
+		}
+	}
+
+	uint32_t *primes = mpi_alloc((*count + 1) * sizeof(uint32_t));
+
+	size_t c = 0;
+
+	if (n >= 2) {
+		primes[c++] = 2;
+	}
+
+	for (size_t i = 1; i < bits && 2 * i + 1 <= n; ++i) {
+		if (!((composite[i / 64] >> (i % 64)) & 1)) {
+			primes[c++] = (uint32_t)(2 * i + 1);
+		}
+	}
+
+	free(composite);
+
+	return primes;
+}
+
+/*
+ * Odd part of the swinging factorial n! / floor(n/2)!^2. The exponent of an
+ * odd prime p in it is the number of odd floor(n / p^k), so p contributes a
+ * single word p^e <= n.
+ */
+static void swing_odd(mpi_t rop, uint32_t n, const uint32_t *primes, size_t count, uint32_t *factors)
+{
+	size_t c = 0;
+
+	for (size_t i = 1; i < count && primes[i] <= n; ++i) {
+		uint32_t p = primes[i], w = 1;
+
+		for (uint32_t q = n / p; q > 0; q /= p) {
+			if (q & 1) {
+				w *= p;
+			}
+		}
+
+		if (w > 1) {
+			factors[c++] = w;
+		}
+	}
+
+	prod_words(rop, factors, c);
+}
+
+/* n! = 2^(n - popcount(n)) oddfac(n), oddfac(n) = oddfac(n / 2)^2 swing_odd(n) */
+void mpi_fac_u32(mpi_t rop, uint32_t n)
+{
+	if (n <= 20) {
+		uint64_t f = 1;
+
+		for (uint32_t i = 2; i <= n; ++i) {
+			f *= i;
+		}
+
+		mpi_set_u64(rop, f);
+		return;
+	}
+
+	size_t count;
+	uint32_t *primes = primes_upto(n, &count);
+	uint32_t *factors = mpi_alloc(count * sizeof(uint32_t));
+
+	/* the smallest level, n >> levels <= 20 */
+	int levels = 0;
+
+	while ((n >> levels) > 20) {
+		levels++;
+	}
+
+	uint64_t f = 1;
+
+	for (uint32_t i = 3; i <= (n >> levels); i += 2) {
+		f *= i;
+	}
+
+	for (uint32_t i = 2; i <= (n >> levels); i *= 2) {
+		for (uint32_t j = 3 * i; j <= (n >> levels); j += 2 * i) {
+			f *= j / i;
+		}
+	}
+
+	mpi_t r, s;
+	mpi_init(r);
+	mpi_init(s);
+
+	mpi_set_u64(r, f);
+
+	for (int l = levels - 1; l >= 0; --l) {
+		mpi_sqr(r, r);
+		swing_odd(s, n >> l, primes, count, factors);
+		mpi_mul(r, r, s);
+	}
+
+	mpi_mul_2exp(rop, r, n - (uint32_t)__builtin_popcount(n));
+
+	mpi_clear(r);
+	mpi_clear(s);
+	free(primes);
+	free(factors);
+}
+
+/*
+ * The k terms of n (n - 1) ... (n - k + 1) are stripped of the prime factors
+ * of k!, which they contain, and then multiplied without any division.
+ */
+void mpi_bin_uiui(mpi_t rop, uint32_t n, uint32_t k)
+{
+	if (k > n) {
+		mpi_set_u32(rop, 0);
+		return;
+	}
+
+	if (k > n - k) {
+		k = n - k;
+	}
+
+	uint32_t *terms = mpi_alloc(((size_t)k + 1) * sizeof(uint32_t));
+
+	uint32_t first = n - k + 1;
+
+	for (uint32_t i = 0; i < k; ++i) {
+		terms[i] = first + i;
+	}
+
+	size_t count;
+	uint32_t *primes = primes_upto(k, &count);
+
+	for (size_t j = 0; j < count; ++j) {
+		uint32_t p = primes[j];
+		/* exponent of p in k! */
+		uint64_t e = 0;
+
+		for (uint32_t q = k / p; q > 0; q /= p) {
+			e += q;
+		}
+
+		/* each pass removes one p from every term still divisible by it */
+		for (uint32_t i0 = (p - first % p) % p; e > 0;) {
+			for (uint32_t i = i0; i < k && e > 0; i += p) {
+				if (terms[i] % p == 0) {
+					terms[i] /= p;
+					e--;
+				}
+			}
+		}
+	}
+
+	prod_words(rop, terms, k);
+
+	free(primes);
+	free(terms);
+}
+
+void mpi_primorial_u32(mpi_t rop, uint32_t n)
+{
+	size_t count;
+	uint32_t *primes = primes_upto(n, &count);
+
+	prod_words(rop, primes, count);
+
+	free(primes);
+}
+
+/*
+ * Fibonacci and Lucas numbers by fast doubling. From F(k) and F(k-1),
+ *
+ *   F(2k-1) = F(k)^2 + F(k-1)^2
+ *   F(2k+1) = 4 F(k)^2 - F(k-1)^2 + 2 (-1)^k
+ *   F(2k)   = F(2k+1) - F(2k-1)
+ *
+ * so each bit of n costs two squarings, starting from the native words of
+ * fib_table for the leading bits.
+ */
+#define FIB_TABLE_LIMIT 93
+
+/* F(0) to F(93), the largest that fits in 64 bits */
+static const uint64_t fib_table[FIB_TABLE_LIMIT + 1] = {
+	UINT64_C(0), UINT64_C(1), UINT64_C(1), UINT64_C(2),
+	UINT64_C(3), UINT64_C(5), UINT64_C(8), UINT64_C(13),
+	UINT64_C(21), UINT64_C(34), UINT64_C(55), UINT64_C(89),
+	UINT64_C(144), UINT64_C(233), UINT64_C(377), UINT64_C(610),
+	UINT64_C(987), UINT64_C(1597), UINT64_C(2584), UINT64_C(4181),
+	UINT64_C(6765), UINT64_C(10946), UINT64_C(17711), UINT64_C(28657),
+	UINT64_C(46368), UINT64_C(75025), UINT64_C(121393), UINT64_C(196418),
+	UINT64_C(317811), UINT64_C(514229), UINT64_C(832040), UINT64_C(1346269),
+	UINT64_C(2178309), UINT64_C(3524578), UINT64_C(5702887), UINT64_C(9227465),
+	UINT64_C(14930352), UINT64_C(24157817), UINT64_C(39088169), UINT64_C(63245986),
+	UINT64_C(102334155), UINT64_C(165580141), UINT64_C(267914296), UINT64_C(433494437),
+	UINT64_C(701408733), UINT64_C(1134903170), UINT64_C(1836311903), UINT64_C(2971215073),
+	UINT64_C(4807526976), UINT64_C(7778742049), UINT64_C(12586269025), UINT64_C(20365011074),
+	UINT64_C(32951280099), UINT64_C(53316291173), UINT64_C(86267571272), UINT64_C(139583862445),
+	UINT64_C(225851433717), UINT64_C(365435296162), UINT64_C(591286729879), UINT64_C(956722026041),
+	UINT64_C(1548008755920), UINT64_C(2504730781961), UINT64_C(4052739537881), UINT64_C(6557470319842),
+	UINT64_C(10610209857723), UINT64_C(17167680177565), UINT64_C(27777890035288), UINT64_C(44945570212853),
+	UINT64_C(72723460248141), UINT64_C(117669030460994), UINT64_C(190392490709135), UINT64_C(308061521170129),
+	UINT64_C(498454011879264), UINT64_C(806515533049393), UINT64_C(1304969544928657), UINT64_C(2111485077978050),
+	UINT64_C(3416454622906707), UINT64_C(5527939700884757), UINT64_C(8944394323791464), UINT64_C(14472334024676221),
+	UINT64_C(23416728348467685), UINT64_C(37889062373143906), UINT64_C(61305790721611591), UINT64_C(99194853094755497),
+	UINT64_C(160500643816367088), UINT64_C(259695496911122585), UINT64_C(420196140727489673), UINT64_C(679891637638612258),
+	UINT64_C(1100087778366101931), UINT64_C(1779979416004714189), UINT64_C(2880067194370816120), UINT64_C(4660046610375530309),
+	UINT64_C(7540113804746346429), UINT64_C(12200160415121876738),
+};
+
+/* f = F(n), g = F(n-1), with F(-1) = 1 */
+static void fib2(mpi_t f, mpi_t g, uint32_t n)
+{
+	if (n <= FIB_TABLE_LIMIT) {
+		mpi_set_u64(f, fib_table[n]);
+		mpi_set_u64(g, n == 0 ? 1 : fib_table[n - 1]);
+		return;
+	}
+
+	int s = 0;
+
+	while ((n >> s) > FIB_TABLE_LIMIT) {
+		s++;
+	}
+
+	uint32_t k = n >> s;
+
+	mpi_set_u64(f, fib_table[k]);
+	mpi_set_u64(g, fib_table[k - 1]);
+
+	mpi_t a, b;
+	mpi_init(a);
+	mpi_init(b);
+
+	for (int i = s - 1; i >= 0; --i) {
+		mpi_sqr(a, f);
+		mpi_sqr(b, g);
+
+		/* g = F(2k-1), f = F(2k+1) */
+		mpi_add(g, a, b);
+		mpi_mul_2exp(f, a, 2);
+		mpi_sub(f, f, b);
+
+		if (k & 1) {
+			mpi_sub_u32(f, f, 2);
+		} else {
+			mpi_add_u32(f, f, 2);
+		}
+
+		/* F(2k) */
+		mpi_sub(a, f, g);
+
+		if ((n >> i) & 1) {
+			mpi_swap(g, a);
+			k = 2 * k + 1;
+		} else {
+			mpi_swap(f, a);
+			k = 2 * k;
+		}
+	}
+
+	mpi_clear(a);
+	mpi_clear(b);
+}
+
+void mpi_fib2_u32(mpi_t fn, mpi_t fnsub1, uint32_t n)
+{
+	mpi_t f, g;
+	mpi_init(f);
+	mpi_init(g);
+
+	/* fib2 swaps its limbs around, so it works on locals */
+	fib2(f, g, n);
+	mpi_compact(f);
+	mpi_compact(g);
+
+	mpi_move(fn, f);
+	mpi_move(fnsub1, g);
+
+	mpi_clear(f);
+	mpi_clear(g);
+}
+
+/* from F(k) and F(k-1) for k = n / 2, one multiplication at the final size */
+void mpi_fib_u32(mpi_t fn, uint32_t n)
+{
+	if (n <= FIB_TABLE_LIMIT) {
+		mpi_set_u64(fn, fib_table[n]);
+		return;
+	}
+
+	uint32_t k = n / 2;
+
+	mpi_t f, g;
+	mpi_init(f);
+	mpi_init(g);
+
+	fib2(f, g, k);
+
+	if (n & 1) {
+		/* F(2k+1) = (2 F(k) + F(k-1)) (2 F(k) - F(k-1)) + 2 (-1)^k */
+		mpi_mul_2exp(f, f, 1);
+		mpi_add(fn, f, g);
+		mpi_sub(f, f, g);
+		mpi_mul(fn, fn, f);
+
+		if (k & 1) {
+			mpi_sub_u32(fn, fn, 2);
+		} else {
+			mpi_add_u32(fn, fn, 2);
+		}
+	} else {
+		/* F(2k) = F(k) (F(k) + 2 F(k-1)) */
+		mpi_mul_2exp(g, g, 1);
+		mpi_add(g, g, f);
+		mpi_mul(fn, f, g);
+	}
+
+	mpi_compact(fn);
+
+	mpi_clear(f);
+	mpi_clear(g);
+}
+
+/* L(n) = F(n) + 2 F(n-1), L(n-1) = 2 F(n) - F(n-1) */
+void mpi_lucnum2_u32(mpi_t ln, mpi_t lnsub1, uint32_t n)
+{
+	if (n == 0) {
+		/* L(-1) = -1 */
+		fprintf(stderr, "Negative numbers not supported\n");
+		abort();
+	}
+
+	mpi_t f, g;
+	mpi_init(f);
+	mpi_init(g);
+
+	fib2(f, g, n);
+
+	mpi_mul_2exp(lnsub1, f, 1);
+	mpi_sub(lnsub1, lnsub1, g);
+	mpi_mul_2exp(g, g, 1);
+	mpi_add(ln, f, g);
+	mpi_compact(ln);
+
+	mpi_clear(f);
+	mpi_clear(g);
+}
+
+/* from F(k) and F(k-1) for k = n / 2, one multiplication at the final size */
+void mpi_lucnum_u32(mpi_t ln, uint32_t n)
+{
+	if (n < FIB_TABLE_LIMIT) {
+		mpi_set_u64(ln, n == 0 ? 2 : fib_table[n] + 2 * fib_table[n - 1]);
+		return;
+	}
+
+	uint32_t k = n / 2;
+
+	mpi_t f, g, l;
+	mpi_init(f);
+	mpi_init(g);
+	mpi_init(l);
+
+	fib2(f, g, k);
+
+	/* L(k) = F(k) + 2 F(k-1) */
+	mpi_mul_2exp(l, g, 1);
+	mpi_add(l, l, f);
+
+	if (n & 1) {
+		/* L(2k+1) = L(k) L(k+1) - (-1)^k, L(k+1) = 3 F(k) + F(k-1) */
+		mpi_mul_u32(f, f, 3);
+		mpi_add(f, f, g);
+		mpi_mul(ln, l, f);
+
+		if (k & 1) {
+			mpi_add_u32(ln, ln, 1);
+		} else {
+			mpi_sub_u32(ln, ln, 1);
+		}
+	} else {
+		/* L(2k) = L(k)^2 - 2 (-1)^k */
+		mpi_sqr(ln, l);
+
+		if (k & 1) {
+			mpi_add_u32(ln, ln, 2);
+		} else {
+			mpi_sub_u32(ln, ln, 2);
+		}
+	}
+
+	mpi_compact(ln);
+
+	mpi_clear(f);
+	mpi_clear(g);
+	mpi_clear(l);
+}
+
+uint32_t mpz_fdiv_u32(const mpi_t n, uint32_t d)
+{
+	uint64_t r = 0;
+
+	for (size_t i = n->nmemb - 1; i != (size_t)-1; --i) {
+		r = ((r << 31) | n->data[i]) % d;
+	}
+
+	return (uint32_t)r;
+}
+
+int mpi_divisible_u32_p(const mpi_t n, unsigned long int d)
+{
+	return mpz_fdiv_u32(n, d) == 0;
+}
+
+int mpi_tstbit(const mpi_t op, mp_bitcnt_t bit_index)
+{
+	size_t word = bit_index / 31;
+	size_t bit = bit_index % 31;
+
+	uint32_t r = word < op->nmemb ? op->data[word] : 0;
+
+	return (r >> bit) & 1;
+}
+
+void mpi_setbit(mpi_t rop, mp_bitcnt_t bit_index)
+{
+	size_t word = bit_index / 31;
+	size_t bit = bit_index % 31;
+
+	mpi_enlarge(rop, word + 1);
+
+	uint32_t mask = (uint32_t)1 << bit;
+
+	rop->data[word] |= mask;
+}
+
+size_t mpi_sizeinbase(const mpi_t op, int base)
+{
+	assert(base == 2);
+
+	// find right-most non-zero word
+	for (size_t i = op->nmemb - 1; i != (size_t)-1; --i) {
+		if (op->data[i] != 0) {
+			// find right-most non-zero bit
+			for (int b = 30; b >= 0; --b) {
+				if ((op->data[i] & ((uint32_t)1 << b)) != 0) {
+					return 31 * i + b + 1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* number of limbs without the leading zeros */
+static size_t limbs(const mpi_t op)
+{
+	size_t nmemb = op->nmemb;
+
+	while (nmemb > 0 && op->data[nmemb - 1] == 0) {
+		nmemb--;
+	}
+
+	return nmemb;
+}
+
+/*
+ * Knuth's algorithm D (TAOCP 4.3.1) on 31-bit limbs, the divisor having at
+ * least two limbs. On return, the low m limbs of u hold the remainder.
+ */
+static void divrem(uint32_t *q, uint32_t *u, size_t l, const uint32_t *v, size_t m)
+{
+	const uint64_t mask = 0x7fffffff;
+
+	for (size_t j = l - m; j != (size_t)-1; --j) {
+		uint64_t num = ((uint64_t)u[j + m] << 31) | u[j + m - 1];
+		uint64_t qhat = num / v[m - 1];
+		uint64_t rhat = num % v[m - 1];
+
+		while (qhat > mask || qhat * v[m - 2] > ((rhat << 31) | u[j + m - 2])) {
+			qhat--;
+			rhat += v[m - 1];
+
+			if (rhat > mask) {
+				break;
+			}
+		}
+
+		/* u[j..j+m] -= qhat * v */
+		uint64_t carry = 0;
+		int64_t borrow = 0;
+
+		for (size_t i = 0; i < m; ++i) {
+			uint64_t p = qhat * v[i] + carry;
+			int64_t t = (int64_t)u[i + j] - (int64_t)(p & mask) + borrow;
+
+			carry = p >> 31;
+			u[i + j] = (uint32_t)(t & (int64_t)mask);
+			borrow = t >> 31;
+		}
+
+		int64_t t = (int64_t)u[j + m] - (int64_t)carry + borrow;
+
+		u[j + m] = (uint32_t)(t & (int64_t)mask);
+
+		if (t < 0) {
+			/* qhat was one too large, add v back (mod 2^(31(m+1))) */
+			qhat--;
+			carry = 0;
+
+			for (size_t i = 0; i < m; ++i) {
+				uint64_t s = (uint64_t)u[i + j] + v[i] + carry;
+
+				u[i + j] = (uint32_t)(s & mask);
+				carry = s >> 31;
+			}
+
+			u[j + m] = (uint32_t)((u[j + m] + carry) & mask);
+		}
+
+		q[j] = (uint32_t)qhat;
+	}
+}
+
+void mpi_fdiv_qr(mpi_t q, mpi_t r, const mpi_t n, const mpi_t d)
+{
+	size_t l = limbs(n);
+	size_t m = limbs(d);
+
+	if (m == 0) {
+		fprintf(stderr, "Division by zero\n");
+		abort();
+	}
+
+	if (m == 1) {
+		mpi_fdiv_qr_u32(q, r, n, d->data[0]);
+		return;
+	}
+
+	STATS_BEGIN(STATS_FDIV_QR, l);
+
+	if (l < m) {
+		mpi_set(r, n);
+		mpi_set_u32(q, 0);
+		mpi_compact(r);
+		mpi_compact(q);
+		STATS_END(STATS_FDIV_QR);
+		return;
+	}
+
+	/* normalize: the top bit of the divisor is set */
+	mp_bitcnt_t shift = 31 * m - mpi_sizeinbase(d, 2);
+
+	mpi_t u, v, t;
+	mpi_init(u);
+	mpi_init(v);
+	mpi_init(t);
+
+	mpi_mul_2exp(u, n, shift);
+	mpi_mul_2exp(v, d, shift);
+	mpi_enlarge(u, l + 1);
+	mpi_enlarge(t, l - m + 1);
+
+	divrem(t->data, u->data, l, v->data, m);
+
+	for (size_t i = m; i < u->nmemb; ++i) {
+		u->data[i] = 0;
+	}
+
+	mpi_compact(t);
+	mpi_move(q, t);
+	mpi_fdiv_q_2exp(r, u, shift);
+	mpi_compact(r);
+
+	mpi_clear(u);
+	mpi_clear(v);
+	mpi_clear(t);
+
+	STATS_END(STATS_FDIV_QR);
+}
+
+uint32_t mpi_fdiv_qr_u32(mpi_t q, mpi_t r, const mpi_t n, uint32_t d)
+{
+	if (d == 0) {
+		fprintf(stderr, "Division by zero\n");
+		abort();
+	}
+
+	size_t nmemb = limbs(n);
+	uint64_t rem = 0;
+
+	STATS_BEGIN(STATS_FDIV_QR_U32, nmemb);
+
+	mpi_t t;
+	mpi_init(t);
+	mpi_enlarge(t, nmemb);
+
+	for (size_t i = nmemb - 1; i != (size_t)-1; --i) {
+		uint64_t num = (rem << 31) | n->data[i];
+
+		t->data[i] = (uint32_t)(num / d);
+		rem = num % d;
+	}
+
+	mpi_compact(t);
+	mpi_move(q, t);
+	mpi_set_u32(r, (uint32_t)rem);
+	mpi_clear(t);
+
+	STATS_END(STATS_FDIV_QR_U32);
+
+	return (uint32_t)rem;
+}
+
+/*
+ * Residues modulo many small divisors. The divisors are packed into leaves
+ * whose products fit in 32 bits, the leaves are multiplied up a product tree
+ * until the nodes are as large as n, and n is reduced modulo the top nodes
+ * and then down the tree, so that every level costs divisions of numbers of
+ * the size of its nodes instead of one pass over n per divisor.
+ */
+struct remtree {
+	const struct mpi *n;
+	/* nodes[0] are the leaves, nodes[levels - 1] the top */
+	size_t levels;
+	size_t count[65];
+	struct mpi *nodes[65];
+	/* level being built or reduced */
+	size_t level;
+	/* divisors of leaf i are first[i] .. first[i + 1] - 1 */
+	size_t *first;
+	/* remainders on the way down */
+	struct mpi *rem, *rem_next;
+};
+
+static void remtree_level_mul(void *arg, size_t begin, size_t end)
+{
+	struct remtree *tree = arg;
+	size_t l = tree->level;
+
+	for (size_t i = begin; i < end; ++i) {
+		if (2 * i + 1 < tree->count[l - 1]) {
+			mpi_mul(&tree->nodes[l][i], &tree->nodes[l - 1][2 * i], &tree->nodes[l - 1][2 * i + 1]);
+		} else {
+			mpi_set(&tree->nodes[l][i], &tree->nodes[l - 1][2 * i]);
+		}
+	}
+}
+
+/* rem_next[i] = rem[i / 2] mod nodes[level][i], n mod nodes[level][i] at the top */
+static void remtree_level_mod(void *arg, size_t begin, size_t end)
+{
+	struct remtree *tree = arg;
+
+	mpi_t q;
+	mpi_init(q);
+
+	for (size_t i = begin; i < end; ++i) {
+		const struct mpi *parent = tree->level + 1 == tree->levels ? tree->n : &tree->rem[i / 2];
+
+		mpi_fdiv_qr(q, &tree->rem_next[i], parent, &tree->nodes[tree->level][i]);
+	}
+
+	mpi_clear(q);
+}
+
+static struct mpi *remtree_level_alloc(size_t count)
+{
+	struct mpi *level = mpi_alloc(count * sizeof(struct mpi));
+
+	for (size_t i = 0; i < count; ++i) {
+		mpi_init(&level[i]);
+	}
+
+	return level;
+}
+
+static void remtree_level_free(struct mpi *level, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		mpi_clear(&level[i]);
+	}
+
+	free(level);
+}
+
+void mpi_mod_u32_many(uint32_t *residues, const mpi_t n, const uint32_t *divisors, size_t count)
+{
+	if (count == 0) {
+		return;
+	}
+
+	STATS_BEGIN(STATS_MOD_U32_MANY, n->nmemb);
+
+	struct remtree tree;
+
+	tree.first = mpi_alloc((count + 1) * sizeof(size_t));
+
+	size_t leaves = 0;
+	uint64_t product = 1;
+
+	for (size_t k = 0; k < count; ++k) {
+		if (divisors[k] == 0) {
+			fprintf(stderr, "Division by zero\n");
+			abort();
+		}
+
+		if (k == 0 || product * divisors[k] > UINT32_MAX) {
+			tree.first[leaves++] = k;
+			product = 1;
+		}
+
+		product *= divisors[k];
+	}
+
+	tree.first[leaves] = count;
+
+	tree.count[0] = leaves;
+	tree.nodes[0] = remtree_level_alloc(leaves);
+
+	for (size_t i = 0; i < leaves; ++i) {
+		product = 1;
+
+		for (size_t k = tree.first[i]; k < tree.first[i + 1]; ++k) {
+			product *= divisors[k];
+		}
+
+		mpi_set_u32(&tree.nodes[0][i], (uint32_t)product);
+	}
+
+	/* product tree */
+	for (tree.levels = 1; tree.count[tree.levels - 1] > 1 && tree.nodes[tree.levels - 1][0].nmemb < n->nmemb; tree.levels++) {
+		size_t l = tree.level = tree.levels;
+
+		tree.count[l] = (tree.count[l - 1] + 1) / 2;
+		tree.nodes[l] = remtree_level_alloc(tree.count[l]);
+		parallel_for(tree.count[l], remtree_level_mul, &tree);
+	}
+
+	/* remainder tree */
+	tree.n = n;
+	tree.rem = NULL;
+
+	for (size_t l = tree.levels; l-- > 0;) {
+		tree.rem_next = remtree_level_alloc(tree.count[l]);
+		tree.level = l;
+		parallel_for(tree.count[l], remtree_level_mod, &tree);
+
+		if (tree.rem != NULL) {
+			remtree_level_free(tree.rem, tree.count[l + 1]);
+		}
+
+		remtree_level_free(tree.nodes[l], tree.count[l]);
+		tree.rem = tree.rem_next;
+	}
+
+	for (size_t i = 0; i < leaves; ++i) {
+		uint32_t r = mpi_get_u32(&tree.rem[i]);
+
+		for (size_t k = tree.first[i]; k < tree.first[i + 1]; ++k) {
+			residues[k] = r % divisors[k];
+		}
+	}
+
+	remtree_level_free(tree.rem, leaves);
+	free(tree.first);
+
+	STATS_END(STATS_MOD_U32_MANY);
+}
+
+int mpi_divisible_by_any(const mpi_t n, const uint32_t *divisors, size_t count)
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	uint32_t *residues = mpi_alloc(count * sizeof(uint32_t));
+
+	mpi_mod_u32_many(residues, n, divisors, count);
+
+	int ret = 0;
+
+	for (size_t k = 0; k < count && !ret; ++k) {
+		ret = residues[k] == 0;
+	}
+
+	free(residues);
+
+	return ret;
+}
+
+/* floor(sqrt(a)) of a < 2^62 */
+static uint32_t sqrt_u64(uint64_t a)
+{
+	uint64_t s = (uint64_t)sqrt((double)a);
+
+	while (s * s > a) {
+		s--;
+	}
+
+	while ((s + 1) * (s + 1) <= a) {
+		s++;
+	}
+
+	return (uint32_t)s;
+}
+
+/*
+ * Karatsuba square root (Zimmermann): split a = a' 2^(2k) + a1 2^k + a0 with
+ * a' >= 2^(2k-2), take s', r' of a' recursively, then one division of r' 2^k +
+ * a1 by 2 s' yields the low half of the root, and at most one correction makes
+ * the remainder non-negative. The division dominates the cost.
+ */
+static void sqrtrem(mpi_t s, mpi_t r, const mpi_t a)
+{
+	mp_bitcnt_t n = mpi_sizeinbase(a, 2);
+
+	if (n <= 62) {
+		uint64_t v = mpi_get_u64(a);
+		uint64_t root = sqrt_u64(v);
+
+		mpi_set_u64(s, root);
+		mpi_set_u64(r, v - root * root);
+		return;
+	}
+
+	mp_bitcnt_t k = (n + 1) / 4;
+
+	mpi_t t, a1, q, u;
+	mpi_init(t);
+	mpi_init(a1);
+	mpi_init(q);
+	mpi_init(u);
+
+	mpi_fdiv_q_2exp(t, a, 2 * k);
+	sqrtrem(s, r, t);
+
+	/* (q, u) = divrem(r' 2^k + a1, 2 s') */
+	mpi_fdiv_q_2exp(a1, a, k);
+	mpi_fdiv_r_2exp(a1, a1, k);
+	mpi_mul_2exp(r, r, k);
+	mpi_add(r, r, a1);
+	mpi_mul_2exp(t, s, 1);
+	mpi_fdiv_qr(q, u, r, t);
+
+	/* s = s' 2^k + q, r = u 2^k + a0 - q^2 */
+	mpi_mul_2exp(s, s, k);
+	mpi_add(s, s, q);
+	mpi_fdiv_r_2exp(r, a, k);
+	mpi_mul_2exp(u, u, k);
+	mpi_add(r, r, u);
+	mpi_sqr(q, q);
+
+	if (mpi_cmp(r, q) < 0) {
+		/* r += 2 s - 1, s -= 1 */
+		mpi_sub_u32(s, s, 1);
+		mpi_mul_2exp(t, s, 1);
+		mpi_add(r, r, t);
+		mpi_add_u32(r, r, 1);
+	}
+
+	mpi_sub(r, r, q);
+
+	mpi_clear(t);
+	mpi_clear(a1);
+	mpi_clear(q);
+	mpi_clear(u);
+}
+
+void mpi_sqrtrem(mpi_t rop1, mpi_t rop2, const mpi_t op)
+{
+	STATS_BEGIN(STATS_SQRTREM, op->nmemb);
+
+	mpi_t s, r;
+	mpi_init(s);
+	mpi_init(r);
+
+	sqrtrem(s, r, op);
+
+	mpi_compact(s);
+	mpi_compact(r);
+	mpi_move(rop1, s);
+	mpi_move(rop2, r);
+
+	mpi_clear(s);
+	mpi_clear(r);
+
+	STATS_END(STATS_SQRTREM);
+}
+
+void mpi_sqrt(mpi_t rop, const mpi_t op)
+{
+	mpi_t r;
+	mpi_init(r);
+
+	mpi_sqrtrem(rop, r, op);
+
+	mpi_clear(r);
+}
+
+/* floor(a^(1/k)) for k >= 2, Newton iteration from an estimate with half the bits */
+static void root_newton(mpi_t x, const mpi_t a, uint32_t k)
+{
+	mp_bitcnt_t n = mpi_sizeinbase(a, 2);
+	/* bits of the root */
+	mp_bitcnt_t m = (n + k - 1) / k;
+
+	if (m <= 16) {
+		/* a < 2^(k m) */
+		mpi_set_u32(x, (uint32_t)1 << m);
+	} else {
+		/* y = floor((a / 2^(k h))^(1/k)) gives a < ((y + 1) 2^h)^k */
+		mp_bitcnt_t h = m / 2;
+
+		mpi_t t;
+		mpi_init(t);
+
+		mpi_fdiv_q_2exp(t, a, k * h);
+		root_newton(x, t, k);
+		mpi_add_u32(x, x, 1);
+		mpi_mul_2exp(x, x, h);
+
+		mpi_clear(t);
+	}
+
+	mpi_t y, p, r;
+	mpi_init(y);
+	mpi_init(p);
+	mpi_init(r);
+
+	/* from above, x decreases until it reaches floor(a^(1/k)) */
+	for (;;) {
+		/* y = ((k - 1) x + a / x^(k - 1)) / k */
+		mpi_pow_u32(p, x, k - 1);
+		mpi_fdiv_qr(y, r, a, p);
+		mpi_mul_u32(p, x, k - 1);
+		mpi_add(y, y, p);
+		mpi_fdiv_qr_u32(y, r, y, k);
+
+		if (mpi_cmp(y, x) >= 0) {
+			break;
+		}
+
+		mpi_swap(x, y);
+	}
+
+	mpi_clear(y);
+	mpi_clear(p);
+	mpi_clear(r);
+}
+
+int mpi_root(mpi_t rop, const mpi_t op, uint32_t n)
+{
+	if (n == 0) {
+		fprintf(stderr, "Zeroth root\n");
+		abort();
+	}
+
+	STATS_BEGIN(STATS_ROOT, op->nmemb);
+
+	mpi_t x, p;
+	mpi_init(x);
+	mpi_init(p);
+
+	if (n == 1 || mpi_cmp_u32(op, 1) <= 0) {
+		mpi_set(x, op);
+		mpi_set_u32(p, 0);
+	} else if (n == 2) {
+		sqrtrem(x, p, op);
+	} else if (n >= mpi_sizeinbase(op, 2)) {
+		/* 1 < op < 2^n */
+		mpi_set_u32(x, 1);
+		mpi_set_u32(p, 1);
+	} else {
+		root_newton(x, op, n);
+		mpi_pow_u32(p, x, n);
+		mpi_sub(p, op, p);
+	}
+
+	int exact = mpi_cmp_u32(p, 0) == 0;
+
+	mpi_compact(x);
+	mpi_move(rop, x);
+
+	mpi_clear(x);
+	mpi_clear(p);
+
+	STATS_END(STATS_ROOT);
+
+	return exact;
+}
+
+static int prime_p(mp_bitcnt_t p)
+{
+	if (p < 2) {
+		return 0;
+	}
+
+	for (mp_bitcnt_t d = 2; d * d <= p; ++d) {
+		if (p % d == 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* strong probable prime to base b < n, n odd */
+static int sprp_u32(uint32_t n, uint32_t b)
+{
+	uint32_t d = n - 1;
+	int s = __builtin_ctz(d);
+	uint64_t x = 1, a = b;
+
+	for (d >>= s; d != 0; d >>= 1) {
+		if (d & 1) {
+			x = x * a % n;
+		}
+
+		a = a * a % n;
+	}
+
+	if (x == 1 || x == n - 1) {
+		return 1;
+	}
+
+	for (int r = 1; r < s; ++r) {
+		x = x * x % n;
+
+		if (x == n - 1) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* the bases 2, 7 and 61 leave no strong pseudoprime below 2^32 */
+static int prime_u32(uint32_t n)
+{
+	if (n < 62) {
+		return prime_p(n);
+	}
+
+	return (n & 1) && sprp_u32(n, 2) && sprp_u32(n, 7) && sprp_u32(n, 61);
+}
+
+/*
+ * Residue filters. n mod 2^24 - 1 = 3^2 5 7 13 17 241 comes from one pass
+ * over the limbs: limb i is worth 2^(31 i) = 2^(7 i mod 24) modulo it.
+ */
+#define RESIDUE_BITS 24
+#define RESIDUE_MOD ((UINT64_C(1) << RESIDUE_BITS) - 1)
+
+static uint32_t mod_residue(const mpi_t op)
+{
+	uint64_t acc = 0;
+	unsigned shift = 0;
+
+	for (size_t i = 0; i < op->nmemb; ++i) {
+		acc += (uint64_t)op->data[i] << shift;
+		shift = (shift + 31) % RESIDUE_BITS;
+
+		/* every term is below 2^54 */
+		if ((i & 511) == 511) {
+			acc = (acc & RESIDUE_MOD) + (acc >> RESIDUE_BITS);
+		}
+	}
+
+	while (acc > RESIDUE_MOD) {
+		acc = (acc & RESIDUE_MOD) + (acc >> RESIDUE_BITS);
+	}
+
+	return acc == RESIDUE_MOD ? 0 : (uint32_t)acc;
+}
+
+/* squares modulo 256, 63, 65, 17 and 241, bit r set if r is a square */
+static const uint64_t sq_res_256[4] = {
+	UINT64_C(0x0202021202030213), UINT64_C(0x0202021202020213), UINT64_C(0x0202021202030212), UINT64_C(0x0202021202020212)
+};
+static const uint64_t sq_res_63[1] = { UINT64_C(0x0402483012450293) };
+static const uint64_t sq_res_65[2] = { UINT64_C(0x218a019866014613), UINT64_C(0x0000000000000001) };
+static const uint64_t sq_res_17[1] = { UINT64_C(0x000000000001a317) };
+static const uint64_t sq_res_241[4] = {
+	UINT64_C(0x3c67a3116b15977f), UINT64_C(0x2fd21c174c8fa909), UINT64_C(0x98f24257c4cba0e1), UINT64_C(0x0001fba6a35a2317)
+};
+
+static int sq_res(const uint64_t *bitmap, uint32_t r)
+{
+	return (bitmap[r / 64] >> (r % 64)) & 1;
+}
+
+int mpi_perfect_square_p(const mpi_t op)
+{
+	if (!sq_res(sq_res_256, op->nmemb > 0 ? op->data[0] & 255 : 0)) {
+		return 0;
+	}
+
+	uint32_t r = mod_residue(op);
+
+	/* about 0.4 % of non-squares get past here */
+	if (!sq_res(sq_res_63, r % 63) || !sq_res(sq_res_65, r % 65) || !sq_res(sq_res_17, r % 17) || !sq_res(sq_res_241, r % 241)) {
+		return 0;
+	}
+
+	mpi_t s, t;
+	mpi_init(s);
+	mpi_init(t);
+
+	mpi_sqrtrem(s, t, op);
+
+	int square = mpi_cmp_u32(t, 0) == 0;
+
+	mpi_clear(s);
+	mpi_clear(t);
+
+	return square;
+}
+
+/* whether r is a p-th power modulo the prime q < 2^32, p dividing q - 1 (Euler's criterion) */
+static int power_res(uint32_t r, uint32_t q, mp_bitcnt_t p)
+{
+	uint64_t b = r % q, e = (q - 1) / p, x = 1;
+
+	if (b == 0) {
+		return 1;
+	}
+
+	for (; e != 0; e >>= 1) {
+		if (e & 1) {
+			x = x * b % q;
+		}
+
+		b = b * b % q;
+	}
+
+	return x == 1;
+}
+
+/* cubes modulo 9 are 0, 1 and 8 */
+static int cube_res(uint32_t r)
+{
+	r %= 9;
+
+	return r == 0 || r == 1 || r == 8;
+}
+
+static uint64_t mont64_inv(uint64_t n);
+
+/* a^e modulo 2^64 */
+static uint64_t pow_u64(uint64_t a, mp_bitcnt_t e)
+{
+	uint64_t x = 1;
+
+	for (; e != 0; e >>= 1) {
+		if (e & 1) {
+			x *= a;
+		}
+
+		a *= a;
+	}
+
+	return x;
+}
+
+/*
+ * The p-th root of odd a modulo 2^64, p odd, which is unique. Newton's
+ * iteration w += w (1 - a w^p) / p for w = a^(-1/p) doubles the correct low
+ * bits from w = 1, then a^(1/p) = a w^(p - 1).
+ */
+static uint64_t root_2adic(uint64_t a, mp_bitcnt_t p)
+{
+	uint64_t p_inv = mont64_inv(p);
+	uint64_t w = 1;
+
+	for (int i = 0; i < 6; ++i) {
+		w += w * (1 - a * pow_u64(w, p)) * p_inv;
+	}
+
+	return a * pow_u64(w, p - 1);
+}
+
+/* a non-power passes the residue filter of an exponent with probability below 2^-POWER_FILTER_BITS */
+#define POWER_FILTER_BITS 32
+
+/* primes q = 1 (mod p) enough for p^count >= 2^POWER_FILTER_BITS */
+static size_t power_filter_count(mp_bitcnt_t p)
+{
+	size_t count = 0;
+
+	for (uint64_t share = 1; share >> POWER_FILTER_BITS == 0; share *= p) {
+		count++;
+	}
+
+	return count;
+}
+
+int mpi_perfect_power_p(const mpi_t op)
+{
+	if (mpi_cmp_u32(op, 1) <= 0) {
+		return 1;
+	}
+
+	mp_bitcnt_t bits = mpi_sizeinbase(op, 2);
+	/* the exponent divides the number of trailing zeros */
+	mp_bitcnt_t zeros = mpi_scan1(op, 0);
+
+	if (zeros == 1) {
+		return 0;
+	}
+
+	if ((zeros == 0 || zeros % 2 == 0) && mpi_perfect_square_p(op)) {
+		return 1;
+	}
+
+	/*
+	 * The odd prime exponents p, x^p with x >= 2 having at least p + 1 bits,
+	 * each with its primes q = 1 (mod p); p-th powers are a 1/p share of the
+	 * residues modulo such a q, and all residues come from one remainder tree.
+	 */
+	size_t nexps = 0, nqs = 0;
+
+	for (mp_bitcnt_t p = 3; p < bits; p += 2) {
+		if (prime_p(p) && (zeros == 0 || zeros % p == 0)) {
+			nexps++;
+			nqs += power_filter_count(p);
+		}
+	}
+
+	mp_bitcnt_t *exps = mpi_alloc(nexps * sizeof(mp_bitcnt_t));
+	size_t *first = mpi_alloc((nexps + 1) * sizeof(size_t));
+	uint32_t *qs = mpi_alloc(nqs * sizeof(uint32_t));
+
+	nexps = 0;
+	nqs = 0;
+
+	for (mp_bitcnt_t p = 3; p < bits; p += 2) {
+		if (!prime_p(p) || (zeros != 0 && zeros % p != 0)) {
+			continue;
+		}
+
+		exps[nexps] = p;
+		first[nexps++] = nqs;
+
+		size_t count = power_filter_count(p);
+
+		for (uint64_t q = 2 * p + 1; q <= UINT32_MAX && count != 0; q += 2 * p) {
+			if (prime_u32((uint32_t)q)) {
+				qs[nqs++] = (uint32_t)q;
+				count--;
+			}
+		}
+	}
+
+	first[nexps] = nqs;
+
+	uint32_t *residues = mpi_alloc(nqs * sizeof(uint32_t));
+
+	mpi_mod_u32_many(residues, op, qs, nqs);
+
+	uint32_t r = mod_residue(op);
+
+	/* the odd part is a p-th power too; its root has 1 + (odd_bits - 1) / p bits */
+	mpi_t odd, x;
+	mpi_init(odd);
+	mpi_init(x);
+
+	mpi_fdiv_q_2exp(odd, op, zeros);
+
+	mp_bitcnt_t odd_bits = bits - zeros;
+	uint64_t odd_low = mpi_get_u64(odd);
+
+	int power = 0;
+
+	for (size_t i = 0; i < nexps && !power; ++i) {
+		mp_bitcnt_t p = exps[i];
+
+		if (p == 3 && !cube_res(r)) {
+			continue;
+		}
+
+		int res = 1;
+
+		for (size_t j = first[i]; j < first[i + 1] && res; ++j) {
+			res = power_res(residues[j], qs[j], p);
+		}
+
+		if (!res) {
+			continue;
+		}
+
+		/* a root of at most 64 bits is its 2-adic root, no full-precision root needed */
+		if ((odd_bits - 1) / p < 64) {
+			uint64_t z = root_2adic(odd_low, p);
+			mp_bitcnt_t z_bits = (mp_bitcnt_t)(64 - __builtin_clzll(z));
+
+			if (z_bits == 1 + (odd_bits - 1) / p) {
+				mpi_set_u64(x, z);
+				mpi_pow_u32(x, x, (uint32_t)p);
+				power = mpi_cmp(x, odd) == 0;
+			}
+
+			continue;
+		}
+
+		power = mpi_root(x, op, (uint32_t)p);
+	}
+
+	mpi_clear(odd);
+	mpi_clear(x);
+	free(exps);
+	free(first);
+	free(qs);
+	free(residues);
+
+	return power;
+}
+
+/*
+ * Primality testing: trial division by the primes below TRIAL_LIMIT, then the
+ * Baillie-PSW test, a strong probable-prime test to base 2 followed by a
+ * strong Lucas test with Selfridge's parameters. There is no known
+ * counterexample, and none below 2^64, where native arithmetic is used.
+ */
+#define TRIAL_LIMIT 1024
+
+/* the odd primes below TRIAL_LIMIT, in groups whose products fit in 32 bits */
+static uint32_t trial_primes[TRIAL_LIMIT / 2];
+static uint32_t trial_products[TRIAL_LIMIT / 2];
+static size_t trial_groups[TRIAL_LIMIT / 2 + 1];
+static size_t trial_groups_count;
+
+static pthread_once_t trial_once = PTHREAD_ONCE_INIT;
+
+static void trial_init(void)
+{
+	size_t count = 0;
+	uint64_t product = 1;
+
+	for (uint32_t p = 3; p < TRIAL_LIMIT; p += 2) {
+		if (!prime_p(p)) {
+			continue;
+		}
+
+		if (product * p > UINT32_MAX) {
+			trial_products[trial_groups_count] = (uint32_t)product;
+			trial_groups[++trial_groups_count] = count;
+			product = 1;
+		}
+
+		trial_primes[count++] = p;
+		product *= p;
+	}
+
+	trial_products[trial_groups_count] = (uint32_t)product;
+	trial_groups[++trial_groups_count] = count;
+}
+
+/* Jacobi symbol (a/n) for odd n */
+static int jacobi_u64(uint64_t a, uint64_t n)
+{
+	int t = 1;
+
+	a %= n;
+
+	while (a != 0) {
+		while ((a & 1) == 0) {
+			a >>= 1;
+
+			if ((n & 7) == 3 || (n & 7) == 5) {
+				t = -t;
+			}
+		}
+
+		uint64_t r = a;
+		a = n;
+		n = r;
+
+		if ((a & 3) == 3 && (n & 3) == 3) {
+			t = -t;
+		}
+
+		a %= n;
+	}
+
+	return n == 1 ? t : 0;
+}
+
+int mpi_jacobi(const mpi_t op1, const mpi_t op2)
+{
+	if (mpi_even_p(op2)) {
+		fprintf(stderr, "Jacobi symbol with an even modulus\n");
+		abort();
+	}
+
+	mpi_t a, n, q;
+	mpi_init(a);
+	mpi_init(n);
+	mpi_init(q);
+
+	mpi_set(n, op2);
+	mpi_fdiv_qr(q, a, op1, n);
+
+	int t = 1;
+
+	/* Euclid with reciprocity, native once both fit */
+	for (;;) {
+		if (mpi_sizeinbase(n, 2) <= 64) {
+			t *= jacobi_u64(mpi_get_u64(a), mpi_get_u64(n));
+			break;
+		}
+
+		if (mpi_cmp_u32(a, 0) == 0) {
+			t = 0;
+			break;
+		}
+
+		mp_bitcnt_t z = mpi_scan1(a, 0);
+		uint32_t n8 = n->data[0] & 7;
+
+		mpi_fdiv_q_2exp(a, a, z);
+
+		if ((z & 1) && (n8 == 3 || n8 == 5)) {
+			t = -t;
+		}
+
+		mpi_swap(a, n);
+
+		if ((a->data[0] & 3) == 3 && (n->data[0] & 3) == 3) {
+			t = -t;
+		}
+
+		mpi_fdiv_qr(q, a, a, n);
+	}
+
+	mpi_clear(a);
+	mpi_clear(n);
+	mpi_clear(q);
+
+	return t;
+}
+
+/* Montgomery arithmetic modulo odd n < 2^64, R = 2^64 */
+
+static uint64_t mont64_inv(uint64_t n)
+{
+	uint64_t x = n;
+
+	for (int i = 0; i < 5; ++i) {
+		x *= 2 - n * x;
+	}
+
+	return x;
+}
+
+/* a b / R mod n, with n_inv = n^-1 mod R; (a b - m n) / R never overflows */
+static uint64_t mont64_mul(uint64_t a, uint64_t b, uint64_t n, uint64_t n_inv)
+{
+	uint128_t t = (uint128_t)a * b;
+	uint64_t m = (uint64_t)t * n_inv;
+	uint64_t th = (uint64_t)(t >> 64);
+	uint64_t mh = (uint64_t)(((uint128_t)m * n) >> 64);
+
+	return th >= mh ? th - mh : th - mh + n;
+}
+
+static uint64_t mont64_add(uint64_t a, uint64_t b, uint64_t n)
+{
+	uint64_t s = a + b;
+
+	return s < a || s >= n ? s - n : s;
+}
+
+static uint64_t mont64_sub(uint64_t a, uint64_t b, uint64_t n)
+{
+	return a >= b ? a - b : a - b + n;
+}
+
+/* a / 2 mod n */
+static uint64_t mont64_half(uint64_t a, uint64_t n)
+{
+	return (a & 1) ? (a >> 1) + (n >> 1) + 1 : a >> 1;
+}
+
+/* strong probable prime to base 2, n odd */
+static int sprp2_u64(uint64_t n)
+{
+	uint64_t n_inv = mont64_inv(n);
+	uint64_t one = (uint64_t)(0 - n) % n;
+	uint64_t minus_one = n - one;
+	int s = __builtin_ctzll(n - 1);
+	uint64_t d = (n - 1) >> s;
+	uint64_t x = one;
+
+	for (int b = 63 - __builtin_clzll(d); b >= 0; --b) {
+		x = mont64_mul(x, x, n, n_inv);
+
+		if ((d >> b) & 1) {
+			x = mont64_add(x, x, n);
+		}
+	}
+
+	if (x == one || x == minus_one) {
+		return 1;
+	}
+
+	for (int r = 1; r < s; ++r) {
+		x = mont64_mul(x, x, n, n_inv);
+
+		if (x == minus_one) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* D = 5, -7, 9, -11, ... with (D/n) = -1, or 0 if n has a factor in common with one */
+static int64_t selfridge_u64(uint64_t n)
+{
+	for (int64_t d = 5;; d = d > 0 ? -d - 2 : -d + 2) {
+		uint64_t a = d > 0 ? (uint64_t)d % n : n - (uint64_t)-d % n;
+		int j = jacobi_u64(a, n);
+
+		if (j == -1) {
+			return d;
+		}
+
+		if (j == 0 && (uint64_t)(d > 0 ? d : -d) != n) {
+			return 0;
+		}
+	}
+}
+
+/* signed small value in Montgomery form */
+static uint64_t mont64_set(int64_t v, uint64_t n)
+{
+	uint64_t a = v >= 0 ? (uint64_t)v % n : n - (uint64_t)-v % n;
+
+	return (uint64_t)(((uint128_t)a << 64) % n);
+}
+
+/* strong Lucas probable prime with P = 1, Q = (1 - D) / 4, n odd and not a square */
+static int lucas_u64(uint64_t n)
+{
+	int64_t d = selfridge_u64(n);
+
+	if (d == 0) {
+		return 0;
+	}
+
+	uint64_t n_inv = mont64_inv(n);
+	uint64_t dm = mont64_set(d, n), q = mont64_set((1 - d) / 4, n);
+	/* n + 1 = k 2^s, n + 1 does not overflow as 2^64 - 1 = 3 5 ... */
+	int s = __builtin_ctzll(n + 1);
+	uint64_t k = (n + 1) >> s;
+
+	/* U_1 = 1, V_1 = P = 1 */
+	uint64_t u = mont64_set(1, n), v = u, qk = q;
+
+	for (int b = 62 - __builtin_clzll(k); b >= 0; --b) {
+		/* U_2j = U_j V_j, V_2j = V_j^2 - 2 Q^j */
+		u = mont64_mul(u, v, n, n_inv);
+		v = mont64_sub(mont64_mul(v, v, n, n_inv), mont64_add(qk, qk, n), n);
+		qk = mont64_mul(qk, qk, n, n_inv);
+
+		if ((k >> b) & 1) {
+			/* U_j+1 = (P U_j + V_j) / 2, V_j+1 = (D U_j + P V_j) / 2 */
+			uint64_t t = mont64_add(u, v, n);
+
+			v = mont64_half(mont64_add(mont64_mul(dm, u, n, n_inv), v, n), n);
+			u = mont64_half(t, n);
+			qk = mont64_mul(qk, q, n, n_inv);
+		}
+	}
+
+	if (u == 0 || v == 0) {
+		return 1;
+	}
+
+	for (int r = 1; r < s; ++r) {
+		v = mont64_sub(mont64_mul(v, v, n, n_inv), mont64_add(qk, qk, n), n);
+		qk = mont64_mul(qk, qk, n, n_inv);
+
+		if (v == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Montgomery arithmetic modulo odd n, R = 2^(31 nmemb). The reduction runs
+ * limb by limb, or from MUL_NTT_THRESHOLD limbs on by two multiplications,
+ * which is then cheaper than the quadratic loop.
+ */
+struct mont {
+	mpi_t n;
+	/* -n^-1 mod R, for the reduction by multiplications */
+	mpi_t n_inv;
+	/* -n^-1 mod 2^31 */
+	uint32_t n_inv0;
+	mp_bitcnt_t bits;
+	mpi_t t, m;
+};
+
+static void mont_init(struct mont *mont, const mpi_t n)
+{
+	mpi_init(mont->n);
+	mpi_init(mont->n_inv);
+	mpi_init(mont->t);
+	mpi_init(mont->m);
+
+	mpi_set(mont->n, n);
+	mpi_compact(mont->n);
+	mont->bits = 31 * mont->n->nmemb;
+
+	/* n^-1 mod 2^31, then Newton x = x (2 - n x) doubling the precision */
+	uint32_t n0 = n->data[0], x0 = n0;
+
+	for (int i = 0; i < 5; ++i) {
+		x0 *= 2 - n0 * x0;
+	}
+
+	mont->n_inv0 = (0 - x0) & 0x7fffffff;
+
+	if (mont->n->nmemb < param(PARAM_MUL_NTT)) {
+		return;
+	}
+
+	mpi_set_u32(mont->n_inv, x0 & 0x7fffffff);
+
+	for (mp_bitcnt_t k = 31; k < mont->bits;) {
+		k = 2 * k < mont->bits ? 2 * k : mont->bits;
+
+		mpi_mul(mont->t, n, mont->n_inv);
+		mpi_fdiv_r_2exp(mont->t, mont->t, k);
+		mpi_set_u32(mont->m, 1);
+		mpi_mul_2exp(mont->m, mont->m, k);
+		mpi_add_u32(mont->m, mont->m, 2);
+		mpi_sub(mont->m, mont->m, mont->t);
+		mpi_mul(mont->n_inv, mont->n_inv, mont->m);
+		mpi_fdiv_r_2exp(mont->n_inv, mont->n_inv, k);
+	}
+
+	mpi_set_u32(mont->m, 1);
+	mpi_mul_2exp(mont->m, mont->m, mont->bits);
+	mpi_sub(mont->n_inv, mont->m, mont->n_inv);
+}
+
+static void mont_clear(struct mont *mont)
+{
+	mpi_clear(mont->n);
+	mpi_clear(mont->n_inv);
+	mpi_clear(mont->t);
+	mpi_clear(mont->m);
+}
+
+/* rop = t / R mod n for t < n R, t is destroyed */
+static void mont_redc(struct mont *mont, mpi_t rop, mpi_t t)
+{
+	size_t s = mont->n->nmemb;
+
+	if (s < param(PARAM_MUL_NTT)) {
+		/* add multiples of n clearing the low limbs one at a time */
+		mpi_enlarge(t, 2 * s + 1);
+
+		uint32_t *a = t->data;
+		const uint32_t *n = mont->n->data;
+
+		for (size_t i = 0; i < s; ++i) {
+			uint32_t m = (a[i] * mont->n_inv0) & 0x7fffffff;
+			uint64_t c = 0;
+
+			for (size_t j = 0; j < s; ++j) {
+				c += (uint64_t)a[i + j] + (uint64_t)m * n[j];
+				a[i + j] = c & 0x7fffffff;
+				c >>= 31;
+			}
+
+			for (size_t k = i + s; c != 0; ++k) {
+				c += a[k];
+				a[k] = c & 0x7fffffff;
+				c >>= 31;
+			}
+		}
+	} else {
+		mpi_fdiv_r_2exp(mont->m, t, mont->bits);
+		mpi_mul(mont->m, mont->m, mont->n_inv);
+		mpi_fdiv_r_2exp(mont->m, mont->m, mont->bits);
+		mpi_mul(mont->m, mont->m, mont->n);
+		mpi_add(t, t, mont->m);
+	}
+
+	mpi_fdiv_q_2exp(rop, t, mont->bits);
+
+	if (mpi_cmp(rop, mont->n) >= 0) {
+		mpi_sub(rop, rop, mont->n);
+	}
+}
+
+static void mont_mul(struct mont *mont, mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	if (op1 == op2) {
+		mpi_sqr(mont->t, op1);
+	} else {
+		mpi_mul(mont->t, op1, op2);
+	}
+
+	mont_redc(mont, rop, mont->t);
+}
+
+/* op R mod n */
+static void mont_set(struct mont *mont, mpi_t rop, const mpi_t op)
+{
+	mpi_mul_2exp(mont->t, op, mont->bits);
+	mpi_fdiv_qr(mont->m, rop, mont->t, mont->n);
+}
+
+static void mont_set_s32(struct mont *mont, mpi_t rop, int32_t v)
+{
+	uint32_t a = v >= 0 ? (uint32_t)v : (uint32_t)-(int64_t)v;
+
+	mpi_set_u32(mont->m, a);
+	mont_set(mont, rop, mont->m);
+
+	if (v < 0 && mpi_cmp_u32(rop, 0) != 0) {
+		mpi_sub(rop, mont->n, rop);
+	}
+}
+
+static void mont_add(struct mont *mont, mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	mpi_add(rop, op1, op2);
+
+	if (mpi_cmp(rop, mont->n) >= 0) {
+		mpi_sub(rop, rop, mont->n);
+	}
+}
+
+static void mont_sub(struct mont *mont, mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	if (mpi_cmp(op1, op2) >= 0) {
+		mpi_sub(rop, op1, op2);
+	} else {
+		mpi_add(mont->m, op1, mont->n);
+		mpi_sub(rop, mont->m, op2);
+	}
+}
+
+static void mont_half(struct mont *mont, mpi_t rop, const mpi_t op)
+{
+	if (mpi_odd_p(op)) {
+		mpi_add(rop, op, mont->n);
+		mpi_fdiv_q_2exp(rop, rop, 1);
+	} else {
+		mpi_fdiv_q_2exp(rop, op, 1);
+	}
+}
+
+/* strong probable prime to base b, n odd */
+static int sprp(struct mont *mont, uint32_t b)
+{
+	mpi_t d, x, one, minus_one, base;
+	mpi_init(d);
+	mpi_init(x);
+	mpi_init(one);
+	mpi_init(minus_one);
+	mpi_init(base);
+
+	mpi_sub_u32(d, mont->n, 1);
+	mp_bitcnt_t s = mpi_scan1(d, 0);
+	mpi_fdiv_q_2exp(d, d, s);
+
+	mont_set_s32(mont, one, 1);
+	mpi_sub(minus_one, mont->n, one);
+	mont_set_s32(mont, base, (int32_t)b);
+	mpi_set(x, one);
+
+	for (mp_bitcnt_t i = mpi_sizeinbase(d, 2) - 1; i != (mp_bitcnt_t)-1; --i) {
+		mont_mul(mont, x, x, x);
+
+		if (mpi_tstbit(d, i)) {
+			if (b == 2) {
+				mont_add(mont, x, x, x);
+			} else {
+				mont_mul(mont, x, x, base);
+			}
+		}
+	}
+
+	int ret = mpi_cmp(x, one) == 0 || mpi_cmp(x, minus_one) == 0;
+
+	for (mp_bitcnt_t r = 1; r < s && !ret; ++r) {
+		mont_mul(mont, x, x, x);
+		ret = mpi_cmp(x, minus_one) == 0;
+	}
+
+	mpi_clear(d);
+	mpi_clear(x);
+	mpi_clear(one);
+	mpi_clear(minus_one);
+	mpi_clear(base);
+
+	return ret;
+}
+
+/* V = V^2 - 2 Q^k, Q^k = Q^2k */
+static void lucas_double_v(struct mont *mont, mpi_t v, mpi_t qk, mpi_t t)
+{
+	mont_mul(mont, v, v, v);
+	mont_add(mont, t, qk, qk);
+	mont_sub(mont, v, v, t);
+	mont_mul(mont, qk, qk, qk);
+}
+
+/* strong Lucas probable prime with P = 1, Q = (1 - D) / 4, n odd and not a square */
+static int lucas(struct mont *mont)
+{
+	mpi_t k, u, v, qk, q, dm, t, a;
+	mpi_init(k);
+	mpi_init(u);
+	mpi_init(v);
+	mpi_init(qk);
+	mpi_init(q);
+	mpi_init(dm);
+	mpi_init(t);
+	mpi_init(a);
+
+	int32_t d = 5;
+
+	for (;; d = d > 0 ? -d - 2 : -d + 2) {
+		mpi_set_u32(a, (uint32_t)(d > 0 ? d : -d));
+
+		int j = mpi_jacobi(a, mont->n);
+
+		if (d < 0 && (mont->n->data[0] & 3) == 3) {
+			/* (-1/n) */
+			j = -j;
+		}
+
+		if (j == -1) {
+			break;
+		}
+
+		if (j == 0) {
+			/* n is larger than any D tried */
+			d = 0;
+			break;
+		}
+	}
+
+	int ret = 0;
+
+	if (d != 0) {
+		mont_set_s32(mont, dm, d);
+		mont_set_s32(mont, q, (1 - d) / 4);
+
+		mpi_add_u32(k, mont->n, 1);
+		mp_bitcnt_t s = mpi_scan1(k, 0);
+		mpi_fdiv_q_2exp(k, k, s);
+
+		mont_set_s32(mont, u, 1);
+		mpi_set(v, u);
+		mpi_set(qk, q);
+
+		for (mp_bitcnt_t i = mpi_sizeinbase(k, 2) - 2; i != (mp_bitcnt_t)-1; --i) {
+			mont_mul(mont, u, u, v);
+			lucas_double_v(mont, v, qk, t);
+
+			if (mpi_tstbit(k, i)) {
+				mont_add(mont, t, u, v);
+				mont_mul(mont, a, dm, u);
+				mont_add(mont, v, a, v);
+				mont_half(mont, v, v);
+				mont_half(mont, u, t);
+				mont_mul(mont, qk, qk, q);
+			}
+		}
+
+		ret = mpi_cmp_u32(u, 0) == 0 || mpi_cmp_u32(v, 0) == 0;
+
+		for (mp_bitcnt_t r = 1; r < s && !ret; ++r) {
+			lucas_double_v(mont, v, qk, t);
+			ret = mpi_cmp_u32(v, 0) == 0;
+		}
+	}
+
+	mpi_clear(k);
+	mpi_clear(u);
+	mpi_clear(v);
+	mpi_clear(qk);
+	mpi_clear(q);
+	mpi_clear(dm);
+	mpi_clear(t);
+	mpi_clear(a);
+
+	return ret;
+}
+
+/* BPSW for odd n < 2^64, which is exact there */
+static int probab_prime_u64(const mpi_t n)
+{
+	uint64_t v = mpi_get_u64(n);
+
+	for (size_t i = 0; i < 16; ++i) {
+		if (v % trial_primes[i] == 0) {
+			return v == trial_primes[i] ? 2 : 0;
+		}
+	}
+
+	return sprp2_u64(v) && !mpi_perfect_square_p(n) && lucas_u64(v) ? 2 : 0;
+}
+
+/* whether n has a factor below TRIAL_LIMIT, one pass per group of primes */
+static int trial_divisible(const mpi_t n)
+{
+	for (size_t g = 0; g < trial_groups_count; ++g) {
+		uint32_t r = mpz_fdiv_u32(n, trial_products[g]);
+
+		for (size_t i = trial_groups[g]; i < trial_groups[g + 1]; ++i) {
+			if (r % trial_primes[i] == 0) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * 2 if n is prime, 1 if it is probably prime, 0 if it is composite. Besides
+ * BPSW, reps - 24 Miller-Rabin rounds to further bases are run, following
+ * GMP's convention for reps.
+ */
+int mpi_probab_prime_p(const mpi_t n, int reps)
+{
+	pthread_once(&trial_once, trial_init);
+
+	if (mpi_cmp_u32(n, 2) <= 0) {
+		return mpi_cmp_u32(n, 2) == 0 ? 2 : 0;
+	}
+
+	if (mpi_even_p(n)) {
+		return 0;
+	}
+
+	if (mpi_sizeinbase(n, 2) <= 64) {
+		return probab_prime_u64(n);
+	}
+
+	if (trial_divisible(n)) {
+		return 0;
+	}
+
+	STATS_BEGIN(STATS_PROBAB_PRIME, n->nmemb);
+
+	struct mont mont;
+	mont_init(&mont, n);
+
+	int ret = sprp(&mont, 2) && !mpi_perfect_square_p(n) && lucas(&mont);
+
+	/* the extra bases are the odd primes in turn, as many as reps asks for */
+	mp_bitcnt_t base = 2;
+
+	for (int i = 0; ret && i < reps - 24; ++i) {
+		do {
+			base++;
+		} while (!prime_p(base));
+
+		ret = sprp(&mont, (uint32_t)base);
+	}
+
+	mont_clear(&mont);
+
+	STATS_END(STATS_PROBAB_PRIME);
+
+	return ret;
+}
+
+/*
+ * Formatted output. Characters go either to a stream or into a buffer of the
+ * given size; whatever does not fit into the buffer is only counted.
+ */
+
+struct out {
+	FILE *stream;
+	char *buf;
+	/* size of buf including the terminating zero */
+	size_t size;
+	/* characters produced so far */
+	size_t len;
+	int error;
+};
+
+/* characters that can still be stored */
+static size_t out_room(const struct out *out)
+{
+	if (out->stream != NULL) {
+		return SIZE_MAX;
+	}
+
+	return out->len + 1 < out->size ? out->size - 1 - out->len : 0;
+}
+
+static void out_write(struct out *out, const char *str, size_t len)
+{
+	if (out->stream != NULL) {
+		if (fwrite(str, 1, len, out->stream) != len) {
+			out->error = 1;
+		}
+	} else {
+		size_t room = out_room(out);
+
+		if (room > 0) {
+			memcpy(out->buf + out->len, str, len < room ? len : room);
+		}
+	}
+
+	out->len += len;
+}
+
+static void out_fill(struct out *out, char c, size_t len)
+{
+	char chunk[64];
+
+	memset(chunk, c, sizeof(chunk));
+
+	while (len > 0) {
+		size_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+
+		out_write(out, chunk, n);
+		len -= n;
+	}
+}
+
+/* number of decimal digits of op > 0 */
+static size_t digits10(const mpi_t op)
+{
+	size_t bits = mpi_sizeinbase(op, 2);
+	/* 10^d <= 2^(bits-1) <= op */
+	size_t d = (size_t)((double)(bits - 1) * 0.30102999566398119521 * (1 - 1e-15));
+
+	mpi_t p;
+	mpi_init(p);
+
+	mpi_ui_pow_u32(p, 10, (uint32_t)(d + 1));
+
+	while (mpi_cmp(op, p) >= 0) {
+		mpi_mul_u32(p, p, 10);
+		d++;
+	}
+
+	mpi_clear(p);
+
+	return d + 1;
+}
+
+/*
+ * Write op < 10^digits as exactly that many digits, most significant first,
+ * splitting off the low 10^(2^k) like set_str_rec() does.
+ */
+static void out_digits(struct out *out, const mpi_t op, size_t digits)
+{
+	if (out_room(out) == 0) {
+		out->len += digits;
+		return;
+	}
+
+	if (digits <= param(PARAM_GET_STR)) {
+		char *chunk = malloc(digits);
+
+		if (chunk == NULL) {
+			abort();
+		}
+
+		mpi_t n, r;
+		mpi_init(n);
+		mpi_init(r);
+		mpi_set(n, op);
+
+		for (size_t i = digits; i > 0; ) {
+			uint32_t word = mpi_fdiv_qr_u32(n, r, n, 1000000000);
+
+			for (int j = 0; j < 9 && i > 0; ++j) {
+				chunk[--i] = (char)('0' + word % 10);
+				word /= 10;
+			}
+		}
+
+		out_write(out, chunk, digits);
+
+		free(chunk);
+		mpi_clear(n);
+		mpi_clear(r);
+
+		return;
+	}
+
+	unsigned k = 0;
+
+	while (((size_t)2 << k) < digits) {
+		k++;
+	}
+
+	size_t low = (size_t)1 << k;
+
+	mpi_t q, r, p;
+	mpi_init(q);
+	mpi_init(r);
+	mpi_init(p);
+
+	mpi_fdiv_qr(q, r, op, mpi_pow_cache(p, 10, k));
+	mpi_clear(p);
+
+	out_digits(out, q, digits - low);
+	out_digits(out, r, low);
+
+	mpi_clear(q);
+	mpi_clear(r);
+}
+
+struct out_spec {
+	int left;
+	int zero;
+	int plus;
+	int space;
+	int alt;
+	size_t width;
+	/* -1 if none */
+	int precision;
+};
+
+static void out_mpi(struct out *out, const mpi_t op, const struct out_spec *spec)
+{
+	int is_zero = mpi_cmp_u32(op, 0) == 0;
+	size_t digits = is_zero ? (spec->precision == 0 ? 0 : 1) : digits10(op);
+	size_t sign = spec->plus || spec->space;
+	size_t zeros = spec->precision > 0 && (size_t)spec->precision > digits ? (size_t)spec->precision - digits : 0;
+
+	if (spec->zero && !spec->left && spec->precision < 0 && spec->width > sign + digits) {
+		zeros = spec->width - sign - digits;
+	}
+
+	size_t total = sign + zeros + digits;
+	size_t pad = spec->width > total ? spec->width - total : 0;
+
+	if (!spec->left) {
+		out_fill(out, ' ', pad);
+	}
+
+	if (sign) {
+		out_write(out, spec->plus ? "+" : " ", 1);
+	}
+
+	out_fill(out, '0', zeros);
+
+	if (digits > 0 && out_room(out) == 0) {
+		/* only counting */
+		out->len += digits;
+	} else if (digits > 0) {
+		STATS_BEGIN(STATS_GET_STR, op->nmemb);
+
+		out_digits(out, op, digits);
+
+		STATS_END(STATS_GET_STR);
+	}
+
+	if (spec->left) {
+		out_fill(out, ' ', pad);
+	}
+}
+
+/* a conversion of the C library, its argument being the next one in ap */
+static void out_native(struct out *out, const struct out_spec *spec, const char *length, int conv, va_list ap)
+{
+	char format[64], chunk[256];
+	int f = snprintf(format, sizeof(format), "%%%s%s%s%s%s",
+		spec->left ? "-" : "", spec->zero ? "0" : "", spec->plus ? "+" : "", spec->space ? " " : "", spec->alt ? "#" : "");
+
+	if (spec->width > 0) {
+		f += snprintf(format + f, sizeof(format) - (size_t)f, "%zu", spec->width);
+	}
+
+	if (spec->precision >= 0) {
+		f += snprintf(format + f, sizeof(format) - (size_t)f, ".%d", spec->precision);
+	}
+
+	snprintf(format + f, sizeof(format) - (size_t)f, "%s%c", length, conv);
+
+	va_list aq;
+	va_copy(aq, ap);
+	int len = vsnprintf(chunk, sizeof(chunk), format, aq);
+	va_end(aq);
+
+	if (len < 0) {
+		out->error = 1;
+		return;
+	}
+
+	if ((size_t)len < sizeof(chunk)) {
+		out_write(out, chunk, (size_t)len);
+		return;
+	}
+
+	char *str = malloc((size_t)len + 1);
+
+	if (str == NULL) {
+		abort();
+	}
+
+	va_copy(aq, ap);
+	vsnprintf(str, (size_t)len + 1, format, aq);
+	va_end(aq);
+
+	out_write(out, str, (size_t)len);
+
+	free(str);
+}
+
+static void out_format(struct out *out, const char *fmt, va_list ap)
+{
+	while (*fmt != 0) {
+		const char *pct = strchr(fmt, '%');
+
+		if (pct == NULL) {
+			out_write(out, fmt, strlen(fmt));
+			break;
+		}
+
+		out_write(out, fmt, (size_t)(pct - fmt));
+		fmt = pct + 1;
+
+		/* %[flags][width][.precision][Z|l]conversion */
+		struct out_spec spec = { 0, 0, 0, 0, 0, 0, -1 };
+
+		for (;; ++fmt) {
+			if (*fmt == '-') {
+				spec.left = 1;
+			} else if (*fmt == '0') {
+				spec.zero = 1;
+			} else if (*fmt == '+') {
+				spec.plus = 1;
+			} else if (*fmt == ' ') {
+				spec.space = 1;
+			} else if (*fmt == '#') {
+				spec.alt = 1;
+			} else {
+				break;
+			}
+		}
+
+		if (*fmt == '*') {
+			int width = va_arg(ap, int);
+
+			if (width < 0) {
+				spec.left = 1;
+				width = -width;
+			}
+
+			spec.width = (size_t)width;
+			fmt++;
+		} else {
+			for (; *fmt >= '0' && *fmt <= '9'; ++fmt) {
+				spec.width = spec.width * 10 + (size_t)(*fmt - '0');
+			}
+		}
+
+		if (*fmt == '.') {
+			fmt++;
+			spec.precision = 0;
+
+			if (*fmt == '*') {
+				spec.precision = va_arg(ap, int);
+				spec.precision = spec.precision < 0 ? -1 : spec.precision;
+				fmt++;
+			} else {
+				for (; *fmt >= '0' && *fmt <= '9'; ++fmt) {
+					spec.precision = spec.precision * 10 + (*fmt - '0');
+				}
+			}
+		}
+
+		/* Z, or the length modifier of a C conversion */
+		char length[3] = { 0, 0, 0 };
+
+		if (*fmt == 'Z') {
+			length[0] = *fmt++;
+		} else if (*fmt != 0 && strchr("hljztL", *fmt) != NULL) {
+			length[0] = *fmt++;
+
+			if ((length[0] == 'h' || length[0] == 'l') && *fmt == length[0]) {
+				length[1] = *fmt++;
+			}
+		}
+
+		if (*fmt == 0) {
+			fprintf(stderr, "Incomplete conversion at the end of the format\n");
+			abort();
+		}
+
+		int conv = *fmt++;
+		int ll = length[0] == 'l' && length[1] == 'l';
+		int hh = length[0] == 'h' && length[1] == 'h';
+
+		if (conv == '%') {
+			out_write(out, "%", 1);
+		} else if (length[0] == 'Z') {
+			if (conv != 'd' && conv != 'i' && conv != 'u') {
+				fprintf(stderr, "Unsupported conversion %%Z%c\n", conv);
+				abort();
+			}
+
+			out_mpi(out, va_arg(ap, const struct mpi *), &spec);
+		} else if (conv == 'n') {
+			/* the count of the whole output, which vsnprintf() does not know */
+			if (hh) {
+				*va_arg(ap, signed char *) = (signed char)out->len;
+			} else if (ll) {
+				*va_arg(ap, long long int *) = (long long int)out->len;
+			} else if (length[0] == 'h') {
+				*va_arg(ap, short int *) = (short int)out->len;
+			} else if (length[0] == 'l') {
+				*va_arg(ap, long int *) = (long int)out->len;
+			} else if (length[0] == 'j') {
+				*va_arg(ap, intmax_t *) = (intmax_t)out->len;
+			} else if (length[0] == 'z') {
+				*va_arg(ap, size_t *) = out->len;
+			} else if (length[0] == 't') {
+				*va_arg(ap, ptrdiff_t *) = (ptrdiff_t)out->len;
+			} else {
+				*va_arg(ap, int *) = (int)out->len;
+			}
+		} else if (strchr("dic", conv) != NULL) {
+			out_native(out, &spec, length, conv, ap);
+
+			/* h and hh arguments are promoted to int */
+			if (conv == 'c' && length[0] == 'l') {
+				(void)va_arg(ap, wint_t);
+			} else if (ll) {
+				(void)va_arg(ap, long long int);
+			} else if (length[0] == 'l') {
+				(void)va_arg(ap, long int);
+			} else if (length[0] == 'j') {
+				(void)va_arg(ap, intmax_t);
+			} else if (length[0] == 'z') {
+				(void)va_arg(ap, size_t);
+			} else if (length[0] == 't') {
+				(void)va_arg(ap, ptrdiff_t);
+			} else {
+				(void)va_arg(ap, int);
+			}
+		} else if (strchr("ouxX", conv) != NULL) {
+			out_native(out, &spec, length, conv, ap);
+
+			if (ll) {
+				(void)va_arg(ap, unsigned long long int);
+			} else if (length[0] == 'l') {
+				(void)va_arg(ap, unsigned long int);
+			} else if (length[0] == 'j') {
+				(void)va_arg(ap, uintmax_t);
+			} else if (length[0] == 'z') {
+				(void)va_arg(ap, size_t);
+			} else if (length[0] == 't') {
+				(void)va_arg(ap, ptrdiff_t);
+			} else {
+				(void)va_arg(ap, unsigned);
+			}
+		} else if (strchr("fFeEgGaA", conv) != NULL) {
+			out_native(out, &spec, length, conv, ap);
+
+			if (length[0] == 'L') {
+				(void)va_arg(ap, long double);
+			} else {
+				(void)va_arg(ap, double);
+			}
+		} else if (conv == 's') {
+			out_native(out, &spec, length, conv, ap);
+
+			if (length[0] == 'l') {
+				(void)va_arg(ap, const wchar_t *);
+			} else {
+				(void)va_arg(ap, const char *);
+			}
+		} else if (conv == 'p') {
+			out_native(out, &spec, length, conv, ap);
+			(void)va_arg(ap, void *);
+		} else {
+			fprintf(stderr, "Unsupported conversion %%%s%c\n", length, conv);
+			abort();
+		}
+	}
+}
+
+static int out_result(const struct out *out)
 {
-	size_t nmemb = op1->nmemb + op2->nmemb;
+	if (out->error || out->len > INT_MAX) {
+		return -1;
+	}
 
-	mpi_t tmp;
+	return (int)out->len;
+}
 
-	mpi_init(tmp);
+char *mpi_to_cstr(const mpi_t op, int base)
+{
+	assert(base == 10);
 
-	mpi_enlarge(tmp, nmemb);
+	size_t digits = mpi_cmp_u32(op, 0) == 0 ? 1 : digits10(op);
+	struct out out = { NULL, malloc(digits + 1), digits + 1, 0, 0 };
 
-	for (size_t n = 0; n < tmp->nmemb; ++n) {
-		tmp->data[n] = 0;
+	if (out.buf == NULL) {
+		abort();
 	}
 
-	for (size_t n = 0; n < op1->nmemb; ++n) {
-		for (size_t m = 0; m < op2->nmemb; ++m) {
-			uint64_t r = (uint64_t)op1->data[n] * op2->data[m];
-			uint64_t c = 0;
-			for (size_t k = m + n; c != 0 || r != 0; ++k) {
-				if (k >= tmp->nmemb) {
-					mpi_enlarge(tmp, tmp->nmemb + 1);
-				}
-				tmp->data[k] += (r & 0x7fffffff) + c;
-				r >>= 31;
-				c = tmp->data[k] >> 31;
-				tmp->data[k] &= 0x7fffffff;
-			}
-		}
-	}
+	STATS_BEGIN(STATS_GET_STR, op->nmemb);
 
-	mpi_set(rop, tmp);
+	out_digits(&out, op, digits);
+	out.buf[digits] = 0;
 
-	mpi_compact(rop);
+	STATS_END(STATS_GET_STR);
 
-	mpi_clear(tmp);
+	return out.buf;
 }
 
-void mpi_mul_karatsuba(mpi_t rop, const mpi_t op1, const mpi_t op2)
+size_t mpi_out_str(FILE *stream, int base, const mpi_t op)
 {
-	/* end recursion */
-	if (op1->nmemb < 32 || op2->nmemb < 32) {
-		mpi_mul_naive(rop, op1, op2);
-		return;
+	struct out out = { stream, NULL, 0, 0, 0 };
+	struct out_spec spec = { 0, 0, 0, 0, 0, 0, -1 };
+
+	assert(base == 10);
+
+	out_mpi(&out, op, &spec);
+
+	return out.error ? 0 : out.len;
+}
+
+/* mpi_inp_str() parses 2^INP_STR_LOG_CHUNK digits at a time */
+#define INP_STR_LOG_CHUNK 16
+
+size_t mpi_inp_str(mpi_t rop, FILE *stream, int base)
+{
+	assert(base == 10);
+
+	size_t read = 0;
+	int c;
+
+	while ((c = getc(stream)) != EOF && isspace(c)) {
+		read++;
 	}
 
-	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+	if (c == EOF || !isdigit(c)) {
+		if (c != EOF) {
+			ungetc(c, stream);
+		}
+		return 0;
+	}
 
-	size_t m = nmemb / 2;
+	const size_t chunk_size = (size_t)1 << INP_STR_LOG_CHUNK;
+	char *chunk = malloc(chunk_size);
 
-	mpi_t x0, x1, y0, y1;
+	if (chunk == NULL) {
+		abort();
+	}
 
-	mpi_init(x0);
-	mpi_init(x1);
-	mpi_init(y0);
-	mpi_init(y1);
+	/*
+	 * Full chunks are combined like a binary counter: the stack holds values
+	 * of 2^(INP_STR_LOG_CHUNK + level) digits, levels strictly decreasing.
+	 */
+	mpi_t stack[64], p;
+	unsigned level[64];
+	size_t depth = 0;
+	size_t len = 0;
 
-	/* x = op1 */
-	/* y = op2 */
-	mpi_fdiv_r_2exp(x0, op1, 31 * m);
-	mpi_fdiv_q_2exp(x1, op1, 31 * m);
-	mpi_fdiv_r_2exp(y0, op2, 31 * m);
-	mpi_fdiv_q_2exp(y1, op2, 31 * m);
+	mpi_init(p);
 
-	mpi_t z0, z1, z2;
+	for (; c != EOF && isdigit(c); c = getc(stream)) {
+		chunk[len++] = (char)c;
+		read++;
 
-	mpi_init(z0);
-	mpi_init(z1);
-	mpi_init(z2);
+		if (len < chunk_size) {
+			continue;
+		}
 
-	mpi_mul_karatsuba(z2, x1, y1);
-	mpi_mul_karatsuba(z0, x0, y0);
+		assert(depth < 64);
 
-	mpi_t w0, w1;
+		mpi_init(stack[depth]);
+		set_str_rec(stack[depth], chunk, len);
+		level[depth] = 0;
+		depth++;
+		len = 0;
 
-	mpi_init(w0);
-	mpi_init(w1);
+		while (depth >= 2 && level[depth - 1] == level[depth - 2]) {
+			mpi_mul(stack[depth - 2], stack[depth - 2], mpi_pow_cache(p, 10, INP_STR_LOG_CHUNK + level[depth - 1]));
+			mpi_add(stack[depth - 2], stack[depth - 2], stack[depth - 1]);
+			mpi_clear(stack[depth - 1]);
+			depth--;
+			level[depth - 1]++;
+		}
+	}
 
-	mpi_add(w0, x0, x1);
-	mpi_add(w1, y0, y1);
+	if (c != EOF) {
+		ungetc(c, stream);
+	}
 
-	mpi_mul_karatsuba(z1, w0, w1);
-	mpi_sub(z1, z1, z2);
-	mpi_sub(z1, z1, z0);
+	/*
+	 * The digits after the last full chunk, then the stack from the top.
+	 * w = 10^(digits below stack[d]) grows by the cached power of each level.
+	 */
+	mpi_t acc, t, w;
+	mpi_init(acc);
+	mpi_init(t);
+	mpi_init(w);
+
+	set_str_rec(acc, chunk, len);
+	mpi_ui_pow_u32(w, 10, (uint32_t)len);
+
+	for (size_t d = depth - 1; d != (size_t)-1; --d) {
+		mpi_mul(t, w, stack[d]);
+		mpi_add(acc, acc, t);
+		mpi_clear(stack[d]);
+
+		if (d != 0) {
+			mpi_mul(w, w, mpi_pow_cache(p, 10, INP_STR_LOG_CHUNK + level[d]));
+		}
+	}
 
-	mpi_mul_2exp(z2, z2, 31 * 2 * m);
-	mpi_mul_2exp(z1, z1, 31 * m);
+	mpi_compact(acc);
+	mpi_move(rop, acc);
 
-	mpi_add(rop, z0, z1);
-	mpi_add(rop, rop, z2);
+	mpi_clear(acc);
+	mpi_clear(t);
+	mpi_clear(w);
+	mpi_clear(p);
+	free(chunk);
 
-	mpi_clear(w0);
-	mpi_clear(w1);
+	return read;
+}
 
-	mpi_clear(z0);
-	mpi_clear(z1);
-	mpi_clear(z2);
+int gmp_vfprintf(FILE *fp, const char *fmt, va_list ap)
+{
+	struct out out = { fp, NULL, 0, 0, 0 };
 
-	mpi_clear(x0);
-	mpi_clear(x1);
-	mpi_clear(y0);
-	mpi_clear(y1);
+	out_format(&out, fmt, ap);
 
-	mpi_compact(rop);
+	return out_result(&out);
 }
 
-void mpi_mul(mpi_t rop, const mpi_t op1, const mpi_t op2)
+int gmp_fprintf(FILE *fp, const char *fmt, ...)
 {
-	mpi_mul_karatsuba(rop, op1, op2);
+	va_list ap;
+	va_start(ap, fmt);
+
+	int ret = gmp_vfprintf(fp, fmt, ap);
+
+	va_end(ap);
+
+	return ret;
 }
 
-int mpi_cmp(const mpi_t op1, const mpi_t op2)
+int gmp_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap)
 {
-	size_t nmemb = op1->nmemb > op2->nmemb ? op1->nmemb : op2->nmemb;
+	struct out out = { NULL, buf, size, 0, 0 };
 
-	if (nmemb == 0) {
-		return 0;
+	out_format(&out, fmt, ap);
+
+	if (size > 0) {
+		buf[out.len < size - 1 ? out.len : size - 1] = 0;
 	}
 
-	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = (n < op2->nmemb) ? op2->data[n] : 0;
+	return out_result(&out);
+}
 
-		if (r1 < r2) {
-			return -1;
-		}
+int gmp_snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
 
-		if (r1 > r2) {
-			return +1;
-		}
-	}
+	int ret = gmp_vsnprintf(buf, size, fmt, ap);
 
-	return 0;
+	va_end(ap);
+
+	return ret;
 }
 
-int mpi_cmp_u32(const mpi_t op1, uint32_t op2)
+int gmp_vsprintf(char *buf, const char *fmt, va_list ap)
 {
-	size_t nmemb = op1->nmemb;
+	return gmp_vsnprintf(buf, SIZE_MAX, fmt, ap);
+}
 
-	if (nmemb < ceil_div(32, 31)) {
-		nmemb = ceil_div(32, 31);
-	}
+int gmp_sprintf(char *buf, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
 
-	for (size_t n = nmemb - 1; n != (size_t)-1; --n) {
-		uint32_t r1 = (n < op1->nmemb) ? op1->data[n] : 0;
-		uint32_t r2 = 0;
+	int ret = gmp_vsprintf(buf, fmt, ap);
 
-		switch (n) {
-			case 0: r2 = (op2      ) & 0x7fffffff; break;
-			case 1: r2 = (op2 >> 31) & 0x7fffffff; break;
-		}
+	va_end(ap);
 
-		if (r1 < r2) {
-			return -1;
-		}
+	return ret;
+}
 
-		if (r1 > r2) {
-			return +1;
-		}
+int gmp_vasprintf(char **pp, const char *fmt, va_list ap)
+{
+	/* the first pass only counts, without converting any number */
+	struct out out = { NULL, NULL, 0, 0, 0 };
+	va_list aq;
+
+	va_copy(aq, ap);
+	out_format(&out, fmt, aq);
+	va_end(aq);
+
+	if (out_result(&out) < 0) {
+		return -1;
 	}
 
-	return 0;
+	*pp = malloc(out.len + 1);
+
+	if (*pp == NULL) {
+		abort();
+	}
+
+	return gmp_vsnprintf(*pp, out.len + 1, fmt, ap);
 }
 
-int mpi_odd_p(const mpi_t op)
+int gmp_asprintf(char **pp, const char *fmt, ...)
 {
-	if (op->nmemb == 0) {
-		return 0;
+	va_list ap;
+	va_start(ap, fmt);
+
+	int ret = gmp_vasprintf(pp, fmt, ap);
+
+	va_end(ap);
+
+	return ret;
+}
+
+void mpi_gcd(mpi_t rop, const mpi_t op1, const mpi_t op2)
+{
+	STATS_BEGIN(STATS_GCD, op1->nmemb + op2->nmemb);
+
+	mpi_t a, b, q, r;
+	mpi_init(a);
+	mpi_init(b);
+	mpi_init(q);
+	mpi_init(r);
+
+	mpi_set(a, op1);
+	mpi_set(b, op2);
+
+	/* (a, b) := (b, a mod b) */
+	while (mpi_cmp_u32(b, 0) != 0) {
+		mpi_fdiv_qr(q, r, a, b);
+		mpi_swap(a, b);
+		mpi_swap(b, r);
 	}
 
-	return op->data[0] & 1;
+	mpi_set(rop, a);
+
+	mpi_clear(a);
+	mpi_clear(b);
+	mpi_clear(q);
+	mpi_clear(r);
+
+	STATS_END(STATS_GCD);
 }
 
-int mpi_even_p(const mpi_t op)
+/*
+ * Lucas-Lehmer test by irrational-base discrete weighted transform.
+ *
+ * s mod 2^p - 1 is held as n balanced digits x[j] of b[j] = e[j+1] - e[j]
+ * bits, where e[j] = ceil(p j / n). Weighting digit j by 2^(e[j] - p j / n)
+ * turns the cyclic convolution of a double-precision FFT into a squaring
+ * modulo 2^p - 1, without a separate reduction.
+ */
+
+/* largest acceptable distance of a convolution output from an integer */
+#define LLT_MAX_ERROR 0.4
+
+/* the transform is split into this many blocks, and as many columns of them */
+#define LLT_BLOCKS 16
+
+/* transforms from this length on run on mpi_get_num_threads() threads */
+#define LLT_PARALLEL_THRESHOLD 16384
+
+struct llt {
+	mp_bitcnt_t p;
+	size_t n;
+	size_t blocks;
+	int64_t *x;
+	/* digits before the last iteration */
+	int64_t *prev;
+	int *bits;
+	double *weight;
+	double *weight_inv;
+	double complex *a;
+	/* roots of unity exp(-2 pi i k / n) */
+	double complex *w;
+	int64_t *block_carry;
+	/* the largest rounding error of the current iteration */
+	double error;
+	pthread_mutex_t mutex;
+};
+
+static void llt_for(const struct llt *llt, size_t count, void (*func)(void *, size_t, size_t), void *arg)
 {
-	if (op->nmemb == 0) {
-		return 1;
+	if (llt->n >= LLT_PARALLEL_THRESHOLD) {
+		parallel_for(count, func, arg);
+	} else {
+		func(arg, 0, count);
 	}
+}
 
-	return !(op->data[0] & 1);
+static size_t llt_exp(const struct llt *llt, size_t j)
+{
+	return (size_t)(((uint64_t)llt->p * j + llt->n - 1) / llt->n);
 }
 
-uint64_t mpi_get_word_u64(const mpi_t op, size_t n)
+/* the shortest transform whose convolution outputs stay well within the 53-bit mantissa */
+static size_t llt_length(mp_bitcnt_t p)
 {
-	uint64_t r = 0;
+	size_t log2n = 2;
 
-	if (n + 0 < op->nmemb) {
-		r |= (uint64_t)op->data[n + 0];
+	while (2 * ((p + ((size_t)1 << log2n) - 1) >> log2n) + log2n / 2 > 47) {
+		log2n++;
 	}
 
-	if (n + 1 < op->nmemb) {
-		r |= (uint64_t)op->data[n + 1] << 31;
+	return (size_t)1 << log2n;
+}
+
+static void llt_init(struct llt *llt, mp_bitcnt_t p, size_t n)
+{
+	llt->p = p;
+	llt->n = n;
+	llt->blocks = n < LLT_BLOCKS ? n : LLT_BLOCKS;
+	llt->x = mpi_alloc(n * sizeof(int64_t));
+	llt->prev = mpi_alloc(n * sizeof(int64_t));
+	llt->bits = mpi_alloc(n * sizeof(int));
+	llt->weight = mpi_alloc(n * sizeof(double));
+	llt->weight_inv = mpi_alloc(n * sizeof(double));
+	llt->a = mpi_alloc(n * sizeof(double complex));
+	llt->w = mpi_alloc(n / 2 * sizeof(double complex));
+	llt->block_carry = mpi_alloc(llt->blocks * sizeof(int64_t));
+	pthread_mutex_init(&llt->mutex, NULL);
+
+	for (size_t j = 0; j < n; ++j) {
+		size_t e = llt_exp(llt, j);
+		double f = (double)(e * n - (uint64_t)p * j) / (double)n;
+
+		llt->bits[j] = (int)(llt_exp(llt, j + 1) - e);
+		llt->weight[j] = exp2(f);
+		llt->weight_inv[j] = exp2(-f);
 	}
 
-	if (n + 2 < op->nmemb) {
-		r |= (uint64_t)op->data[n + 2] << 62;
+	for (size_t k = 0; k < n / 2; ++k) {
+		double phi = -2 * M_PI * (double)k / (double)n;
+
+		llt->w[k] = cos(phi) + I * sin(phi);
 	}
+}
 
-	return r;
+static void llt_clear(struct llt *llt)
+{
+	free(llt->x);
+	free(llt->prev);
+	free(llt->bits);
+	free(llt->weight);
+	free(llt->weight_inv);
+	free(llt->a);
+	free(llt->w);
+	free(llt->block_carry);
+	pthread_mutex_destroy(&llt->mutex);
 }
 
-void mpi_fdiv_q_2exp(mpi_t q, const mpi_t n, mp_bitcnt_t b)
+/*
+ * The forward transform is decimation in frequency, natural order in and bit
+ * reversed out, and the inverse is decimation in time, the other way round,
+ * so the pointwise squaring needs no permutation. With n = blocks * len, the
+ * stages of half >= len combine the len columns a[c + r len] independently,
+ * and the others stay within the blocks a[b len, (b + 1) len), so each pass
+ * below splits over threads without synchronisation.
+ */
+
+/* a[i], a[j] := a[i] + a[j], (a[i] - a[j]) w, spelled out as complex multiplication would check for infinities */
+static void llt_dif(double complex *a, size_t i, size_t j, double complex w)
 {
-	size_t words = b / 31; /* shift by whole words/limbs */
-	size_t bits = b % 31; /* and shift by bits */
+	double ur = creal(a[i]), ui = cimag(a[i]);
+	double xr = creal(a[j]), xi = cimag(a[j]);
+	double dr = ur - xr, di = ui - xi;
 
-	size_t nmemb = n->nmemb >= words ? n->nmemb - words : 0;
+	a[i] = (ur + xr) + I * (ui + xi);
+	a[j] = (dr * creal(w) - di * cimag(w)) + I * (dr * cimag(w) + di * creal(w));
+}
 
-	mpi_t tmp;
+/* a[i], a[j] := a[i] + a[j] w*, a[i] - a[j] w* for the conjugate w* of w */
+static void llt_dit(double complex *a, size_t i, size_t j, double complex w)
+{
+	double ur = creal(a[i]), ui = cimag(a[i]);
+	double xr = creal(a[j]), xi = cimag(a[j]);
+	double vr = xr * creal(w) + xi * cimag(w);
+	double vi = xi * creal(w) - xr * cimag(w);
 
-	mpi_init(tmp);
+	a[i] = (ur + vr) + I * (ui + vi);
+	a[j] = (ur - vr) + I * (ui - vi);
+}
 
-	mpi_enlarge(tmp, nmemb);
+/* the stages of half >= len on the columns [begin, end), forward or inverse */
+static void llt_fft_columns(const struct llt *llt, size_t begin, size_t end, int inverse)
+{
+	size_t n = llt->n, len = n / llt->blocks;
+
+	for (size_t h = 0; len << h < n; ++h) {
+		size_t half = inverse ? len << h : n >> (h + 1);
+		size_t step = n / (2 * half);
+
+		for (size_t i = 0; i < n; i += 2 * half) {
+			for (size_t k = i; k < i + half; k += len) {
+				for (size_t c = begin; c < end; ++c) {
+					size_t t = ((k - i) + c) * step;
+
+					if (inverse) {
+						llt_dit(llt->a, k + c, k + c + half, llt->w[t]);
+					} else {
+						llt_dif(llt->a, k + c, k + c + half, llt->w[t]);
+					}
+				}
+			}
+		}
+	}
+}
 
-	if (bits == 0) {
-		memcpy(tmp->data, n->data + words, nmemb * sizeof(uint32_t));
-	} else {
-		for (size_t i = 0; i < tmp->nmemb; ++i) {
-			uint32_t r = (uint32_t)((mpi_get_word_u64(n, i + words) >> bits) & 0x7fffffff);
+static int64_t floor_div(int64_t a, int64_t b)
+{
+	return a / b - (a % b < 0);
+}
 
-			tmp->data[i] = r;
-		}
+/* digits [begin, end) to [-2^(b-1), 2^(b-1)) with carry entering at begin; returns the carry out of end */
+static int64_t llt_carry_range(struct llt *llt, size_t begin, size_t end, int64_t carry)
+{
+	int64_t *x = llt->x;
+
+	for (size_t j = begin; j < end; ++j) {
+		int64_t base = (int64_t)1 << llt->bits[j];
+		int64_t v = x[j] + carry;
+
+		carry = floor_div(v + base / 2, base);
+		x[j] = v - carry * base;
 	}
 
-	mpi_set(q, tmp);
+	return carry;
+}
 
-	mpi_clear(tmp);
+static void llt_carry_blocks(void *arg, size_t begin, size_t end)
+{
+	struct llt *llt = arg;
+	size_t len = llt->n / llt->blocks;
+
+	for (size_t b = begin; b < end; ++b) {
+		llt->block_carry[b] = llt_carry_range(llt, b * len, (b + 1) * len, 0);
+	}
 }
 
-void mpi_fdiv_r_2exp(mpi_t r, const mpi_t n, mp_bitcnt_t b)
+/*
+ * Bring all digits back to [-2^(b-1), 2^(b-1)), block by block, then add the
+ * carry out of each block into the next one until it is absorbed, wrapping the
+ * top carry around since 2^p = 1.
+ */
+static void llt_carry(struct llt *llt)
 {
-	size_t words = b / 31; /* shift by whole words/limbs */
-	size_t bits = b % 31; /* and shift by bits */
+	size_t len = llt->n / llt->blocks;
 
-	size_t nmemb = words + 1;
+	llt_for(llt, llt->blocks, llt_carry_blocks, llt);
 
-	mpi_t tmp;
+	for (size_t b = 0; b < llt->blocks; ++b) {
+		int64_t carry = llt->block_carry[b];
 
-	mpi_init(tmp);
+		for (size_t j = (b + 1) * len % llt->n; carry != 0; j = (j + 1) % llt->n) {
+			carry = llt_carry_range(llt, j, j + 1, carry);
+		}
+	}
+}
 
-	mpi_enlarge(tmp, nmemb);
+static void llt_set(struct llt *llt, const mpi_t s)
+{
+	for (size_t j = 0; j < llt->n; ++j) {
+		size_t e = llt_exp(llt, j);
+		int64_t v = 0;
 
-	if (bits == 0) {
-		size_t min = words < n->nmemb ? words : n->nmemb;
-		memcpy(tmp->data, n->data, sizeof(uint32_t) * min);
-		memset(tmp->data + min, 0, sizeof(uint32_t) * (tmp->nmemb - min));
-	} else {
-		for (size_t i = 0; i < words; ++i) {
-			tmp->data[i] = i < n->nmemb ? n->data[i] : 0;
+		for (int t = llt->bits[j] - 1; t >= 0; --t) {
+			v = 2 * v + mpi_tstbit(s, e + t);
 		}
 
-		tmp->data[words] = words < n->nmemb ? n->data[words] & ((UINT32_C(1) << bits) - 1) : 0;
+		llt->x[j] = v;
 	}
 
-	mpi_set(r, tmp);
-
-	mpi_clear(tmp);
-
-	mpi_compact(r);
+	llt_carry(llt);
 }
 
-uint32_t mpi_get_word_lshift_u32(const mpi_t op, size_t n, size_t lshift)
+/* s := s mod m for m = 2^p - 1 */
+static void llt_mod(mpi_t s, const mpi_t m, mp_bitcnt_t p)
 {
-	uint32_t r = 0;
+	mpi_t q;
 
-	assert(lshift < 31);
+	mpi_init(q);
 
-	if (n < op->nmemb + 0) {
-		r |= (op->data[n + 0] << lshift) & 0x7fffffff;
+	while (mpi_cmp(s, m) > 0) {
+		mpi_fdiv_q_2exp(q, s, p);
+		mpi_fdiv_r_2exp(s, s, p);
+		mpi_add(s, s, q);
 	}
 
-	if (n < op->nmemb + 1 && n > 0) {
-		r |= op->data[n - 1] >> (31 - lshift);
+	if (mpi_cmp(s, m) == 0) {
+		mpi_set_u32(s, 0);
 	}
 
-	return r;
+	mpi_compact(s);
+
+	mpi_clear(q);
 }
 
-void mpi_mul_2exp(mpi_t rop, const mpi_t op1, mp_bitcnt_t op2)
+static void llt_get(mpi_t s, const struct llt *llt, const mpi_t m)
 {
-	size_t words = ceil_div(op2, 31);
-	size_t word_shift = op2 / 31;
-	size_t bit_shift = op2 % 31;
+	mpi_t neg;
 
-	size_t nmemb = op1->nmemb + words;
+	mpi_init(neg);
 
-	mpi_t tmp;
+	mpi_set_u32(s, 0);
+	mpi_set_u32(neg, 0);
 
-	mpi_init(tmp);
+	/* the digits of either sign occupy disjoint bit ranges */
+	for (size_t j = 0; j < llt->n; ++j) {
+		size_t e = llt_exp(llt, j);
+		int64_t v = llt->x[j];
+		struct mpi *r = v < 0 ? neg : s;
 
-	mpi_enlarge(tmp, nmemb);
+		if (v < 0) {
+			v = -v;
+		}
 
-	for (size_t i = 0; i < tmp->nmemb; ++i) {
-		tmp->data[i] = i >= word_shift ? mpi_get_word_lshift_u32(op1, i - word_shift, bit_shift) : 0;
+		for (int t = 0; v >> t != 0; ++t) {
+			if ((v >> t) & 1) {
+				mpi_setbit(r, e + t);
+			}
+		}
 	}
 
-	mpi_set(rop, tmp);
+	llt_mod(s, m, llt->p);
+	llt_mod(neg, m, llt->p);
 
-	mpi_clear(tmp);
+	if (mpi_cmp(s, neg) < 0) {
+		mpi_add(s, s, m);
+	}
 
-	mpi_compact(rop);
+	mpi_sub(s, s, neg);
+
+	mpi_clear(neg);
 }
 
-int mpi_get_bit(const mpi_t op, mp_bitcnt_t b)
+/* s := s^2 - c mod m, exactly */
+static void llt_step_exact(mpi_t s, const mpi_t m, mp_bitcnt_t p, uint32_t c)
 {
-	size_t word = b / 31;
-	size_t bit = b % 31;
-
-	int r = 0;
-
-	if (word < op->nmemb) {
-		r = (op->data[word] >> bit) & 1;
-	}
+	mpi_sqr(s, s);
+	mpi_add(s, s, m);
+	mpi_sub_u32(s, s, c);
 
-	return r;
+	llt_mod(s, m, p);
 }
 
-mp_bitcnt_t mpi_scan1(const mpi_t op, mp_bitcnt_t starting_bit)
+/* weight the columns and run their forward stages */
+static void llt_step_weight(void *arg, size_t begin, size_t end)
 {
-	size_t bits = 31 * op->nmemb;
+	struct llt *llt = arg;
+	size_t len = llt->n / llt->blocks;
 
-	for (size_t i = starting_bit; i < bits; ++i) {
-		if (mpi_get_bit(op, i) == 1) {
-			return i;
+	for (size_t r = 0; r < llt->n; r += len) {
+		for (size_t j = r + begin; j < r + end; ++j) {
+			llt->prev[j] = llt->x[j];
+			llt->a[j] = (double)llt->x[j] * llt->weight[j];
 		}
 	}
 
-	return (mp_bitcnt_t)-1;
+	llt_fft_columns(llt, begin, end, 0);
 }
 
-void mpi_ui_pow_u32(mpi_t rop, uint32_t base, uint32_t exp)
+/* the stages within the blocks and the squaring in between */
+static void llt_step_square(void *arg, size_t begin, size_t end)
 {
-	mpi_t b;
+	struct llt *llt = arg;
+	double complex *a = llt->a;
+	size_t n = llt->n, len = n / llt->blocks;
 
-	mpi_init(b);
+	for (size_t b = begin; b < end; ++b) {
+		size_t first = b * len, last = first + len;
+
+		for (size_t half = len / 2; half >= 1; half /= 2) {
+			for (size_t i = first; i < last; i += 2 * half) {
+				for (size_t k = 0; k < half; ++k) {
+					llt_dif(a, i + k, i + k + half, llt->w[k * (n / (2 * half))]);
+				}
+			}
+		}
 
-	mpi_set_u32(b, base);
+		for (size_t j = first; j < last; ++j) {
+			double re = creal(a[j]), im = cimag(a[j]);
 
-	mpi_set_u32(rop, 1);
+			a[j] = (re * re - im * im) + I * (2 * re * im);
+		}
 
-	while (exp != 0) {
-		if (exp & 1) {
-			mpi_mul(rop, rop, b);
+		for (size_t half = 1; half < len; half *= 2) {
+			for (size_t i = first; i < last; i += 2 * half) {
+				for (size_t k = 0; k < half; ++k) {
+					llt_dit(a, i + k, i + k + half, llt->w[k * (n / (2 * half))]);
+				}
+			}
 		}
-		mpi_mul(b, b, b);
-		exp >>= 1;
 	}
-
-	mpi_clear(b);
 }
 
-uint32_t mpz_fdiv_u32(const mpi_t n, uint32_t d)
+/* run the inverse stages of the columns, unweight and round */
+static void llt_step_round(void *arg, size_t begin, size_t end)
 {
-	uint32_t r = 0;
+	struct llt *llt = arg;
+	size_t len = llt->n / llt->blocks;
+	double error = 0;
 
-	for (size_t i = n->nmemb - 1; i != (size_t)-1; --i) {
-		for (int b = 30; b >= 0; --b) {
-			int bit = (n->data[i] >> b) & 1;
+	llt_fft_columns(llt, begin, end, 1);
 
-			r *= 2;
-			r += bit;
+	for (size_t r = 0; r < llt->n; r += len) {
+		for (size_t j = r + begin; j < r + end; ++j) {
+			double v = creal(llt->a[j]) * llt->weight_inv[j] / (double)llt->n;
+			double r = rint(v);
 
-			if (r >= d) {
-				r -= d;
+			if (fabs(v - r) > error) {
+				error = fabs(v - r);
 			}
+
+			llt->x[j] = (int64_t)r;
 		}
 	}
 
-	return r;
+	pthread_mutex_lock(&llt->mutex);
+	if (error > llt->error) {
+		llt->error = error;
+	}
+	pthread_mutex_unlock(&llt->mutex);
 }
 
-int mpi_divisible_u32_p(const mpi_t n, unsigned long int d)
+/* x := x^2 - c by transform; returns the largest rounding error seen */
+static double llt_step(struct llt *llt, uint32_t c)
 {
-	return mpz_fdiv_u32(n, d) == 0;
-}
+	size_t len = llt->n / llt->blocks;
 
-int mpi_tstbit(const mpi_t op, mp_bitcnt_t bit_index)
-{
-	size_t word = bit_index / 31;
-	size_t bit = bit_index % 31;
+	llt->error = 0;
 
-	uint32_t r = word < op->nmemb ? op->data[word] : 0;
+	llt_for(llt, len, llt_step_weight, llt);
+	llt_for(llt, llt->blocks, llt_step_square, llt);
+	llt_for(llt, len, llt_step_round, llt);
 
-	return (r >> bit) & 1;
+	llt->x[0] -= c;
+
+	llt_carry(llt);
+
+	return llt->error;
 }
 
-void mpi_setbit(mpi_t rop, mp_bitcnt_t bit_index)
+/* count iterations of s := s^2 - c mod m, for m = 2^p - 1 */
+static void llt_run(mpi_t s, const mpi_t m, mp_bitcnt_t p, mp_bitcnt_t count, uint32_t c)
 {
-	size_t word = bit_index / 31;
-	size_t bit = bit_index % 31;
+	mp_bitcnt_t i = 0;
 
-	mpi_enlarge(rop, word + 1);
-
-	uint32_t mask = (uint32_t)1 << bit;
+	if (p >= param(PARAM_LLT_FFT)) {
+		size_t n = llt_length(p);
 
-	rop->data[word] |= mask;
-}
+		while (i < count && n <= p) {
+			struct llt llt;
 
-size_t mpi_sizeinbase(const mpi_t op, int base)
-{
-	assert(base == 2);
+			llt_init(&llt, p, n);
+			llt_set(&llt, s);
 
-	// find right-most non-zero word
-	for (size_t i = op->nmemb - 1; i != (size_t)-1; --i) {
-		if (op->data[i] != 0) {
-			// find right-most non-zero bit
-			for (int b = 30; b >= 0; --b) {
-				if ((op->data[i] & ((uint32_t)1 << b)) != 0) {
-					return 31 * i + b + 1;
+			for (; i < count; ++i) {
+				if (llt_step(&llt, c) > LLT_MAX_ERROR) {
+					memcpy(llt.x, llt.prev, n * sizeof(int64_t));
+					break;
 				}
 			}
+
+			llt_get(s, &llt, m);
+			llt_clear(&llt);
+
+			if (i < count) {
+				/* redo this iteration exactly, and continue on a longer transform */
+				llt_step_exact(s, m, p, c);
+				i++;
+				n *= 2;
+			}
 		}
 	}
 
-	return 0;
+	for (; i < count; ++i) {
+		llt_step_exact(s, m, p, c);
+	}
 }
 
-void mpi_fdiv_qr(mpi_t q, mpi_t r, const mpi_t n, const mpi_t d)
+static void mpi_set_mersenne(mpi_t m, mp_bitcnt_t p)
 {
-	mpi_t n0, d0;
-	mpi_init(n0);
-	mpi_init(d0);
-	mpi_set(n0, n);
-	mpi_set(d0, d);
+	mpi_set_u32(m, 1);
+	mpi_mul_2exp(m, m, p);
+	mpi_sub_u32(m, m, 1);
+	mpi_compact(m);
+}
 
-	if (mpi_cmp_u32(d0, 0) == 0) {
-		fprintf(stderr, "Division by zero\n");
-		abort();
+int mpi_llt(mp_bitcnt_t p)
+{
+	if (p <= 2) {
+		return p == 2;
 	}
 
-	mpi_set_u32(q, 0);
-	mpi_set_u32(r, 0);
+	mpi_t s, m;
 
-	size_t start = mpi_sizeinbase(n0, 2) - 1;
+	mpi_init(s);
+	mpi_init(m);
 
-	for (size_t i = start; i != (size_t)-1; --i) {
-		mpi_mul_2exp(r, r, 1);
-		if (mpi_tstbit(n0, i) != 0) {
-			mpi_setbit(r, 0);
-		}
-		if (mpi_cmp(r, d0) >= 0) {
-			mpi_sub(r, r, d0);
-			mpi_setbit(q, i);
-		}
+	mpi_set_mersenne(m, p);
+
+	mpi_set_u32(s, 4);
+
+	llt_run(s, m, p, p - 2, 2);
+
+	int ret = mpi_cmp_u32(s, 0) == 0;
+
+	mpi_clear(s);
+	mpi_clear(m);
+
+	return ret;
+}
+
+/*
+ * Checkpoint files, in host byte order:
+ *
+ *   char magic[8] = "MPICKPT1"
+ *   uint32_t type = CHECKPOINT_LLT or CHECKPOINT_PRP
+ *   uint32_t count (number of values)
+ *   uint64_t p
+ *   uint64_t iteration
+ *   count times: uint64_t nmemb, uint32_t data[nmemb] (31-bit limbs)
+ *   uint32_t checksum (sum of all preceding 32-bit words, header included)
+ *
+ * A file is written next to the target and renamed over it, so an
+ * interrupted write leaves the previous checkpoint intact.
+ */
+
+#define CHECKPOINT_LLT 1
+#define CHECKPOINT_PRP 2
+
+#define CHECKPOINT_MAX_RETRIES 3
+
+/* the most values any test keeps */
+#define CHECKPOINT_MAX_VALUES 2
+
+static uint32_t checksum_add(uint32_t sum, const void *ptr, size_t size)
+{
+	const unsigned char *bytes = ptr;
+
+	for (size_t i = 0; i + 4 <= size; i += 4) {
+		uint32_t word;
+		memcpy(&word, bytes + i, 4);
+		sum += word;
 	}
 
-	mpi_clear(n0);
-	mpi_clear(d0);
+	return sum;
 }
 
-uint32_t mpi_fdiv_qr_u32(mpi_t q, mpi_t r, const mpi_t n, uint32_t d)
+struct checkpoint_header {
+	char magic[8];
+	uint32_t type;
+	uint32_t count;
+	uint64_t p;
+	uint64_t iteration;
+};
+
+static void checkpoint_write(const char *path, uint32_t type, mp_bitcnt_t p, mp_bitcnt_t iteration, const struct mpi *const *values, uint32_t count)
 {
-	mpi_t n0;
-	mpi_init(n0);
-	mpi_set(n0, n);
+	size_t len = strlen(path);
+	char *tmp = malloc(len + 5);
 
-	if (d == 0) {
-		fprintf(stderr, "Division by zero\n");
+	if (tmp == NULL) {
 		abort();
 	}
 
-	mpi_set_u32(q, 0);
-	mpi_set_u32(r, 0);
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, ".tmp", 5);
 
-	size_t start = mpi_sizeinbase(n0, 2) - 1;
+	FILE *stream = fopen(tmp, "wb");
 
-	for (size_t i = start; i != (size_t)-1; --i) {
-		mpi_mul_2exp(r, r, 1);
-		if (mpi_tstbit(n0, i) != 0) {
-			mpi_setbit(r, 0);
-		}
-		if (mpi_cmp_u32(r, d) >= 0) {
-			mpi_sub_u32(r, r, d);
+	if (stream == NULL) {
+		fprintf(stderr, "Cannot write checkpoint %s\n", tmp);
+		abort();
+	}
 
-			mpi_setbit(q, i);
+	struct checkpoint_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "MPICKPT1", 8);
+	header.type = type;
+	header.count = count;
+	header.p = p;
+	header.iteration = iteration;
+
+	uint32_t sum = checksum_add(0, &header, sizeof(header));
+	int ok = fwrite(&header, sizeof(header), 1, stream) == 1;
+
+	for (uint32_t k = 0; k < count; ++k) {
+		uint64_t nmemb = values[k]->nmemb;
+
+		sum = checksum_add(sum, &nmemb, sizeof(nmemb));
+		ok = ok && fwrite(&nmemb, sizeof(nmemb), 1, stream) == 1;
+
+		/* a zero may have no limbs, and no data pointer */
+		if (nmemb != 0) {
+			sum = checksum_add(sum, values[k]->data, nmemb * sizeof(uint32_t));
+			ok = ok && fwrite(values[k]->data, sizeof(uint32_t), nmemb, stream) == nmemb;
 		}
 	}
 
-	mpi_clear(n0);
+	ok = ok && fwrite(&sum, sizeof(sum), 1, stream) == 1;
+	ok = (fclose(stream) == 0) && ok;
+
+	if (!ok || rename(tmp, path) != 0) {
+		fprintf(stderr, "Cannot write checkpoint %s\n", path);
+		abort();
+	}
 
-	return mpi_get_u32(r);
+	free(tmp);
 }
 
-char *mpi_to_cstr(const mpi_t op, int base)
+/*
+ * returns 0 if there is no usable checkpoint for this test; the whole file
+ * is checked against its checksum before the header is trusted, and a sound
+ * checkpoint of another test is refused rather than left to be overwritten
+ */
+static int checkpoint_read(const char *path, uint32_t type, mp_bitcnt_t p, mp_bitcnt_t *iteration, struct mpi *const *values, uint32_t count)
 {
-	mpi_t n, r;
-	mpi_init(n);
-	mpi_init(r);
-	mpi_set(n, op);
+	FILE *stream = fopen(path, "rb");
 
-	assert(base == 10);
+	if (stream == NULL) {
+		return 0;
+	}
 
-	size_t size = 2;
-	char *buffer = malloc(size);
+	/* no value can hold more limbs than the file has bytes */
+	long size = fseek(stream, 0, SEEK_END) == 0 ? ftell(stream) : -1;
 
-	if (buffer == NULL) {
-		abort();
-	}
+	rewind(stream);
 
-	// buffer[i] := digit, buffer[i+1] := \0
-	size_t i = 0;
+	struct checkpoint_header header;
+	mpi_t read[CHECKPOINT_MAX_VALUES];
+	uint32_t sum = 0, stored, nread = 0;
+	int ok = size >= 0 && fread(&header, sizeof(header), 1, stream) == 1;
 
-	while (mpi_cmp_u32(n, 0) != 0) {
-		uint32_t digit = mpi_fdiv_qr_u32(n, r, n, 10);
+	ok = ok && memcmp(header.magic, "MPICKPT1", 8) == 0 && header.count <= CHECKPOINT_MAX_VALUES;
 
-		buffer[i] = '0' + digit;
+	sum = checksum_add(sum, &header, sizeof(header));
 
-		i++;
+	for (uint32_t k = 0; ok && k < header.count; ++k) {
+		uint64_t nmemb;
 
-		if (i == size - 1) {
-			size <<= 1;
-			buffer = realloc(buffer, size);
+		ok = fread(&nmemb, sizeof(nmemb), 1, stream) == 1 && nmemb <= (uint64_t)size / sizeof(uint32_t);
 
-			if (buffer == NULL) {
-				abort();
+		if (ok) {
+			mpi_init(read[k]);
+			nread++;
+			mpi_enlarge(read[k], (size_t)nmemb);
+			ok = nmemb == 0 || fread(read[k]->data, sizeof(uint32_t), nmemb, stream) == nmemb;
+			sum = checksum_add(sum, &nmemb, sizeof(nmemb));
+			if (nmemb != 0) {
+				sum = checksum_add(sum, read[k]->data, nmemb * sizeof(uint32_t));
 			}
+			mpi_compact(read[k]);
 		}
 	}
 
-	if (i == 0) {
-		buffer[i] = '0';
-		i++;
+	ok = ok && fread(&stored, sizeof(stored), 1, stream) == 1 && stored == sum;
+
+	fclose(stream);
+
+	if (ok && (header.type != type || header.count != count || header.p != p)) {
+		fprintf(stderr, "Checkpoint %s belongs to another test\n", path);
+		abort();
 	}
 
-	buffer[i] = 0;
+	ok = ok && header.iteration <= p;
 
-	// reverse string
-	for (size_t k = 0, l = i - 1; k < l; ++k, --l) {
-		char t = buffer[k];
-		buffer[k] = buffer[l];
-		buffer[l] = t;
+	for (uint32_t k = 0; ok && k < nread; ++k) {
+		ok = mpi_sizeinbase(read[k], 2) <= p + 1;
 	}
 
-	mpi_clear(n);
-	mpi_clear(r);
+	for (uint32_t k = 0; k < nread; ++k) {
+		if (ok) {
+			mpi_swap(values[k], read[k]);
+		}
+		mpi_clear(read[k]);
+	}
 
-	return buffer;
+	if (!ok) {
+		fprintf(stderr, "Ignoring damaged checkpoint %s\n", path);
+		return 0;
+	}
+
+	*iteration = header.iteration;
+
+	return 1;
 }
 
-size_t mpi_out_str(FILE *stream, int base, const mpi_t op)
+/* (s - 2 / 2^p - 1) is -1 for every s of the Lucas-Lehmer sequence after the first */
+static int llt_jacobi_check(const mpi_t s, const mpi_t m)
 {
-	char *buffer = mpi_to_cstr(op, base);
+	mpi_t t;
+
+	mpi_init(t);
+
+	mpi_add(t, s, m);
+	mpi_sub_u32(t, t, 2);
 
-	int ret = fprintf(stream, "%s", buffer);
+	int ret = mpi_jacobi(t, m) == -1;
 
-	free(buffer);
+	mpi_clear(t);
 
 	return ret;
 }
 
-int gmp_vfprintf(FILE *fp, const char *fmt, va_list ap)
+int mpi_llt_resume(mp_bitcnt_t p, const char *path, mp_bitcnt_t interval)
 {
-	char buffer[4096];
-
-	int ret = gmp_vsprintf(buffer, fmt, ap);
+	/* 2^p - 1 is composite for composite p; the Jacobi check needs p prime */
+	if (!prime_p(p) || p == 2) {
+		return p == 2;
+	}
 
-	if (ret < 0) {
-		return -1;
+	if (interval == 0) {
+		interval = p;
 	}
 
-	return fprintf(fp, "%s", buffer);
-}
+	mpi_t s, m, good;
 
-int gmp_fprintf(FILE *fp, const char *fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
+	mpi_init(s);
+	mpi_init(m);
+	mpi_init(good);
 
-	int ret = gmp_vfprintf(fp, fmt, ap);
+	mpi_set_mersenne(m, p);
 
-	va_end(ap);
+	mp_bitcnt_t i = 0;
+	struct mpi *values[1] = { s };
 
-	return ret;
-}
+	if (path == NULL || !checkpoint_read(path, CHECKPOINT_LLT, p, &i, values, 1) || i > p - 2) {
+		i = 0;
+		mpi_set_u32(s, 4);
+	}
 
-int gmp_vsprintf(char *buf, const char *fmt, va_list ap)
-{
-	int written = 0;
-	int state = 0;
-	int type = 0;
+	/* last verified state */
+	mp_bitcnt_t good_i = i;
+	int retries = 0;
 
-	while (1) {
-		switch (state) {
-			/* before/after %... sequence */
-			case 0:
-				switch (*fmt) {
-					case '%':
-						state = 1;
-						type = 0;
-						break;
-					default:
-						*buf++ = *fmt;
-						break;
-				}
-				break;
-			/* inside %... sequence */
-			case 1:
-				switch (*fmt) {
-					case '%':
-						*buf++ = '%';
-						state = 0;
-						break;
-					case 'Z':
-						type = 'Z';
-						break;
-					case 'l':
-						type = 'l';
-						break;
-					case 'i':
-					case 'd':
-						switch (type) {
-							int i;
-							long int l;
-							mpi_t n;
-							int size;
-							case 0:
-								i = va_arg(ap, int);
-								size = sprintf(buf, "%i", i);
-								if (size < 0) {
-									return -1;
-								}
-								buf += size;
-								written += size;
-								break;
-							case 'l':
-								l = va_arg(ap, long int);
-								size = sprintf(buf, "%li", l);
-								if (size < 0) {
-									return -1;
-								}
-								buf += size;
-								written += size;
-								break;
-							case 'Z':
-								*n = *va_arg(ap, struct mpi *);
-								char *str = mpi_to_cstr(n, 10);
-								size = sprintf(buf, "%s", str);
-								free(str);
-								if (size < 0) {
-									return -1;
-								}
-								buf += size;
-								written += size;
-								break;
-							default:
-								abort();
-						}
-						/* print */
-						state = 0;
-						break;
-					case 'u':
-						switch (type) {
-							unsigned u;
-							long unsigned lu;
-							int size;
-							case 0:
-								u = va_arg(ap, unsigned);
-								size = sprintf(buf, "%u", u);
-								if (size < 0) {
-									return -1;
-								}
-								buf += size;
-								written += size;
-								break;
-							case 'l':
-								lu = va_arg(ap, unsigned long int);
-								size = sprintf(buf, "%lu", lu);
-								if (size < 0) {
-									return -1;
-								}
-								buf += size;
-								written += size;
-								break;
-							default:
-								abort();
-						}
-						state = 0;
-						break;
-					case 'f':
-						switch (type) {
-							double f;
-							int size;
-							case 0:
-								f = va_arg(ap, double);
-								size = sprintf(buf, "%f", f);
-								if (size < 0) {
-									return -1;
-								}
-								buf += size;
-								written += size;
-								break;
-							default:
-								abort();
-						}
-						state = 0;
-						break;
-					default:
-						/* unhandled */
-						abort();
-				}
-				break;
+	mpi_set(good, s);
+
+	while (i < p - 2) {
+		mp_bitcnt_t count = p - 2 - i < interval ? p - 2 - i : interval;
+
+		llt_run(s, m, p, count, 2);
+		i += count;
+
+		if (!llt_jacobi_check(s, m)) {
+			if (++retries > CHECKPOINT_MAX_RETRIES) {
+				fprintf(stderr, "Lucas-Lehmer test of 2^%zu - 1 keeps failing at iteration %zu\n", (size_t)p, (size_t)i);
+				abort();
+			}
+
+			i = good_i;
+			mpi_set(s, good);
+			continue;
 		}
-		if (*fmt == 0) {
-			break;
+
+		retries = 0;
+		good_i = i;
+		mpi_set(good, s);
+
+		if (path != NULL) {
+			const struct mpi *state[1] = { s };
+
+			checkpoint_write(path, CHECKPOINT_LLT, p, i, state, 1);
 		}
-		fmt++;
 	}
 
-	return written;
+	int ret = mpi_cmp_u32(s, 0) == 0;
+
+	mpi_clear(s);
+	mpi_clear(m);
+	mpi_clear(good);
+
+	return ret;
 }
 
-int gmp_sprintf(char *buf, const char *fmt, ...)
+/* d := d * x mod m */
+static void prp_mul(mpi_t d, const mpi_t x, const mpi_t m, mp_bitcnt_t p)
 {
-	va_list ap;
-	va_start(ap, fmt);
+	mpi_mul(d, d, x);
+	llt_mod(d, m, p);
+}
 
-	int ret = gmp_vsprintf(buf, fmt, ap);
+/*
+ * Fermat test 3^(2^p - 2) = 1 (mod 2^p - 1), i.e. 3^(2^p) = 9, by p squarings
+ * of x = 3. Every block of L squarings multiplies d by x, so that
+ * d_k = 3 * d_(k-1)^(2^L); this is verified every L blocks.
+ */
+int mpi_prp_mersenne(mp_bitcnt_t p, const char *path, mp_bitcnt_t interval)
+{
+	if (p <= 2) {
+		return p == 2;
+	}
 
-	va_end(ap);
+	if (interval == 0) {
+		interval = p;
+	}
 
-	return ret;
-}
+	mp_bitcnt_t block = 1;
 
-void mpi_gcd(mpi_t rop, const mpi_t op1, const mpi_t op2)
-{
-	// a = op1
-	// b = op2
-	if (mpi_cmp_u32(op2, 0) == 0) {
-		mpi_set(rop, op1);
-		return;
+	while ((block + 1) * (block + 1) <= interval) {
+		block++;
 	}
 
-	mpi_t q, r;
-	mpi_init(q);
-	mpi_init(r);
+	mpi_t x, d, m, d_prev, t, good_x, good_d;
 
-	mpi_fdiv_qr(q, r, op1, op2);
+	mpi_init(x);
+	mpi_init(d);
+	mpi_init(m);
+	mpi_init(d_prev);
+	mpi_init(t);
+	mpi_init(good_x);
+	mpi_init(good_d);
 
-	mpi_gcd(rop, op2, r);
+	mpi_set_mersenne(m, p);
 
-	mpi_clear(q);
-	mpi_clear(r);
+	mp_bitcnt_t i = 0;
+	struct mpi *values[2] = { x, d };
+
+	if (path == NULL || !checkpoint_read(path, CHECKPOINT_PRP, p, &i, values, 2)) {
+		i = 0;
+		mpi_set_u32(x, 3);
+		mpi_set_u32(d, 3);
+	}
+
+	mp_bitcnt_t good_i = i;
+	int retries = 0;
+
+	mpi_set(good_x, x);
+	mpi_set(good_d, d);
+
+	/* full blocks, verified */
+	while (i + block <= p) {
+		mp_bitcnt_t blocks = 0;
+
+		while (blocks < block && i + block <= p) {
+			mpi_set(d_prev, d);
+			llt_run(x, m, p, block, 0);
+			prp_mul(d, x, m, p);
+			i += block;
+			blocks++;
+		}
+
+		mpi_set(t, d_prev);
+		llt_run(t, m, p, block, 0);
+		mpi_mul_u32(t, t, 3);
+		llt_mod(t, m, p);
+
+		if (mpi_cmp(t, d) != 0) {
+			if (++retries > CHECKPOINT_MAX_RETRIES) {
+				fprintf(stderr, "PRP test of 2^%zu - 1 keeps failing at iteration %zu\n", (size_t)p, (size_t)i);
+				abort();
+			}
+
+			i = good_i;
+			mpi_set(x, good_x);
+			mpi_set(d, good_d);
+			continue;
+		}
+
+		retries = 0;
+		good_i = i;
+		mpi_set(good_x, x);
+		mpi_set(good_d, d);
+
+		if (path != NULL) {
+			const struct mpi *state[2] = { x, d };
+
+			checkpoint_write(path, CHECKPOINT_PRP, p, i, state, 2);
+		}
+	}
+
+	/* fewer than L squarings are left; run them twice */
+	mpi_set(t, x);
+	llt_run(x, m, p, p - i, 0);
+	llt_run(t, m, p, p - i, 0);
+
+	if (mpi_cmp(t, x) != 0) {
+		fprintf(stderr, "PRP test of 2^%zu - 1 is not reproducible\n", (size_t)p);
+		abort();
+	}
+
+	mpi_set_u32(t, 9);
+	llt_mod(t, m, p);
+
+	int ret = mpi_cmp(x, t) == 0;
+
+	mpi_clear(x);
+	mpi_clear(d);
+	mpi_clear(m);
+	mpi_clear(d_prev);
+	mpi_clear(t);
+	mpi_clear(good_x);
+	mpi_clear(good_d);
+
+	return ret;
 }
@@ -4,21 +4,44 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mpi_mmap;
 
 struct mpi {
 	uint32_t *data;
 	size_t nmemb;
+	/* file backing (mpi_init_mmap), NULL for heap storage */
+	struct mpi_mmap *mmap;
 };
 
 typedef struct mpi mpi_t[1];
 
 typedef size_t mp_bitcnt_t;
 
+/* Thread Control */
+
+void mpi_set_num_threads(int n);
+int mpi_get_num_threads(void);
+
+/* Tuning Parameters (see mpi-params.h) */
+
+size_t mpi_get_param(const char *name);
+void mpi_set_param(const char *name, size_t value);
+
 /* Initialization Functions */
 
 void mpi_init(mpi_t rop);
+void mpi_init_mmap(mpi_t rop, const char *path, mp_bitcnt_t bits);
 void mpi_clear(mpi_t rop);
 
+void mpi_enlarge(mpi_t rop, size_t nmemb);
+void mpi_compact(mpi_t rop);
+
 /* Assignment Functions */
 
 void mpi_set(mpi_t rop, const mpi_t op);
@@ -34,6 +57,13 @@ void mpi_swap(mpi_t rop1, mpi_t rop2);
 uint32_t mpi_get_u32(const mpi_t op);
 uint64_t mpi_get_u64(const mpi_t op);
 
+/* Integer Import and Export */
+
+void mpi_import(mpi_t rop, size_t count, int order, size_t size, int endian, size_t nails, const void *op);
+void *mpi_export(void *rop, size_t *countp, int order, size_t size, int endian, size_t nails, const mpi_t op);
+
+const struct mpi *mpi_view(mpi_t rop, const uint32_t *data, size_t nmemb);
+
 /* Arithmetic Functions */
 
 void mpi_add(mpi_t rop, const mpi_t op1, const mpi_t op2);
@@ -46,8 +76,17 @@ void mpi_sub_u64(mpi_t rop, const mpi_t op1, uint64_t op2);
 
 void mpi_mul(mpi_t rop, const mpi_t op1, const mpi_t op2);
 void mpi_mul_u32(mpi_t rop, const mpi_t op1, uint32_t op2);
+void mpi_sqr(mpi_t rop, const mpi_t op);
 void mpi_mul_2exp(mpi_t rop, const mpi_t op1, mp_bitcnt_t op2);
 
+void mpi_addmul(mpi_t rop, const mpi_t op1, const mpi_t op2);
+void mpi_addmul_u32(mpi_t rop, const mpi_t op1, uint32_t op2);
+void mpi_addmul_2exp(mpi_t rop, const mpi_t op1, mp_bitcnt_t op2);
+
+void mpi_submul(mpi_t rop, const mpi_t op1, const mpi_t op2);
+void mpi_submul_u32(mpi_t rop, const mpi_t op1, uint32_t op2);
+void mpi_submul_2exp(mpi_t rop, const mpi_t op1, mp_bitcnt_t op2);
+
 /* Division Functions */
 
 void mpi_fdiv_qr(mpi_t q, mpi_t r, const mpi_t n, const mpi_t d);
@@ -60,14 +99,48 @@ uint32_t mpz_fdiv_u32(const mpi_t n, uint32_t d);
 
 int mpi_divisible_u32_p(const mpi_t n, unsigned long int d);
 
+void mpi_mod_u32_many(uint32_t *residues, const mpi_t n, const uint32_t *divisors, size_t count);
+int mpi_divisible_by_any(const mpi_t n, const uint32_t *divisors, size_t count);
+
 /* Integer Exponentiation */
 
 void mpi_ui_pow_u32(mpi_t rop, uint32_t base, uint32_t exp);
+void mpi_pow_u32(mpi_t rop, const mpi_t base, uint32_t exp);
+
+/* sets scratch to base^(2^k) and returns it; may run concurrently with mpi_pow_cache_clear() */
+const struct mpi *mpi_pow_cache(mpi_t scratch, uint32_t base, unsigned k);
+void mpi_pow_cache_clear(void);
+
+/* Root Extraction */
+
+void mpi_sqrt(mpi_t rop, const mpi_t op);
+void mpi_sqrtrem(mpi_t rop1, mpi_t rop2, const mpi_t op);
+int mpi_root(mpi_t rop, const mpi_t op, uint32_t n);
+
+int mpi_perfect_square_p(const mpi_t op);
+int mpi_perfect_power_p(const mpi_t op);
 
 /* Number Theoretic Functions */
 
+int mpi_probab_prime_p(const mpi_t n, int reps);
+
 void mpi_gcd(mpi_t rop, const mpi_t op1, const mpi_t op2);
 
+int mpi_jacobi(const mpi_t op1, const mpi_t op2);
+
+void mpi_fac_u32(mpi_t rop, uint32_t n);
+void mpi_bin_uiui(mpi_t rop, uint32_t n, uint32_t k);
+void mpi_primorial_u32(mpi_t rop, uint32_t n);
+
+void mpi_fib_u32(mpi_t fn, uint32_t n);
+void mpi_fib2_u32(mpi_t fn, mpi_t fnsub1, uint32_t n);
+void mpi_lucnum_u32(mpi_t ln, uint32_t n);
+void mpi_lucnum2_u32(mpi_t ln, mpi_t lnsub1, uint32_t n);
+
+int mpi_llt(mp_bitcnt_t p);
+int mpi_llt_resume(mp_bitcnt_t p, const char *path, mp_bitcnt_t interval);
+int mpi_prp_mersenne(mp_bitcnt_t p, const char *path, mp_bitcnt_t interval);
+
 /* Comparison Functions */
 
 int mpi_cmp(const mpi_t op1, const mpi_t op2);
@@ -83,11 +156,21 @@ void mpi_setbit(mpi_t rop, mp_bitcnt_t bit_index);
 /* I/O of Integers */
 
 size_t mpi_out_str(FILE *stream, int base, const mpi_t op);
+size_t mpi_inp_str(mpi_t rop, FILE *stream, int base);
 
 int gmp_vfprintf(FILE *fp, const char *fmt, va_list ap);
 int gmp_fprintf(FILE *fp, const char *fmt, ...);
 int gmp_vsprintf(char *buf, const char *fmt, va_list ap);
 int gmp_sprintf(char *buf, const char *fmt, ...);
+int gmp_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+int gmp_snprintf(char *buf, size_t size, const char *fmt, ...);
+int gmp_vasprintf(char **pp, const char *fmt, va_list ap);
+int gmp_asprintf(char **pp, const char *fmt, ...);
+
+/* Statistics (counted only when built with -DMPI_STATS) */
+
+void mpi_stats_dump(FILE *stream);
+void mpi_stats_reset(void);
 
 /* Miscellaneous Functions */
 
@@ -96,4 +179,8 @@ int mpi_even_p(const mpi_t op);
 
 size_t mpi_sizeinbase(const mpi_t op, int base);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,866 @@
+#ifndef MPI_HPP
+#define MPI_HPP
+
+#include "mpi.h"
+#include <cstdlib>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace mpixx {
+
+class integer;
+
+/* base of integer and of the lazy nodes built by the arithmetic operators */
+template <class E>
+struct expression {
+	const E &self() const noexcept
+	{
+		return static_cast<const E &>(*this);
+	}
+};
+
+/*
+ * Owning wrapper around struct mpi. Moves steal the limbs (like mpi_swap).
+ * The operators +, -, *, << and >> build expressions that are evaluated only
+ * when assigned, straight into the destination, so that s = s * s + m - 2
+ * squares s in place and adds m to it without any temporary. An expression
+ * refers to its operands, so it must not outlive the statement (no auto).
+ */
+class integer : public expression<integer> {
+public:
+	integer() noexcept
+	{
+		mpi_init(v);
+	}
+
+	integer(uint64_t op)
+	{
+		mpi_init(v);
+		mpi_set_u64(v, op);
+	}
+
+	/* a template, so that integer(0) is not taken for a null string */
+	template <class C, class = typename std::enable_if<std::is_same<C, char>::value>::type>
+	explicit integer(const C *str)
+	{
+		mpi_init(v);
+		mpi_set_str(v, str, 10);
+	}
+
+	explicit integer(const std::string &str) : integer(str.c_str())
+	{
+	}
+
+	integer(const integer &op)
+	{
+		mpi_init(v);
+		mpi_set(v, op.v);
+	}
+
+	integer(integer &&op) noexcept
+	{
+		*v = *op.v;
+		mpi_init(op.v);
+	}
+
+	template <class E>
+	integer(const expression<E> &op);
+
+	~integer()
+	{
+		mpi_clear(v);
+	}
+
+	integer &operator=(const integer &op)
+	{
+		if (this != &op) {
+			mpi_set(v, op.v);
+		}
+
+		return *this;
+	}
+
+	/* the old limbs go with op */
+	integer &operator=(integer &&op) noexcept
+	{
+		mpi_swap(v, op.v);
+
+		return *this;
+	}
+
+	integer &operator=(uint64_t op)
+	{
+		mpi_set_u64(v, op);
+
+		return *this;
+	}
+
+	template <class E>
+	integer &operator=(const expression<E> &op);
+
+	void swap(integer &op) noexcept
+	{
+		mpi_swap(v, op.v);
+	}
+
+	struct mpi *get() noexcept
+	{
+		return v;
+	}
+
+	const struct mpi *get() const noexcept
+	{
+		return v;
+	}
+
+	/* storage for at least bits bits, kept until an operation compacts it */
+	void reserve(mp_bitcnt_t bits)
+	{
+		mpi_enlarge(v, (bits + 30) / 31);
+	}
+
+	mp_bitcnt_t capacity() const noexcept
+	{
+		return 31 * v->nmemb;
+	}
+
+	void shrink_to_fit()
+	{
+		mpi_compact(v);
+	}
+
+	mp_bitcnt_t bits() const
+	{
+		return mpi_sizeinbase(v, 2);
+	}
+
+	uint32_t get_u32() const
+	{
+		return mpi_get_u32(v);
+	}
+
+	uint64_t get_u64() const
+	{
+		return mpi_get_u64(v);
+	}
+
+	explicit operator bool() const
+	{
+		return mpi_cmp_u32(v, 0) != 0;
+	}
+
+	std::string str() const
+	{
+		char *buf;
+		int len = gmp_asprintf(&buf, "%Zd", v);
+
+		if (len < 0) {
+			std::abort();
+		}
+
+		std::string s(buf, (size_t)len);
+
+		std::free(buf);
+
+		return s;
+	}
+
+	integer &operator+=(const integer &op)
+	{
+		mpi_add(v, v, op.v);
+
+		return *this;
+	}
+
+	integer &operator+=(uint64_t op)
+	{
+		mpi_add_u64(v, v, op);
+
+		return *this;
+	}
+
+	integer &operator-=(const integer &op)
+	{
+		mpi_sub(v, v, op.v);
+
+		return *this;
+	}
+
+	integer &operator-=(uint64_t op)
+	{
+		mpi_sub_u64(v, v, op);
+
+		return *this;
+	}
+
+	template <class E>
+	integer &operator+=(const expression<E> &op);
+
+	template <class E>
+	integer &operator-=(const expression<E> &op);
+
+	template <class E>
+	integer &operator*=(const expression<E> &op);
+
+	integer &operator*=(const integer &op)
+	{
+		if (&op == this) {
+			mpi_sqr(v, v);
+		} else {
+			mpi_mul(v, v, op.v);
+		}
+
+		return *this;
+	}
+
+	integer &operator*=(uint64_t op)
+	{
+		if (op <= UINT32_MAX) {
+			mpi_mul_u32(v, v, (uint32_t)op);
+		} else {
+			mpi_mul(v, v, integer(op).v);
+		}
+
+		return *this;
+	}
+
+	integer &operator/=(const integer &op)
+	{
+		integer r;
+
+		mpi_fdiv_qr(v, r.v, v, op.v);
+
+		return *this;
+	}
+
+	integer &operator/=(uint64_t op)
+	{
+		integer r;
+
+		if (op <= UINT32_MAX) {
+			mpi_fdiv_qr_u32(v, r.v, v, (uint32_t)op);
+		} else {
+			mpi_fdiv_qr(v, r.v, v, integer(op).v);
+		}
+
+		return *this;
+	}
+
+	integer &operator%=(const integer &op)
+	{
+		integer q;
+
+		mpi_fdiv_qr(q.v, v, v, op.v);
+
+		return *this;
+	}
+
+	integer &operator<<=(mp_bitcnt_t op)
+	{
+		mpi_mul_2exp(v, v, op);
+
+		return *this;
+	}
+
+	integer &operator>>=(mp_bitcnt_t op)
+	{
+		mpi_fdiv_q_2exp(v, v, op);
+
+		return *this;
+	}
+
+	integer &operator++()
+	{
+		return *this += 1;
+	}
+
+	integer &operator--()
+	{
+		return *this -= 1;
+	}
+
+private:
+	mpi_t v;
+};
+
+inline void swap(integer &a, integer &b) noexcept
+{
+	a.swap(b);
+}
+
+namespace detail {
+
+/* nodes hold their operand nodes by value and the integers by reference */
+template <class E>
+struct operand {
+	typedef const E type;
+};
+
+template <>
+struct operand<integer> {
+	typedef const integer &type;
+};
+
+template <class E>
+struct terminal {
+	static const bool value = false;
+};
+
+template <>
+struct terminal<integer> {
+	static const bool value = true;
+};
+
+/* whether evaluating e reads t */
+inline bool aliases(const integer &e, const integer &t) noexcept
+{
+	return &e == &t;
+}
+
+template <class E>
+inline bool aliases(const E &e, const integer &t) noexcept
+{
+	return e.references(t);
+}
+
+/* t = e, where e may read t */
+inline void eval(integer &t, const integer &e)
+{
+	if (&t != &e) {
+		mpi_set(t.get(), e.get());
+	}
+}
+
+template <class E>
+inline void eval(integer &t, const E &e)
+{
+	e.evaluate(t);
+}
+
+/* an integer operand as it is, a node evaluated into t */
+inline const integer &source(integer &, const integer &e) noexcept
+{
+	return e;
+}
+
+template <class E>
+inline const integer &source(integer &t, const E &e)
+{
+	e.evaluate(t);
+
+	return t;
+}
+
+/* an integer operand as it is, a node evaluated into a scratch integer */
+template <class E>
+class value {
+public:
+	explicit value(const E &e) : v(e)
+	{
+	}
+
+	const integer &get() const noexcept
+	{
+		return v;
+	}
+
+private:
+	integer v;
+};
+
+template <>
+class value<integer> {
+public:
+	explicit value(const integer &e) noexcept : v(e)
+	{
+	}
+
+	const integer &get() const noexcept
+	{
+		return v;
+	}
+
+private:
+	const integer &v;
+};
+
+inline void multiply(integer &t, const integer &a, const integer &b)
+{
+	if (&a == &b) {
+		mpi_sqr(t.get(), a.get());
+	} else {
+		mpi_mul(t.get(), a.get(), b.get());
+	}
+}
+
+#define MPI_HPP_NODE(name) \
+	template <class L, class R> \
+	struct name : expression<name<L, R> > { \
+		name(const L &a, const R &b) : l(a), r(b) \
+		{ \
+		} \
+		bool references(const integer &t) const noexcept \
+		{ \
+			return aliases(l, t) || aliases(r, t); \
+		} \
+		void evaluate(integer &t) const; \
+		typename operand<L>::type l; \
+		typename operand<R>::type r; \
+	};
+
+#define MPI_HPP_SCALAR_NODE(name, scalar) \
+	template <class L> \
+	struct name : expression<name<L> > { \
+		name(const L &a, scalar b) : l(a), r(b) \
+		{ \
+		} \
+		bool references(const integer &t) const noexcept \
+		{ \
+			return aliases(l, t); \
+		} \
+		void evaluate(integer &t) const; \
+		typename operand<L>::type l; \
+		scalar r; \
+	};
+
+MPI_HPP_NODE(add)
+MPI_HPP_NODE(sub)
+MPI_HPP_NODE(mul)
+MPI_HPP_SCALAR_NODE(add_u64, uint64_t)
+MPI_HPP_SCALAR_NODE(sub_u64, uint64_t)
+MPI_HPP_SCALAR_NODE(mul_u64, uint64_t)
+MPI_HPP_SCALAR_NODE(shl, mp_bitcnt_t)
+MPI_HPP_SCALAR_NODE(shr, mp_bitcnt_t)
+
+#undef MPI_HPP_NODE
+#undef MPI_HPP_SCALAR_NODE
+
+/*
+ * t += e and t -= e for an e that does not read t. Sums are flattened into
+ * the accumulator term by term (in an order that keeps it non-negative),
+ * products and shifts go to the fused mpi_addmul* and mpi_submul* kernels,
+ * and anything else is evaluated into one scratch integer.
+ */
+template <class E>
+inline void add_to(integer &t, const E &e)
+{
+	value<E> a(e);
+
+	mpi_add(t.get(), t.get(), a.get().get());
+}
+
+template <class E>
+inline void sub_from(integer &t, const E &e)
+{
+	value<E> a(e);
+
+	mpi_sub(t.get(), t.get(), a.get().get());
+}
+
+template <class L, class R>
+inline void add_to(integer &t, const add<L, R> &e)
+{
+	add_to(t, e.l);
+	add_to(t, e.r);
+}
+
+template <class L, class R>
+inline void sub_from(integer &t, const add<L, R> &e)
+{
+	sub_from(t, e.l);
+	sub_from(t, e.r);
+}
+
+template <class L, class R>
+inline void add_to(integer &t, const sub<L, R> &e)
+{
+	add_to(t, e.l);
+	sub_from(t, e.r);
+}
+
+template <class L, class R>
+inline void sub_from(integer &t, const sub<L, R> &e)
+{
+	add_to(t, e.r);
+	sub_from(t, e.l);
+}
+
+template <class L>
+inline void add_to(integer &t, const add_u64<L> &e)
+{
+	add_to(t, e.l);
+	mpi_add_u64(t.get(), t.get(), e.r);
+}
+
+template <class L>
+inline void sub_from(integer &t, const add_u64<L> &e)
+{
+	sub_from(t, e.l);
+	mpi_sub_u64(t.get(), t.get(), e.r);
+}
+
+template <class L>
+inline void add_to(integer &t, const sub_u64<L> &e)
+{
+	add_to(t, e.l);
+	mpi_sub_u64(t.get(), t.get(), e.r);
+}
+
+template <class L>
+inline void sub_from(integer &t, const sub_u64<L> &e)
+{
+	mpi_add_u64(t.get(), t.get(), e.r);
+	sub_from(t, e.l);
+}
+
+template <class L, class R>
+inline void add_to(integer &t, const mul<L, R> &e)
+{
+	value<L> a(e.l);
+	value<R> b(e.r);
+
+	mpi_addmul(t.get(), a.get().get(), b.get().get());
+}
+
+template <class L, class R>
+inline void sub_from(integer &t, const mul<L, R> &e)
+{
+	value<L> a(e.l);
+	value<R> b(e.r);
+
+	mpi_submul(t.get(), a.get().get(), b.get().get());
+}
+
+template <class L>
+inline void add_to(integer &t, const mul_u64<L> &e)
+{
+	value<L> a(e.l);
+
+	if (e.r <= UINT32_MAX) {
+		mpi_addmul_u32(t.get(), a.get().get(), (uint32_t)e.r);
+	} else {
+		mpi_addmul(t.get(), a.get().get(), integer(e.r).get());
+	}
+}
+
+template <class L>
+inline void sub_from(integer &t, const mul_u64<L> &e)
+{
+	value<L> a(e.l);
+
+	if (e.r <= UINT32_MAX) {
+		mpi_submul_u32(t.get(), a.get().get(), (uint32_t)e.r);
+	} else {
+		mpi_submul(t.get(), a.get().get(), integer(e.r).get());
+	}
+}
+
+template <class L>
+inline void add_to(integer &t, const shl<L> &e)
+{
+	value<L> a(e.l);
+
+	mpi_addmul_2exp(t.get(), a.get().get(), e.r);
+}
+
+template <class L>
+inline void sub_from(integer &t, const shl<L> &e)
+{
+	value<L> a(e.l);
+
+	mpi_submul_2exp(t.get(), a.get().get(), e.r);
+}
+
+/*
+ * The first operand that does not read t is accumulated last, so the other
+ * one can be evaluated into t; integers are read where they are.
+ */
+template <class L, class R>
+void add<L, R>::evaluate(integer &t) const
+{
+	if (terminal<L>::value && terminal<R>::value) {
+		mpi_add(t.get(), source(t, l).get(), source(t, r).get());
+	} else if (!aliases(r, t) && (aliases(l, t) || !terminal<L>::value)) {
+		eval(t, l);
+		add_to(t, r);
+	} else if (!aliases(l, t)) {
+		eval(t, r);
+		add_to(t, l);
+	} else {
+		integer s(r);
+
+		eval(t, l);
+		mpi_add(t.get(), t.get(), s.get());
+	}
+}
+
+template <class L, class R>
+void sub<L, R>::evaluate(integer &t) const
+{
+	if (terminal<L>::value && terminal<R>::value) {
+		mpi_sub(t.get(), source(t, l).get(), source(t, r).get());
+	} else if (!aliases(r, t) && (aliases(l, t) || !terminal<L>::value)) {
+		eval(t, l);
+		sub_from(t, r);
+	} else if (!aliases(l, t)) {
+		eval(t, r);
+
+		value<L> a(l);
+
+		mpi_sub(t.get(), a.get().get(), t.get());
+	} else {
+		integer s(r);
+
+		eval(t, l);
+		mpi_sub(t.get(), t.get(), s.get());
+	}
+}
+
+template <class L, class R>
+void mul<L, R>::evaluate(integer &t) const
+{
+	if (!terminal<R>::value && !aliases(l, t)) {
+		const integer &b = source(t, r);
+		value<L> a(l);
+
+		multiply(t, a.get(), b);
+	} else if (!aliases(r, t)) {
+		const integer &a = source(t, l);
+		value<R> b(r);
+
+		multiply(t, a, b.get());
+	} else {
+		value<L> a(l);
+		value<R> b(r);
+
+		multiply(t, a.get(), b.get());
+	}
+}
+
+/* the in-place scalar additions stop with the carry, so they are O(1) mostly */
+template <class L>
+void add_u64<L>::evaluate(integer &t) const
+{
+	mpi_add_u64(t.get(), source(t, l).get(), r);
+}
+
+template <class L>
+void sub_u64<L>::evaluate(integer &t) const
+{
+	mpi_sub_u64(t.get(), source(t, l).get(), r);
+}
+
+template <class L>
+void mul_u64<L>::evaluate(integer &t) const
+{
+	const integer &a = source(t, l);
+
+	if (r <= UINT32_MAX) {
+		mpi_mul_u32(t.get(), a.get(), (uint32_t)r);
+	} else {
+		mpi_mul(t.get(), a.get(), integer(r).get());
+	}
+}
+
+template <class L>
+void shl<L>::evaluate(integer &t) const
+{
+	mpi_mul_2exp(t.get(), source(t, l).get(), r);
+}
+
+template <class L>
+void shr<L>::evaluate(integer &t) const
+{
+	mpi_fdiv_q_2exp(t.get(), source(t, l).get(), r);
+}
+
+}
+
+template <class E>
+integer::integer(const expression<E> &op)
+{
+	mpi_init(v);
+	detail::eval(*this, op.self());
+}
+
+template <class E>
+integer &integer::operator=(const expression<E> &op)
+{
+	detail::eval(*this, op.self());
+
+	return *this;
+}
+
+template <class E>
+integer &integer::operator+=(const expression<E> &op)
+{
+	return *this = *this + op.self();
+}
+
+template <class E>
+integer &integer::operator-=(const expression<E> &op)
+{
+	return *this = *this - op.self();
+}
+
+template <class E>
+integer &integer::operator*=(const expression<E> &op)
+{
+	return *this = *this * op.self();
+}
+
+#define MPI_HPP_OPERATOR(op, node) \
+	template <class L, class R> \
+	inline detail::node<L, R> operator op(const expression<L> &a, const expression<R> &b) \
+	{ \
+		return detail::node<L, R>(a.self(), b.self()); \
+	}
+
+#define MPI_HPP_SCALAR_OPERATOR(op, node, scalar) \
+	template <class L> \
+	inline detail::node<L> operator op(const expression<L> &a, scalar b) \
+	{ \
+		return detail::node<L>(a.self(), b); \
+	}
+
+MPI_HPP_OPERATOR(+, add)
+MPI_HPP_OPERATOR(-, sub)
+MPI_HPP_OPERATOR(*, mul)
+MPI_HPP_SCALAR_OPERATOR(+, add_u64, uint64_t)
+MPI_HPP_SCALAR_OPERATOR(-, sub_u64, uint64_t)
+MPI_HPP_SCALAR_OPERATOR(*, mul_u64, uint64_t)
+MPI_HPP_SCALAR_OPERATOR(<<, shl, mp_bitcnt_t)
+MPI_HPP_SCALAR_OPERATOR(>>, shr, mp_bitcnt_t)
+
+#undef MPI_HPP_OPERATOR
+#undef MPI_HPP_SCALAR_OPERATOR
+
+template <class R>
+inline detail::add_u64<R> operator+(uint64_t a, const expression<R> &b)
+{
+	return detail::add_u64<R>(b.self(), a);
+}
+
+template <class R>
+inline detail::mul_u64<R> operator*(uint64_t a, const expression<R> &b)
+{
+	return detail::mul_u64<R>(b.self(), a);
+}
+
+template <class R>
+inline integer operator-(uint64_t a, const expression<R> &b)
+{
+	integer r(a);
+
+	r -= b.self();
+
+	return r;
+}
+
+/* division is not lazy; these work on a copy of the left operand, or on it if it is an rvalue */
+
+#define MPI_HPP_OPERATOR(op, type) \
+	inline integer operator op(const integer &a, type b) \
+	{ \
+		integer r(a); \
+		r op##= b; \
+		return r; \
+	} \
+	inline integer operator op(integer &&a, type b) \
+	{ \
+		a op##= b; \
+		return std::move(a); \
+	}
+
+MPI_HPP_OPERATOR(/, const integer &)
+MPI_HPP_OPERATOR(/, uint64_t)
+MPI_HPP_OPERATOR(%, const integer &)
+
+#undef MPI_HPP_OPERATOR
+
+inline int cmp(const integer &a, const integer &b)
+{
+	return mpi_cmp(a.get(), b.get());
+}
+
+/* one scalar type only, so that int arguments are not ambiguous */
+inline int cmp(const integer &a, uint64_t b)
+{
+	if (b <= UINT32_MAX) {
+		return mpi_cmp_u32(a.get(), (uint32_t)b);
+	}
+
+	if (a.bits() > 64) {
+		return 1;
+	}
+
+	uint64_t u = a.get_u64();
+
+	return (u > b) - (u < b);
+}
+
+inline int cmp(uint64_t a, const integer &b)
+{
+	return -cmp(b, a);
+}
+
+#define MPI_HPP_COMPARISON(op) \
+	inline bool operator op(const integer &a, const integer &b) \
+	{ \
+		return cmp(a, b) op 0; \
+	} \
+	inline bool operator op(const integer &a, uint64_t b) \
+	{ \
+		return cmp(a, b) op 0; \
+	} \
+	inline bool operator op(uint64_t a, const integer &b) \
+	{ \
+		return cmp(a, b) op 0; \
+	}
+
+MPI_HPP_COMPARISON(==)
+MPI_HPP_COMPARISON(!=)
+MPI_HPP_COMPARISON(<)
+MPI_HPP_COMPARISON(<=)
+MPI_HPP_COMPARISON(>)
+MPI_HPP_COMPARISON(>=)
+
+#undef MPI_HPP_COMPARISON
+
+inline std::ostream &operator<<(std::ostream &os, const integer &op)
+{
+	return os << op.str();
+}
+
+inline integer pow(const integer &base, uint32_t exp)
+{
+	integer r;
+
+	mpi_pow_u32(r.get(), base.get(), exp);
+
+	return r;
+}
+
+inline integer sqrt(const integer &op)
+{
+	integer r;
+
+	mpi_sqrt(r.get(), op.get());
+
+	return r;
+}
+
+inline integer gcd(const integer &a, const integer &b)
+{
+	integer r;
+
+	mpi_gcd(r.get(), a.get(), b.get());
+
+	return r;
+}
+
+}
+
+#endif
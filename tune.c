@@ -0,0 +1,217 @@
+#include "mpi.h"
+#include "bench-util.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* every timing repeats the operation for at least this long, best of TUNE_RUNS */
+#define TUNE_SECONDS 0.02
+#define TUNE_RUNS 3
+
+/* a crossover needs this many consecutive sizes where the new algorithm wins */
+#define TUNE_CONFIRM 3
+
+struct work {
+	size_t size;
+	mpi_t a, b, r;
+	char *str;
+};
+
+static void work_mul(struct work *w)
+{
+	mpi_mul(w->r, w->a, w->b);
+}
+
+static void work_set_str(struct work *w)
+{
+	mpi_set_str(w->r, w->str, 10);
+}
+
+static void work_get_str(struct work *w)
+{
+	char *str;
+
+	gmp_asprintf(&str, "%Zd", w->a);
+	free(str);
+}
+
+static void work_llt(struct work *w)
+{
+	mpi_llt(w->size);
+}
+
+/* seconds per call of func(w) with the parameter set to value */
+static double measure(void (*func)(struct work *), struct work *w, const char *name, size_t value)
+{
+	double best = 1e300;
+
+	mpi_set_param(name, value);
+
+	/* warm up (power caches, page faults) */
+	func(w);
+
+	for (int run = 0; run < TUNE_RUNS; ++run) {
+		size_t reps = 0;
+		double start = now(), elapsed;
+
+		do {
+			func(w);
+			reps++;
+			elapsed = now() - start;
+		} while (elapsed < TUNE_SECONDS);
+
+		if (elapsed / (double)reps < best) {
+			best = elapsed / (double)reps;
+		}
+	}
+
+	return best;
+}
+
+static size_t next_size(size_t size)
+{
+	return size + size / 8 + 1;
+}
+
+static int prime_p(size_t p)
+{
+	for (size_t d = 2; d * d <= p; ++d) {
+		if (p % d == 0) {
+			return 0;
+		}
+	}
+
+	return p >= 2;
+}
+
+/*
+ * Smallest size in [min, max] from which the new algorithm at the top level
+ * beats the old one for TUNE_CONFIRM consecutive sizes. The parameter is
+ * either the first size of the new algorithm or, if last_old is set, the last
+ * size of the old one. If prepare is NULL, operands of size limbs are used.
+ */
+static size_t crossover(const char *name, void (*func)(struct work *), void (*prepare)(struct work *), size_t min, size_t max, int last_old)
+{
+	size_t found = 0;
+	int wins = 0;
+
+	for (size_t size = min; size <= max; size = next_size(size)) {
+		struct work w;
+
+		w.size = size;
+		w.str = NULL;
+		mpi_init(w.a);
+		mpi_init(w.b);
+		mpi_init(w.r);
+
+		if (prepare != NULL) {
+			prepare(&w);
+		} else {
+			mpi_random(w.a, size);
+			mpi_random(w.b, size);
+		}
+
+		size = w.size;
+
+		double t_old = measure(func, &w, name, last_old ? size : size + 1);
+		double t_new = measure(func, &w, name, last_old ? size - 1 : size);
+
+		fprintf(stderr, "%s %zu: %.3g s / %.3g s\n", name, size, t_old, t_new);
+
+		if (t_new < t_old) {
+			if (wins++ == 0) {
+				found = last_old ? size - 1 : size;
+			}
+		} else {
+			wins = 0;
+		}
+
+		mpi_clear(w.a);
+		mpi_clear(w.b);
+		mpi_clear(w.r);
+		free(w.str);
+
+		if (wins == TUNE_CONFIRM) {
+			return found;
+		}
+	}
+
+	return wins > 0 ? found : max;
+}
+
+/* size decimal digits, to be parsed */
+static void prepare_set_str(struct work *w)
+{
+	w->str = malloc(w->size + 1);
+
+	if (w->str == NULL) {
+		abort();
+	}
+
+	for (size_t i = 0; i < w->size; ++i) {
+		w->str[i] = (char)('0' + (i == 0 ? 1 + rand_u32() % 9 : rand_u32() % 10));
+	}
+
+	w->str[w->size] = 0;
+}
+
+/* a number of size decimal digits, to be printed */
+static void prepare_get_str(struct work *w)
+{
+	prepare_set_str(w);
+	mpi_set_str(w->a, w->str, 10);
+}
+
+/* the next prime exponent */
+static void prepare_llt(struct work *w)
+{
+	while (!prime_p(w->size)) {
+		w->size++;
+	}
+}
+
+/*
+ * Usage: tune > mpi-params.h
+ *
+ * Measures the crossovers between the algorithms on this machine, one
+ * parameter at a time with the previously tuned ones in effect, and prints
+ * the parameters header. Progress goes to stderr.
+ */
+int main(void)
+{
+	srand(1);
+
+	mpi_set_param("MUL_NTT_THRESHOLD", SIZE_MAX);
+	size_t karatsuba = crossover("MUL_KARATSUBA_THRESHOLD", work_mul, NULL, 4, 512, 0);
+	mpi_set_param("MUL_KARATSUBA_THRESHOLD", karatsuba);
+
+	size_t ntt = crossover("MUL_NTT_THRESHOLD", work_mul, NULL, 64, 32768, 0);
+	mpi_set_param("MUL_NTT_THRESHOLD", ntt);
+
+	size_t set_str = crossover("SET_STR_THRESHOLD", work_set_str, prepare_set_str, 16, 65536, 1);
+	mpi_set_param("SET_STR_THRESHOLD", set_str);
+
+	size_t get_str = crossover("GET_STR_THRESHOLD", work_get_str, prepare_get_str, 16, 65536, 1);
+	mpi_set_param("GET_STR_THRESHOLD", get_str);
+
+	size_t llt_fft = crossover("LLT_FFT_THRESHOLD", work_llt, prepare_llt, 5, 4096, 0);
+
+	printf("/* Generated by tune; 'make params' regenerates this file for the build machine. */\n");
+	printf("#ifndef MPI_PARAMS_H\n");
+	printf("#define MPI_PARAMS_H\n\n");
+	printf("/* operands from this many limbs on are multiplied by Karatsuba */\n");
+	printf("#define MUL_KARATSUBA_THRESHOLD %zu\n\n", karatsuba);
+	printf("/* operands from this many limbs on are multiplied by the NTT */\n");
+	printf("#define MUL_NTT_THRESHOLD %zu\n\n", ntt);
+	printf("/* decimal strings up to this many digits are parsed by the basecase */\n");
+	printf("#define SET_STR_THRESHOLD %zu\n\n", set_str);
+	printf("/* numbers up to this many decimal digits are printed by the basecase */\n");
+	printf("#define GET_STR_THRESHOLD %zu\n\n", get_str);
+	printf("/* Mersenne exponents from this one on use the IBDWT in the Lucas-Lehmer test */\n");
+	printf("#define LLT_FFT_THRESHOLD %zu\n\n", llt_fft);
+	printf("#endif\n");
+
+	mpi_pow_cache_clear();
+
+	return 0;
+}